@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "memory.h"
+
+const AotChunk* aotChunks = NULL;
+
+static void loadChunk(Heap* heap, Chunk* chunk, int id, ObjFunction** functions) {
+    const AotChunk* source = &aotChunks[id];
+    chunk->id = id;
+    for (int i = 0; i < source->count; i++) writeChunk(chunk, source->code[i], source->lines[i]);
+    chunk->maxDepth = source->maxDepth;
+    for (int i = 0; i < source->constantCount; i++) {
+        const AotConstant* constant = &source->constants[i];
+        switch (constant->type) {
+            case AOT_INT: addConstant(chunk, INT_VAL(constant->integer)); break;
+            case AOT_DOUBLE: addConstant(chunk, DOUBLE_VAL(constant->number)); break;
+            case AOT_STRING:
+                addConstant(chunk, OBJ_VAL(copyString(heap, constant->chars, constant->length)));
+                break;
+            case AOT_FUNCTION: addConstant(chunk, OBJ_VAL(functions[constant->integer])); break;
+        }
+    }
+}
+
+// The program is rebuilt as the compiler left it, so every chunk has the
+// id it had there and functions made from constants are the same objects.
+int runCompiled(const AotChunk* chunks, int count) {
+    aotChunks = chunks;
+    VM vm;
+    initVM(&vm);
+    Program* program = (Program*)malloc(sizeof(Program));
+    initProgram(program);
+    MemoryAccount* previous = useMemoryAccount(&vm.memory);
+    ObjFunction** functions = (ObjFunction**)malloc(sizeof(ObjFunction*) * count);
+    functions[0] = NULL;
+    for (int i = 1; i < count; i++) {
+        functions[i] = newFunction(&program->heap);
+        functions[i]->arity = chunks[i].arity;
+        if (chunks[i].name != NULL) {
+            functions[i]->name = copyString(&program->heap, chunks[i].name, (int)strlen(chunks[i].name));
+        }
+    }
+    loadChunk(&program->heap, &program->chunk, 0, functions);
+    for (int i = 1; i < count; i++) loadChunk(&program->heap, &functions[i]->chunk, i, functions);
+    free(functions);
+    useMemoryAccount(previous);
+
+    InterpretResult result = executeCompiled(&vm, program);
+    freeVM(&vm);
+    return result == INTERPRET_RUNTIME_ERROR ? 70 : 0;
+}
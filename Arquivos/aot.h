@@ -0,0 +1,220 @@
+#ifndef APOLO_AOT_H
+#define APOLO_AOT_H
+
+#include "array.h"
+#include "object.h"
+#include "vm.h"
+
+// What programs written by apolo --emit-c are built against. Each chunk
+// becomes a C function whose stack slots are locals s0, s1, ..., with the
+// VM's stack used only to hand arguments to calls and to show the
+// collector what the locals hold at a safepoint. The chunks' bytecode,
+// lines and constants are kept too: the functions the script creates are
+// the same objects the interpreter would see, and runtime errors walk the
+// same frames to report the same lines.
+
+// Runs the chunk the VM just entered, whose arguments are at vm->stack.
+// A fiber's body is entered again at the instruction after the yield
+// vm->ip points to. False after a runtime error.
+typedef bool (*CompiledCode)(VM* vm, Value* result);
+
+typedef enum {
+    AOT_INT,
+    AOT_DOUBLE,
+    AOT_STRING,
+    AOT_FUNCTION
+} AotConstantType;
+
+// A function constant names the chunk it compiles to by id.
+typedef struct {
+    AotConstantType type;
+    int64_t integer;
+    double number;
+    const char* chars;
+    int length;
+} AotConstant;
+
+// name is NULL for the script and for blocks. run is NULL for spawned
+// blocks: they run on the interpreter of the worker's VM.
+typedef struct {
+    const char* name;
+    int arity;
+    int maxDepth;
+    int count;
+    const Byte* code;
+    const int* lines;
+    int constantCount;
+    const AotConstant* constants;
+    CompiledCode run;
+} AotChunk;
+
+typedef enum { FOR_ENTER, FOR_SKIP, FOR_ERROR } ForPrep;
+
+// The chunks of the program running, by id.
+extern const AotChunk* aotChunks;
+
+// Builds the program, runs it on a new VM and returns the exit status
+// apolo would give for it.
+int runCompiled(const AotChunk* chunks, int count);
+// Runs the script's compiled code. The VM keeps the program and frees it
+// with itself.
+InterpretResult executeCompiled(VM* vm, Program* program);
+
+// The slow paths of instructions, shared with the interpreter. Each one
+// reports its runtime error at vm->ip, which the caller points into the
+// instruction first.
+void aotUndefined(VM* vm, Value name);
+void aotNotNumbers(VM* vm);
+void aotNotNumber(VM* vm);
+bool aotAdd(VM* vm, Value a, Value b, Value* result);
+bool aotCollect(VM* vm);
+bool aotArray(VM* vm, Value* elements, int count, Value* result);
+bool aotMap(VM* vm, Value* entries, int count, Value* result);
+bool aotGetIndex(VM* vm, Value target, Value index, Value* result);
+bool aotSetIndex(VM* vm, Value target, Value index, Value value);
+bool aotDeleteIndex(VM* vm, Value target, Value index);
+bool aotGetField(VM* vm, Value target, Value name, Value* result);
+Value aotInput(VM* vm);
+bool aotInputLines(VM* vm, Value count, Value* result);
+ForPrep aotForPrep(VM* vm, Value* slots);
+ForPrep aotForIn(VM* vm, Value* slots);
+// Calls, spawns and resumes take their operands from the top of the VM's
+// stack, where the caller stored its locals, and leave the result there.
+bool aotCall(VM* vm, int argCount);
+bool aotSpawn(VM* vm, ObjFunction* function);
+Value aotFiber(VM* vm, ObjFunction* function, Value* args);
+bool aotResume(VM* vm, int argCount);
+// A fiber's body hands control back to its resumer.
+void aotYield(VM* vm);
+void aotFinishFiber(VM* vm);
+
+#define AOT_AT(offset) (vm->ip = vm->chunk->code + (offset) + 1)
+#define AOT_FALSEY(value) (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+#define AOT_MUST_COLLECT() \
+    (vm->heap.bytesAllocated > vm->nextGC || vm->memory.total > vm->memory.limit)
+
+// Two ints take intOp, any other pair of numbers is done in doubles.
+#define AOT_BINARY(a, b, valueType, intOp, op, offset) \
+    do { \
+        if (LIKELY(IS_INT(a) && IS_INT(b))) { \
+            int64_t x = AS_INT(a), y = AS_INT(b); \
+            a = intOp; \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            a = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } else { \
+            AOT_AT(offset); \
+            aotNotNumbers(vm); \
+            return false; \
+        } \
+    } while (false)
+
+#define AOT_LESS(a, b, offset) AOT_BINARY(a, b, BOOL_VAL, BOOL_VAL(x < y), <, offset)
+#define AOT_GREATER(a, b, offset) AOT_BINARY(a, b, BOOL_VAL, BOOL_VAL(x > y), >, offset)
+#define AOT_SUB(a, b, offset) AOT_BINARY(a, b, DOUBLE_VAL, intValue(x - y), -, offset)
+#define AOT_MUL(a, b, offset) AOT_BINARY(a, b, DOUBLE_VAL, multiplyInts(x, y), *, offset)
+#define AOT_DIV(a, b, offset) AOT_BINARY(a, b, DOUBLE_VAL, divideInts(x, y), /, offset)
+
+#define AOT_ADD(a, b, offset) \
+    do { \
+        if (LIKELY(IS_INT(a) && IS_INT(b))) { \
+            a = intValue(AS_INT(a) + AS_INT(b)); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            a = DOUBLE_VAL(AS_NUMBER(a) + AS_NUMBER(b)); \
+        } else { \
+            Value sum; \
+            AOT_AT(offset); \
+            if (!aotAdd(vm, a, b, &sum)) return false; \
+            a = sum; \
+        } \
+    } while (false)
+
+#define AOT_EQUAL(a, b) \
+    (a = BOOL_VAL(IS_INT(a) && IS_INT(b) ? AS_INT(a) == AS_INT(b) : valuesEqual(a, b)))
+
+#define AOT_NEGATE(a, offset) \
+    do { \
+        if (!IS_NUMBER(a)) { \
+            AOT_AT(offset); \
+            aotNotNumber(vm); \
+            return false; \
+        } \
+        a = IS_INT(a) && AS_INT(a) != 0 ? INT_VAL(-AS_INT(a)) : DOUBLE_VAL(-AS_NUMBER(a)); \
+    } while (false)
+
+#define AOT_GET_GLOBAL(target, name, offset) \
+    do { \
+        Value global; \
+        if (!tableGet(vm->currentGlobals, name, &global)) { \
+            AOT_AT(offset); \
+            aotUndefined(vm, name); \
+            return false; \
+        } \
+        target = global; \
+    } while (false)
+
+#define AOT_SET_GLOBAL(name, value, offset) \
+    do { \
+        if (tableSet(vm->currentGlobals, name, value)) { \
+            tableDelete(vm->currentGlobals, name); \
+            AOT_AT(offset); \
+            aotUndefined(vm, name); \
+            return false; \
+        } \
+    } while (false)
+
+// Arrays indexed by ints in range are read and written in place.
+#define AOT_GET_INDEX(target, index, offset) \
+    do { \
+        Value element; \
+        if (IS_ARRAY(target) && IS_INT(index) && \
+            (uint64_t)AS_INT(index) < (uint64_t)AS_ARRAY(target)->count) { \
+            element = arrayGet(AS_ARRAY(target), (int)AS_INT(index)); \
+        } else { \
+            AOT_AT(offset); \
+            if (!aotGetIndex(vm, target, index, &element)) return false; \
+        } \
+        target = element; \
+    } while (false)
+
+#define AOT_SET_INDEX(target, index, value, offset) \
+    do { \
+        if (IS_ARRAY(target) && IS_INT(index) && \
+            (uint64_t)AS_INT(index) < (uint64_t)AS_ARRAY(target)->count) { \
+            arraySet(&vm->heap, AS_ARRAY(target), (int)AS_INT(index), value); \
+        } else { \
+            AOT_AT(offset); \
+            if (!aotSetIndex(vm, target, index, value)) return false; \
+        } \
+        target = value; \
+    } while (false)
+
+// Int counters can't overflow: they stop at the limit first.
+#define AOT_FOR_STEP(counter, limit, step, more) \
+    do { \
+        if (IS_INT(counter)) { \
+            int64_t next = AS_INT(counter) + AS_INT(step); \
+            more = AS_INT(step) > 0 ? next < AS_INT(limit) : next > AS_INT(limit); \
+            counter = INT_VAL(next); \
+        } else { \
+            double next = AS_DOUBLE(counter) + AS_DOUBLE(step); \
+            more = AS_DOUBLE(step) > 0 ? next < AS_DOUBLE(limit) : next > AS_DOUBLE(limit); \
+            counter = DOUBLE_VAL(next); \
+        } \
+    } while (false)
+
+// Products of ints that stay exact; -0 and anything out of range are only
+// doubles.
+static inline Value multiplyInts(int64_t a, int64_t b) {
+    int64_t product;
+    if (__builtin_mul_overflow(a, b, &product)) return DOUBLE_VAL((double)a * (double)b);
+    if (product == 0 && (a < 0 || b < 0)) return DOUBLE_VAL(-0.0);
+    return intValue(product);
+}
+
+// Quotients of ints are ints only when the division is exact.
+static inline Value divideInts(int64_t a, int64_t b) {
+    if (b == 0 || a % b != 0 || (a == 0 && b < 0)) return DOUBLE_VAL((double)a / (double)b);
+    return INT_VAL(a / b);
+}
+
+#endif
@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "memory.h"
+
+#ifdef X86_SIMD
+#include <immintrin.h>
+#endif
+
+static size_t elementSize(ObjArray* array) {
+    return array->packed ? sizeof(double) : sizeof(Value);
+}
+
+size_t arrayElementBytes(ObjArray* array) {
+    return elementSize(array) * array->capacity;
+}
+
+bool arrayReserve(Heap* heap, ObjArray* array, int capacity) {
+    if (capacity <= array->capacity) return true;
+    size_t size = elementSize(array);
+    void* elements = array->packed ? (void*)array->numbers : (void*)array->values;
+    elements = tryReallocate(elements, size * array->capacity, size * capacity, MEMORY_ARRAYS);
+    if (elements == NULL) return false;
+    if (array->packed) {
+        array->numbers = (double*)elements;
+    } else {
+        array->values = (Value*)elements;
+    }
+    heap->bytesAllocated += size * (capacity - array->capacity);
+    array->capacity = capacity;
+    return true;
+}
+
+bool arrayAppend(Heap* heap, ObjArray* array, Value value) {
+    if (array->packed && !IS_NUMBER(value)) unpackArray(heap, array);
+    if (array->count == array->capacity &&
+        !arrayReserve(heap, array, array->capacity < 8 ? 8 : array->capacity * 2)) {
+        return false;
+    }
+    if (array->packed) {
+        array->numbers[array->count++] = AS_NUMBER(value);
+    } else {
+        array->values[array->count++] = value;
+    }
+    return true;
+}
+
+void arraySet(Heap* heap, ObjArray* array, int index, Value value) {
+    if (array->packed) {
+        if (IS_NUMBER(value)) {
+            array->numbers[index] = AS_NUMBER(value);
+            return;
+        }
+        unpackArray(heap, array);
+    }
+    array->values[index] = value;
+}
+
+void unpackArray(Heap* heap, ObjArray* array) {
+    if (!array->packed) return;
+    Value* values = NULL;
+    if (array->capacity > 0) {
+        values = (Value*)reallocate(NULL, 0, sizeof(Value) * array->capacity, MEMORY_ARRAYS);
+        for (int i = 0; i < array->count; i++) values[i] = numberValue(array->numbers[i]);
+    }
+    freeArrayElements(heap, array);
+    array->packed = false;
+    array->values = values;
+    heap->bytesAllocated += sizeof(Value) * array->capacity;
+}
+
+bool packArray(Heap* heap, ObjArray* array) {
+    if (array->packed) return true;
+    for (int i = 0; i < array->count; i++) {
+        if (!IS_NUMBER(array->values[i])) return false;
+    }
+    double* numbers = NULL;
+    if (array->capacity > 0) {
+        numbers = (double*)reallocate(NULL, 0, sizeof(double) * array->capacity, MEMORY_ARRAYS);
+        for (int i = 0; i < array->count; i++) numbers[i] = AS_NUMBER(array->values[i]);
+    }
+    freeArrayElements(heap, array);
+    array->packed = true;
+    array->numbers = numbers;
+    heap->bytesAllocated += sizeof(double) * array->capacity;
+    return true;
+}
+
+void freeArrayElements(Heap* heap, ObjArray* array) {
+    size_t bytes = arrayElementBytes(array);
+    if (array->packed) {
+        reallocate(array->numbers, bytes, 0, MEMORY_ARRAYS);
+        array->numbers = NULL;
+    } else {
+        reallocate(array->values, bytes, 0, MEMORY_ARRAYS);
+        array->values = NULL;
+    }
+    heap->bytesAllocated -= bytes;
+}
+
+#ifdef X86_SIMD
+// Workers can ask at the same time; they all store the same answer.
+bool hasAVX2() {
+    static int supported = -1;
+    int known = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+    if (known < 0) {
+        __builtin_cpu_init();
+        known = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&supported, known, __ATOMIC_RELAXED);
+    }
+    return known == 1;
+}
+
+__attribute__((target("avx2")))
+static double sumAVX2(const double* numbers, int count) {
+    __m256d sums[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 4; j++) {
+            sums[j] = _mm256_add_pd(sums[j], _mm256_loadu_pd(numbers + i + 4 * j));
+        }
+    }
+    for (; i + 4 <= count; i += 4) sums[0] = _mm256_add_pd(sums[0], _mm256_loadu_pd(numbers + i));
+    __m256d sum = _mm256_add_pd(_mm256_add_pd(sums[0], sums[1]), _mm256_add_pd(sums[2], sums[3]));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += numbers[i];
+    return total;
+}
+
+__attribute__((target("avx2")))
+static double dotAVX2(const double* a, const double* b, int count) {
+    __m256d sums[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 4; j++) {
+            __m256d product = _mm256_mul_pd(_mm256_loadu_pd(a + i + 4 * j), _mm256_loadu_pd(b + i + 4 * j));
+            sums[j] = _mm256_add_pd(sums[j], product);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        sums[0] = _mm256_add_pd(sums[0], _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    __m256d sum = _mm256_add_pd(_mm256_add_pd(sums[0], sums[1]), _mm256_add_pd(sums[2], sums[3]));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+// _mm256_min_pd(x, m) is x < m ? x : m lane by lane, the same choice the
+// scalar loop makes, nan included.
+__attribute__((target("avx2")))
+static double minAVX2(const double* numbers, int count) {
+    __m256d least = _mm256_set1_pd(numbers[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) least = _mm256_min_pd(_mm256_loadu_pd(numbers + i), least);
+    double lanes[4];
+    _mm256_storeu_pd(lanes, least);
+    double result = lanes[0];
+    for (int j = 1; j < 4; j++) result = lanes[j] < result ? lanes[j] : result;
+    for (; i < count; i++) result = numbers[i] < result ? numbers[i] : result;
+    return result;
+}
+
+__attribute__((target("avx2")))
+static double maxAVX2(const double* numbers, int count) {
+    __m256d greatest = _mm256_set1_pd(numbers[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) greatest = _mm256_max_pd(_mm256_loadu_pd(numbers + i), greatest);
+    double lanes[4];
+    _mm256_storeu_pd(lanes, greatest);
+    double result = lanes[0];
+    for (int j = 1; j < 4; j++) result = lanes[j] > result ? lanes[j] : result;
+    for (; i < count; i++) result = numbers[i] > result ? numbers[i] : result;
+    return result;
+}
+
+__attribute__((target("avx2")))
+static void fillAVX2(double* numbers, int count, double value) {
+    __m256d values = _mm256_set1_pd(value);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(numbers + i, values);
+    for (; i < count; i++) numbers[i] = value;
+}
+#endif
+
+// The plain versions add in the same order as the AVX2 ones, so a script
+// gets the same sum on every machine.
+double sumNumbers(const double* numbers, int count) {
+#ifdef X86_SIMD
+    if (hasAVX2()) return sumAVX2(numbers, count);
+#endif
+    double sums[16] = {0};
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 16; j++) sums[j] += numbers[i + j];
+    }
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; j++) sums[j] += numbers[i + j];
+    }
+    double lanes[4];
+    for (int j = 0; j < 4; j++) lanes[j] = (sums[j] + sums[4 + j]) + (sums[8 + j] + sums[12 + j]);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += numbers[i];
+    return total;
+}
+
+double dotNumbers(const double* a, const double* b, int count) {
+#ifdef X86_SIMD
+    if (hasAVX2()) return dotAVX2(a, b, count);
+#endif
+    double sums[16] = {0};
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 16; j++) sums[j] += a[i + j] * b[i + j];
+    }
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; j++) sums[j] += a[i + j] * b[i + j];
+    }
+    double lanes[4];
+    for (int j = 0; j < 4; j++) lanes[j] = (sums[j] + sums[4 + j]) + (sums[8 + j] + sums[12 + j]);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+double minNumbers(const double* numbers, int count) {
+#ifdef X86_SIMD
+    if (hasAVX2()) return minAVX2(numbers, count);
+#endif
+    double result = numbers[0];
+    for (int i = 1; i < count; i++) result = numbers[i] < result ? numbers[i] : result;
+    return result;
+}
+
+double maxNumbers(const double* numbers, int count) {
+#ifdef X86_SIMD
+    if (hasAVX2()) return maxAVX2(numbers, count);
+#endif
+    double result = numbers[0];
+    for (int i = 1; i < count; i++) result = numbers[i] > result ? numbers[i] : result;
+    return result;
+}
+
+void fillNumbers(double* numbers, int count, double value) {
+#ifdef X86_SIMD
+    if (hasAVX2()) {
+        fillAVX2(numbers, count, value);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) numbers[i] = value;
+}
+
+// Doubles ordered as unsigned integers: flipping every bit of negatives and
+// just the sign bit of the rest makes the integer order the numeric one.
+static uint64_t sortKey(double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (UINT64_C(1) << 63);
+}
+
+static double fromSortKey(uint64_t key) {
+    uint64_t bits = key >> 63 ? key & ~(UINT64_C(1) << 63) : ~key;
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+#define RADIX_MIN 64
+
+// Least significant byte first, one pass per byte of the key, skipping the
+// bytes every key shares; for the small integers most arrays hold, that is
+// most of them. Short arrays are insertion sorted.
+void sortNumbers(double* numbers, int count) {
+    if (count < RADIX_MIN) {
+        for (int i = 1; i < count; i++) {
+            double number = numbers[i];
+            uint64_t key = sortKey(number);
+            int j = i;
+            for (; j > 0 && sortKey(numbers[j - 1]) > key; j--) numbers[j] = numbers[j - 1];
+            numbers[j] = number;
+        }
+        return;
+    }
+
+    uint64_t* keys = (uint64_t*)malloc(sizeof(uint64_t) * count * 2);
+    if (keys == NULL) exit(1);
+    uint64_t* scratch = keys + count;
+    static _Thread_local size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < count; i++) {
+        keys[i] = sortKey(numbers[i]);
+        for (int byte = 0; byte < 8; byte++) counts[byte][(keys[i] >> (8 * byte)) & 0xff]++;
+    }
+
+    for (int byte = 0; byte < 8; byte++) {
+        int shift = 8 * byte;
+        if (counts[byte][(keys[0] >> shift) & 0xff] == (size_t)count) continue;
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digitCount = counts[byte][digit];
+            counts[byte][digit] = offset;
+            offset += digitCount;
+        }
+        for (int i = 0; i < count; i++) scratch[counts[byte][(keys[i] >> shift) & 0xff]++] = keys[i];
+        uint64_t* sorted = scratch;
+        scratch = keys;
+        keys = sorted;
+    }
+
+    for (int i = 0; i < count; i++) numbers[i] = fromSortKey(keys[i]);
+    free(keys < scratch ? keys : scratch);
+}
@@ -0,0 +1,42 @@
+#ifndef APOLO_ARRAY_H
+#define APOLO_ARRAY_H
+
+#include "object.h"
+
+// The most elements an array can hold, so capacities never overflow an int.
+#define ARRAY_MAX (1 << 28)
+
+// Element storage grows through tryReallocate() as MEMORY_ARRAYS and
+// counts towards the heap's bytesAllocated, so big arrays bring the next
+// collection forward like big strings do. Both are false, with the array
+// unchanged, when it can't grow.
+bool arrayReserve(Heap* heap, ObjArray* array, int capacity);
+bool arrayAppend(Heap* heap, ObjArray* array, Value value);
+// index must be in bounds. Storing anything but a number unpacks the array.
+void arraySet(Heap* heap, ObjArray* array, int index, Value value);
+void unpackArray(Heap* heap, ObjArray* array);
+// Goes back to packed storage if every element is a number; false if one
+// isn't.
+bool packArray(Heap* heap, ObjArray* array);
+void freeArrayElements(Heap* heap, ObjArray* array);
+size_t arrayElementBytes(ObjArray* array);
+
+static inline Value arrayGet(ObjArray* array, int index) {
+    return array->packed ? DOUBLE_VAL(array->numbers[index]) : array->values[index];
+}
+
+// Kernels over packed elements. They use AVX2 when the processor has it,
+// and plain loops otherwise. Sums and dot products add four lanes at a
+// time, so their last bits can differ from adding left to right. min and
+// max give nan if the first element is nan and skip nan elsewhere, as a
+// loop keeping the smallest so far with < would.
+double sumNumbers(const double* numbers, int count);
+double dotNumbers(const double* a, const double* b, int count);
+double minNumbers(const double* numbers, int count);
+double maxNumbers(const double* numbers, int count);
+void fillNumbers(double* numbers, int count, double value);
+// Ascending, with -0 before 0 and nan at the end (or the start, for nan
+// with the sign bit set).
+void sortNumbers(double* numbers, int count);
+
+#endif
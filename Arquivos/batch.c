@@ -0,0 +1,216 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "io.h"
+#include "vm.h"
+
+typedef struct {
+    char* path;
+    int status;
+    double seconds;
+    char* out;
+    int outLength;
+    char* err;
+    int errLength;
+    bool done;
+} Job;
+
+typedef struct {
+    Job* jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} Batch;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* copyChars(const char* chars, int length) {
+    char* copy = (char*)malloc(length + 1);
+    if (length > 0) memcpy(copy, chars, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static void addJob(Batch* batch, int* capacity, char* path) {
+    if (*capacity < batch->count + 1) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        batch->jobs = (Job*)realloc(batch->jobs, sizeof(Job) * *capacity);
+    }
+    Job* job = &batch->jobs[batch->count++];
+    memset(job, 0, sizeof(Job));
+    job->path = path;
+}
+
+static int comparePaths(const void* a, const void* b) {
+    return strcmp(((const Job*)a)->path, ((const Job*)b)->path);
+}
+
+// A directory contributes its .apo files in name order; any other file is a
+// list of paths, one per line.
+static bool collectJobs(Batch* batch, const char* target) {
+    int capacity = 0;
+    struct stat info;
+    if (stat(target, &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(target);
+        if (dir == NULL) return false;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int length = (int)strlen(entry->d_name);
+            if (length <= 4 || strcmp(entry->d_name + length - 4, ".apo") != 0) continue;
+            int dirLength = (int)strlen(target);
+            char* path = (char*)malloc(dirLength + length + 2);
+            sprintf(path, "%s/%s", target, entry->d_name);
+            addJob(batch, &capacity, path);
+        }
+        closedir(dir);
+        qsort(batch->jobs, batch->count, sizeof(Job), comparePaths);
+        return true;
+    }
+
+    FileView list;
+    if (!openFileView(target, &list)) return false;
+    const char* line = list.chars;
+    const char* end = list.chars + list.length;
+    while (line < end) {
+        const char* newline = (const char*)memchr(line, '\n', end - line);
+        const char* lineEnd = newline != NULL ? newline : end;
+        int length = (int)(lineEnd - line);
+        if (length > 0 && line[length - 1] == '\r') length--;
+        if (length > 0) addJob(batch, &capacity, copyChars(line, length));
+        line = lineEnd + 1;
+    }
+    closeFileView(&list);
+    return true;
+}
+
+static void runJob(VM* vm, Job* job) {
+    double start = now();
+    FileView source;
+    if (!openFileView(job->path, &source)) {
+        writeOutputFormat(&vm->err, "Could not open file \"%s\".\n", job->path);
+        job->status = 74;
+    } else {
+        InterpretResult result = interpret(vm, source.chars);
+        closeFileView(&source);
+        if (result == INTERPRET_COMPILE_ERROR) job->status = 65;
+        if (result == INTERPRET_RUNTIME_ERROR) job->status = 70;
+    }
+    job->seconds = now() - start;
+    job->out = copyChars(vm->out.chars, vm->out.count);
+    job->outLength = vm->out.count;
+    job->err = copyChars(vm->err.chars, vm->err.count);
+    job->errLength = vm->err.count;
+    resetVM(vm);
+}
+
+// Workers keep one VM for all the scripts they take, capturing its output in
+// memory. Scripts run without standard input.
+static void* worker(void* arg) {
+    Batch* batch = (Batch*)arg;
+    VM vm;
+    initVM(&vm);
+    initOutput(&vm.out, NULL);
+    initOutput(&vm.err, NULL);
+    freeInput(&vm.in);
+    initInput(&vm.in, NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next < batch->count ? batch->next++ : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if (index < 0) break;
+
+        Job* job = &batch->jobs[index];
+        runJob(&vm, job);
+
+        pthread_mutex_lock(&batch->lock);
+        job->done = true;
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    freeVM(&vm);
+    return NULL;
+}
+
+// Output is released in list order as soon as every earlier script is done,
+// so a slow script holds back later ones but never reorders them.
+static void writeResult(Job* job) {
+    printf("==> %s <==\n", job->path);
+    fwrite(job->out, 1, job->outLength, stdout);
+    fflush(stdout);
+    if (job->errLength > 0) {
+        fprintf(stderr, "==> %s <==\n", job->path);
+        fwrite(job->err, 1, job->errLength, stderr);
+        fflush(stderr);
+    }
+    free(job->out);
+    free(job->err);
+    job->out = NULL;
+    job->err = NULL;
+}
+
+static void writeSummary(Batch* batch, int jobs, double wall) {
+    double total = 0;
+    int failures = 0;
+    fprintf(stderr, "\n  status      time  script\n");
+    for (int i = 0; i < batch->count; i++) {
+        Job* job = &batch->jobs[i];
+        fprintf(stderr, "  %6d %7.2f ms  %s\n", job->status, job->seconds * 1000, job->path);
+        total += job->seconds;
+        if (job->status != 0) failures++;
+    }
+    fprintf(stderr, "%d scripts, %d failed; %.3f s of script time in %.3f s on %d jobs\n",
+            batch->count, failures, total, wall, jobs);
+}
+
+int runBatch(const char* target, int jobs) {
+    Batch batch;
+    batch.jobs = NULL;
+    batch.count = 0;
+    batch.next = 0;
+    if (!collectJobs(&batch, target)) {
+        fprintf(stderr, "Could not read \"%s\".\n", target);
+        return 74;
+    }
+    if (jobs > batch.count) jobs = batch.count;
+    if (jobs < 1) jobs = 1;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+    double start = now();
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * jobs);
+    for (int i = 0; i < jobs; i++) {
+        pthread_create(&threads[i], NULL, worker, &batch);
+    }
+
+    int status = 0;
+    for (int i = 0; i < batch.count; i++) {
+        pthread_mutex_lock(&batch.lock);
+        while (!batch.jobs[i].done) pthread_cond_wait(&batch.finished, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+        writeResult(&batch.jobs[i]);
+        if (batch.jobs[i].status > status) status = batch.jobs[i].status;
+    }
+
+    for (int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+    writeSummary(&batch, jobs, now() - start);
+
+    free(threads);
+    for (int i = 0; i < batch.count; i++) free(batch.jobs[i].path);
+    free(batch.jobs);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.finished);
+    return status;
+}
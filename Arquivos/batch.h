@@ -0,0 +1,10 @@
+#ifndef APOLO_BATCH_H
+#define APOLO_BATCH_H
+
+// Runs every script named by target, a directory of .apo files or a file
+// listing one script path per line, on a pool of jobs worker threads. Each
+// script's output is written in list order, followed by a timing summary on
+// stderr. Returns the highest exit status of any script (0, 65, 70 or 74).
+int runBatch(const char* target, int jobs);
+
+#endif
@@ -0,0 +1,190 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "channel.h"
+
+bool packMessage(Value value, Message* message) {
+    switch (value.type) {
+        case VAL_NIL:
+            message->type = MESSAGE_NIL;
+            return true;
+        case VAL_BOOL:
+            message->type = MESSAGE_BOOL;
+            message->as.boolean = AS_BOOL(value);
+            return true;
+        case VAL_DOUBLE:
+            message->type = MESSAGE_DOUBLE;
+            message->as.number = AS_DOUBLE(value);
+            return true;
+        case VAL_INT:
+            message->type = MESSAGE_INT;
+            message->as.integer = AS_INT(value);
+            return true;
+        case VAL_OBJ:
+            break;
+    }
+    if (IS_STRING(value)) {
+        ObjString* string = AS_STRING(value);
+        message->type = MESSAGE_STRING;
+        message->as.string.chars = (char*)malloc(string->length + 1);
+        memcpy(message->as.string.chars, string->chars, string->length);
+        message->as.string.chars[string->length] = '\0';
+        message->as.string.length = string->length;
+        return true;
+    }
+    if (IS_CHANNEL(value)) {
+        message->type = MESSAGE_CHANNEL;
+        message->as.channel = AS_CHANNEL(value)->channel;
+        retainChannel(message->as.channel);
+        return true;
+    }
+    return false;
+}
+
+// Moves the message into heap; the message is left empty.
+Value unpackMessage(Heap* heap, Message* message) {
+    Value value = NIL_VAL;
+    switch (message->type) {
+        case MESSAGE_NIL: break;
+        case MESSAGE_BOOL: value = BOOL_VAL(message->as.boolean); break;
+        case MESSAGE_DOUBLE: value = DOUBLE_VAL(message->as.number); break;
+        case MESSAGE_INT: value = INT_VAL(message->as.integer); break;
+        case MESSAGE_STRING:
+            value = OBJ_VAL(takeString(heap, message->as.string.chars, message->as.string.length));
+            break;
+        case MESSAGE_CHANNEL:
+            value = OBJ_VAL(newChannelObject(heap, message->as.channel));
+            break;
+    }
+    message->type = MESSAGE_NIL;
+    return value;
+}
+
+void freeMessage(Message* message) {
+    if (message->type == MESSAGE_STRING) free(message->as.string.chars);
+    if (message->type == MESSAGE_CHANNEL) releaseChannel(message->as.channel);
+    message->type = MESSAGE_NIL;
+}
+
+Channel* newChannel(int capacity) {
+    size_t size = 2;
+    while (size < (size_t)capacity) size *= 2;
+    Channel* channel = (Channel*)malloc(sizeof(Channel));
+    channel->slots = (Slot*)malloc(sizeof(Slot) * size);
+    for (size_t i = 0; i < size; i++) atomic_init(&channel->slots[i].sequence, i);
+    channel->mask = size - 1;
+    atomic_init(&channel->head, 0);
+    atomic_init(&channel->tail, 0);
+    atomic_init(&channel->senders, 0);
+    atomic_init(&channel->refs, 1);
+    atomic_init(&channel->closed, false);
+    return channel;
+}
+
+void retainChannel(Channel* channel) {
+    atomic_fetch_add_explicit(&channel->refs, 1, memory_order_relaxed);
+}
+
+void releaseChannel(Channel* channel) {
+    if (atomic_fetch_sub_explicit(&channel->refs, 1, memory_order_acq_rel) != 1) return;
+    Message message;
+    size_t tail = atomic_load(&channel->tail);
+    for (size_t position = atomic_load(&channel->head); position != tail; position++) {
+        message = channel->slots[position & channel->mask].message;
+        freeMessage(&message);
+    }
+    free(channel->slots);
+    free(channel);
+}
+
+void closeChannel(Channel* channel) {
+    atomic_store(&channel->closed, true);
+}
+
+static bool trySend(Channel* channel, Message* message) {
+    size_t position = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    for (;;) {
+        Slot* slot = &channel->slots[position & channel->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->tail, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->message = *message;
+                atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static bool tryReceive(Channel* channel, Message* message) {
+    size_t position = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    for (;;) {
+        Slot* slot = &channel->slots[position & channel->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->head, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *message = slot->message;
+                atomic_store_explicit(&slot->sequence, position + channel->mask + 1,
+                                      memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = atomic_load_explicit(&channel->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Waiting spins briefly, then gives up the core, then sleeps, so a blocked
+// VM costs little when its partner is slow but reacts fast when it is not.
+static void backoff(int* attempts) {
+    (*attempts)++;
+    if (*attempts < 64) return;
+    if (*attempts < 256) {
+        sched_yield();
+        return;
+    }
+    struct timespec pause = {0, 50000};
+    nanosleep(&pause, NULL);
+}
+
+// A send that saw the channel open may still be writing its slot after
+// the channel is closed; it counts itself in senders until it is done.
+bool channelSend(Channel* channel, Message* message) {
+    atomic_fetch_add(&channel->senders, 1);
+    bool sent = false;
+    int attempts = 0;
+    while (!atomic_load(&channel->closed)) {
+        if (trySend(channel, message)) {
+            sent = true;
+            break;
+        }
+        backoff(&attempts);
+    }
+    atomic_fetch_sub(&channel->senders, 1);
+    return sent;
+}
+
+// Once the channel is closed and no send is under way, every value sent
+// is in its slot, and an empty queue stays empty.
+bool channelReceive(Channel* channel, Message* message) {
+    int attempts = 0;
+    for (;;) {
+        if (tryReceive(channel, message)) return true;
+        if (atomic_load(&channel->closed) && atomic_load(&channel->senders) == 0) {
+            return tryReceive(channel, message);
+        }
+        backoff(&attempts);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef APOLO_CHANNEL_H
+#define APOLO_CHANNEL_H
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "object.h"
+
+// A value on its way from one VM to another. Strings travel as private
+// copies of their characters, channels as a reference; anything else can't
+// leave the heap it was made in.
+typedef enum {
+    MESSAGE_NIL,
+    MESSAGE_BOOL,
+    MESSAGE_DOUBLE,
+    MESSAGE_INT,
+    MESSAGE_STRING,
+    MESSAGE_CHANNEL,
+} MessageType;
+
+typedef struct {
+    MessageType type;
+    union {
+        bool boolean;
+        double number;
+        int64_t integer;
+        struct {
+            char* chars;
+            int length;
+        } string;
+        Channel* channel;
+    } as;
+} Message;
+
+typedef struct {
+    atomic_size_t sequence;
+    Message message;
+} Slot;
+
+// Bounded multi-producer, multi-consumer queue shared by any number of VMs.
+// Each slot's sequence number says whether it is ready for the sender or
+// the receiver of a given position, so head and tail are claimed with a
+// single compare-and-swap and no lock is ever taken. Head and tail are kept
+// on separate cache lines so senders and receivers don't contend. senders
+// counts the sends under way, so receivers of a closed channel can wait
+// for the last values still being written. The channel is freed when the
+// last VM holding it lets go.
+struct Channel {
+    atomic_size_t head;
+    char headPadding[64 - sizeof(atomic_size_t)];
+    atomic_size_t tail;
+    atomic_int senders;
+    char tailPadding[64 - sizeof(atomic_size_t) - sizeof(atomic_int)];
+    atomic_int refs;
+    atomic_bool closed;
+    size_t mask;
+    Slot* slots;
+};
+
+bool packMessage(Value value, Message* message);
+Value unpackMessage(Heap* heap, Message* message);
+void freeMessage(Message* message);
+
+Channel* newChannel(int capacity);
+void retainChannel(Channel* channel);
+void releaseChannel(Channel* channel);
+void closeChannel(Channel* channel);
+// Both block while the channel is full or empty. channelSend() fails once
+// the channel is closed; channelReceive() fails once it is also drained.
+bool channelSend(Channel* channel, Message* message);
+bool channelReceive(Channel* channel, Message* message);
+
+#endif
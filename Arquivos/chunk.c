@@ -1,7 +1,87 @@
 #include <stdlib.h>
+#include <string.h>
 #include "chunk.h"
+#include "memory.h"
+
+const char* const opcodeNames[OP_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUB] = "OP_SUB",
+    [OP_MUL] = "OP_MUL",
+    [OP_DIV] = "OP_DIV",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ARRAY] = "OP_ARRAY",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_MAP] = "OP_MAP",
+    [OP_DELETE_INDEX] = "OP_DELETE_INDEX",
+    [OP_GET_FIELD] = "OP_GET_FIELD",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_INPUT] = "OP_INPUT",
+    [OP_INPUT_LINES] = "OP_INPUT_LINES",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+    [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+    [OP_POP_JUMP_IF_TRUE] = "OP_POP_JUMP_IF_TRUE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_FOR_PREP] = "OP_FOR_PREP",
+    [OP_FOR_LOOP] = "OP_FOR_LOOP",
+    [OP_FOR_IN] = "OP_FOR_IN",
+    [OP_CALL] = "OP_CALL",
+    [OP_SPAWN] = "OP_SPAWN",
+    [OP_FIBER] = "OP_FIBER",
+    [OP_RESUME] = "OP_RESUME",
+    [OP_YIELD] = "OP_YIELD",
+    [OP_IMPORT] = "OP_IMPORT",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_RETURN_CALL] = "OP_RETURN_CALL",
+};
+
+// Bytes that follow each opcode in the code array.
+const Byte opcodeOperands[OP_COUNT] = {
+    [OP_CONSTANT] = 1,
+    [OP_GET_LOCAL] = 1,
+    [OP_SET_LOCAL] = 1,
+    [OP_GET_GLOBAL] = 1,
+    [OP_DEFINE_GLOBAL] = 1,
+    [OP_SET_GLOBAL] = 1,
+    [OP_ARRAY] = 1,
+    [OP_MAP] = 1,
+    [OP_GET_FIELD] = 1,
+    [OP_JUMP] = 2,
+    [OP_JUMP_IF_FALSE] = 2,
+    [OP_JUMP_IF_TRUE] = 2,
+    [OP_POP_JUMP_IF_FALSE] = 2,
+    [OP_POP_JUMP_IF_TRUE] = 2,
+    [OP_LOOP] = 2,
+    [OP_FOR_PREP] = 3,
+    [OP_FOR_LOOP] = 3,
+    [OP_FOR_IN] = 3,
+    [OP_CALL] = 1,
+    [OP_SPAWN] = 1,
+    [OP_FIBER] = 1,
+    [OP_RESUME] = 1,
+    [OP_IMPORT] = 1,
+};
 
 void initChunk(Chunk* chunk) {
+    chunk->id = 0;
+    chunk->module = 0;
+    chunk->maxDepth = 0;
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
@@ -10,8 +90,8 @@ void initChunk(Chunk* chunk) {
 }
 
 void freeChunk(Chunk* chunk) {
-    free(chunk->code);
-    free(chunk->lines);
+    reallocate(chunk->code, sizeof(Byte) * chunk->capacity, 0, MEMORY_CODE);
+    reallocate(chunk->lines, sizeof(int) * chunk->capacity, 0, MEMORY_CODE);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
@@ -20,8 +100,10 @@ void writeChunk(Chunk* chunk, Byte byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
-        chunk->code = (Byte*)realloc(chunk->code, sizeof(Byte) * chunk->capacity);
-        chunk->lines = (int*)realloc(chunk->lines, sizeof(int) * chunk->capacity);
+        chunk->code = (Byte*)reallocate(chunk->code, sizeof(Byte) * oldCapacity,
+                                        sizeof(Byte) * chunk->capacity, MEMORY_CODE);
+        chunk->lines = (int*)reallocate(chunk->lines, sizeof(int) * oldCapacity,
+                                        sizeof(int) * chunk->capacity, MEMORY_CODE);
     }
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
@@ -31,4 +113,23 @@ void writeChunk(Chunk* chunk, Byte byte, int line) {
 int addConstant(Chunk* chunk, Value value) {
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
+}
+
+int instructionStart(const Chunk* chunk, int offset) {
+    int start = 0;
+    while (start < chunk->count) {
+        int next = start + 1 + opcodeOperands[chunk->code[start]];
+        if (next > offset) break;
+        start = next;
+    }
+    return start;
+}
+
+int opcodeNameWidth() {
+    int width = 0;
+    for (int i = 0; i < OP_COUNT; i++) {
+        int length = (int)strlen(opcodeNames[i]);
+        if (length > width) width = length;
+    }
+    return width;
 }
\ No newline at end of file
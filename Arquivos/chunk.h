@@ -24,15 +24,45 @@ typedef enum {
     OP_DIV,
     OP_NOT,
     OP_NEGATE,
+    OP_ARRAY,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_MAP,
+    OP_DELETE_INDEX,
+    OP_GET_FIELD,
     OP_PRINT,
     OP_INPUT,
+    OP_INPUT_LINES,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
+    OP_POP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_TRUE,
     OP_LOOP,
+    OP_FOR_PREP,
+    OP_FOR_LOOP,
+    OP_FOR_IN,
+    OP_CALL,
+    OP_SPAWN,
+    OP_FIBER,
+    OP_RESUME,
+    OP_YIELD,
+    OP_IMPORT,
     OP_RETURN,
+    OP_RETURN_CALL,
+    OP_COUNT
 } OpCode;
 
+// id numbers the chunks of one program in the order the compiler creates
+// them, the script's own being 0, so the same source always gives the same
+// ids; traces use it to name chunks, along with module, the number of the
+// module the program was compiled as, or 0 for a script. maxDepth is the most values the code
+// ever has on the stack, counting its parameters and locals, so the VM can
+// make room for it once instead of checking every push.
 typedef struct {
+    int id;
+    int module;
+    int maxDepth;
     int count;
     int capacity;
     Byte* code;
@@ -40,9 +70,17 @@ typedef struct {
     ValueArray constants;
 } Chunk;
 
+extern const char* const opcodeNames[OP_COUNT];
+extern const Byte opcodeOperands[OP_COUNT];
+
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, Byte byte, int line);
 int addConstant(Chunk* chunk, Value value);
+// Offset of the instruction whose opcode or operands are at offset. Walks
+// the code from the start, so it is meant for reports, not for the VM.
+int instructionStart(const Chunk* chunk, int offset);
+// Length of the longest name in opcodeNames, for lining up report columns.
+int opcodeNameWidth();
 
 #endif
\ No newline at end of file
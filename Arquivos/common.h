@@ -7,6 +7,23 @@
 
 typedef uint8_t Byte;
 
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define NOINLINE __attribute__((noinline))
+#define LIKELY(condition) __builtin_expect(!!(condition), 1)
+#else
+#define ALWAYS_INLINE inline
+#define NOINLINE
+#define LIKELY(condition) (condition)
+#endif
+
+// x86-64 builds carry SSE2 and AVX2 kernels; the AVX2 ones only run when
+// hasAVX2(), in array.c, finds the processor supports it.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define X86_SIMD
+bool hasAVX2();
+#endif
+
 // Uncomment to debug
 // #define DEBUG_TRACE_EXECUTION 
 // #define DEBUG_PRINT_CODE
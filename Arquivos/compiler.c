@@ -4,14 +4,13 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "number.h"
 #include "scanner.h"
 
-typedef struct {
-    Token current;
-    Token previous;
-    bool hadError;
-    bool panicMode;
-} Parser;
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
 
 typedef enum {
     PREC_NONE, PREC_ASSIGNMENT, PREC_OR, PREC_AND,
@@ -19,7 +18,9 @@ typedef enum {
     PREC_UNARY, PREC_CALL, PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign);
+typedef struct Parser Parser;
+
+typedef void (*ParseFn)(Parser* parser, bool canAssign);
 
 typedef struct {
     ParseFn prefix;
@@ -32,113 +33,231 @@ typedef struct {
     int depth;
 } Local;
 
-typedef struct {
+typedef enum {
+    TYPE_SCRIPT,
+    TYPE_SPAWN,
+    TYPE_FIBER,
+    TYPE_FUNCTION,
+} FunctionType;
+
+// function is NULL while compiling the script itself and set for the body
+// of a spawn, fiber or function, which only sees its own locals and
+// parameters.
+typedef struct Compiler {
+    struct Compiler* enclosing;
+    ObjFunction* function;
+    FunctionType type;
+    Chunk* chunk;
     Local locals[256];
     int localCount;
     int scopeDepth;
 } Compiler;
 
-Parser parser;
-Compiler* current = NULL;
-Chunk* compilingChunk;
+// Everything one compilation needs, so several can run at once.
+struct Parser {
+    Scanner scanner;
+    Token current;
+    Token previous;
+    bool hadError;
+    bool panicMode;
+    Compiler* compiler;
+    Heap* heap;
+    Output* errors;
+    int module;
+    int chunkCount;
+    // Where the last OP_GET_INDEX went, for delete to turn into
+    // OP_DELETE_INDEX when it ends its expression.
+    Chunk* indexChunk;
+    int indexOffset;
+    // Where the last OP_NOT went, for a condition that ends with it to
+    // branch the other way instead.
+    Chunk* notChunk;
+    int notOffset;
+};
 
-static Chunk* currentChunk() { return compilingChunk; }
+static Chunk* currentChunk(Parser* parser) { return parser->compiler->chunk; }
 
-static void errorAt(Token* token, const char* message) {
-    if (parser.panicMode) return;
-    parser.panicMode = true;
-    fprintf(stderr, "[Line %d] Error", token->line);
-    if (token->type == TOKEN_EOF) fprintf(stderr, " at end");
-    else if (token->type != TOKEN_ERROR) fprintf(stderr, " at '%.*s'", token->length, token->start);
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+static void errorAt(Parser* parser, Token* token, const char* message) {
+    if (parser->panicMode) return;
+    parser->panicMode = true;
+    writeOutputFormat(parser->errors, "[Line %d] Error", token->line);
+    if (token->type == TOKEN_EOF) writeOutputFormat(parser->errors, " at end");
+    else if (token->type != TOKEN_ERROR) writeOutputFormat(parser->errors, " at '%.*s'", token->length, token->start);
+    writeOutputFormat(parser->errors, ": %s\n", message);
+    parser->hadError = true;
 }
 
-static void errorAtCurrent(const char* message) { errorAt(&parser.current, message); }
-static void advance() {
-    parser.previous = parser.current;
+static void errorAtCurrent(Parser* parser, const char* message) { errorAt(parser, &parser->current, message); }
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) break;
-        errorAtCurrent(parser.current.start);
+        parser->current = scanToken(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
+        errorAtCurrent(parser, parser->current.start);
     }
 }
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) { advance(); return; }
-    errorAtCurrent(message);
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (parser->current.type == type) { advance(parser); return; }
+    errorAtCurrent(parser, message);
 }
-static bool match(TokenType type) {
-    if (parser.current.type != type) return false;
-    advance(); return true;
+static bool match(Parser* parser, TokenType type) {
+    if (parser->current.type != type) return false;
+    advance(parser); return true;
 }
 
-static void emitByte(Byte byte) { writeChunk(currentChunk(), byte, parser.previous.line); }
-static void emitBytes(Byte byte1, Byte byte2) { emitByte(byte1); emitByte(byte2); }
-static void emitReturn() { emitByte(OP_RETURN); }
+static void emitByte(Parser* parser, Byte byte) { writeChunk(currentChunk(parser), byte, parser->previous.line); }
+static void emitBytes(Parser* parser, Byte byte1, Byte byte2) { emitByte(parser, byte1); emitByte(parser, byte2); }
+static void emitReturn(Parser* parser) { emitByte(parser, OP_RETURN); }
 
-static int makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
-    if (constant > 255) { errorAtCurrent("Too many constants in one chunk."); return 0; }
+static int makeConstant(Parser* parser, Value value) {
+    int constant = addConstant(currentChunk(parser), value);
+    if (constant > 255) { errorAtCurrent(parser, "Too many constants in one chunk."); return 0; }
     return constant;
 }
 
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, (Byte)makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+    emitBytes(parser, OP_CONSTANT, (Byte)makeConstant(parser, value));
 }
 
-static void initCompiler(Compiler* compiler) {
+static void initCompiler(Parser* parser, Compiler* compiler, Chunk* chunk) {
+    compiler->enclosing = parser->compiler;
+    compiler->function = NULL;
+    compiler->type = TYPE_SCRIPT;
+    compiler->chunk = chunk;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    current = compiler;
+    parser->compiler = compiler;
 }
 
 // Forward declarations
-static void expression();
-static void statement();
-static void declaration();
+static void expression(Parser* parser);
+static void statement(Parser* parser);
+static void declaration(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
+static void block(Parser* parser);
+static void addLocal(Parser* parser, Token name);
+static int emitJump(Parser* parser, Byte instruction);
+static void patchJump(Parser* parser, int offset);
+
+static void emitNot(Parser* parser) {
+    emitByte(parser, OP_NOT);
+    parser->notChunk = currentChunk(parser);
+    parser->notOffset = currentChunk(parser)->count - 1;
+}
 
-static void binary(bool canAssign) {
-    TokenType operatorType = parser.previous.type;
+static void binary(Parser* parser, bool canAssign) {
+    TokenType operatorType = parser->previous.type;
     ParseRule* rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
     switch (operatorType) {
-        case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUB); break;
-        case TOKEN_STAR:          emitByte(OP_MUL); break;
-        case TOKEN_SLASH:         emitByte(OP_DIV); break;
+        case TOKEN_BANG_EQUAL:    emitByte(parser, OP_EQUAL); emitNot(parser); break;
+        case TOKEN_EQUAL_EQUAL:   emitByte(parser, OP_EQUAL); break;
+        case TOKEN_GREATER:       emitByte(parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emitByte(parser, OP_LESS); emitNot(parser); break;
+        case TOKEN_LESS:          emitByte(parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL:    emitByte(parser, OP_GREATER); emitNot(parser); break;
+        case TOKEN_PLUS:          emitByte(parser, OP_ADD); break;
+        case TOKEN_MINUS:         emitByte(parser, OP_SUB); break;
+        case TOKEN_STAR:          emitByte(parser, OP_MUL); break;
+        case TOKEN_SLASH:         emitByte(parser, OP_DIV); break;
         default: return;
     }
 }
 
-static void literal(bool canAssign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL:   emitByte(OP_NIL); break;
-        case TOKEN_TRUE:  emitByte(OP_TRUE); break;
+static Byte argumentList(Parser* parser) {
+    Byte argCount = 0;
+    if (parser->current.type != TOKEN_RIGHT_PAREN) {
+        do {
+            expression(parser);
+            if (argCount == 255) errorAtCurrent(parser, "Can't have more than 255 arguments.");
+            argCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
+static void call(Parser* parser, bool canAssign) {
+    Byte argCount = argumentList(parser);
+    emitBytes(parser, OP_CALL, argCount);
+}
+
+static void arrayLiteral(Parser* parser, bool canAssign) {
+    int count = 0;
+    if (parser->current.type != TOKEN_RIGHT_BRACKET) {
+        do {
+            expression(parser);
+            if (count == 255) errorAtCurrent(parser, "Can't have more than 255 elements in an array literal.");
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+    emitBytes(parser, OP_ARRAY, (Byte)count);
+}
+
+static void subscript(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitByte(parser, OP_SET_INDEX);
+    } else {
+        parser->indexChunk = currentChunk(parser);
+        parser->indexOffset = currentChunk(parser)->count;
+        emitByte(parser, OP_GET_INDEX);
+    }
+}
+
+// module.name reads one of an imported module's globals.
+static void dot(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect name after '.'.");
+    Token name = parser->previous;
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        errorAt(parser, &name, "Can't assign to a module's globals from outside it.");
+    }
+    ObjString* key = copyString(parser->heap, name.start, name.length);
+    emitBytes(parser, OP_GET_FIELD, (Byte)makeConstant(parser, OBJ_VAL(key)));
+}
+
+// Each entry takes two stack slots until OP_MAP gathers them.
+static void mapLiteral(Parser* parser, bool canAssign) {
+    int count = 0;
+    if (parser->current.type != TOKEN_RIGHT_BRACE) {
+        do {
+            expression(parser);
+            consume(parser, TOKEN_COLON, "Expect ':' after map key.");
+            expression(parser);
+            if (count == 255) errorAtCurrent(parser, "Can't have more than 255 entries in a map literal.");
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    emitBytes(parser, OP_MAP, (Byte)count);
+}
+
+static void literal(Parser* parser, bool canAssign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE: emitByte(parser, OP_FALSE); break;
+        case TOKEN_NIL:   emitByte(parser, OP_NIL); break;
+        case TOKEN_TRUE:  emitByte(parser, OP_TRUE); break;
         default: return;
     }
 }
 
-static void grouping(bool canAssign) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number(bool canAssign) {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser, bool canAssign) {
+    double value;
+    parseNumber(parser->previous.start, parser->previous.length, &value);
+    emitConstant(parser, numberValue(value));
 }
 
-static void string(bool canAssign) {
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+static void string(Parser* parser, bool canAssign) {
+    emitConstant(parser, OBJ_VAL(copyString(parser->heap, parser->previous.start + 1, parser->previous.length - 2)));
 }
 
 static int resolveLocal(Compiler* compiler, Token* name) {
@@ -152,53 +271,293 @@ static int resolveLocal(Compiler* compiler, Token* name) {
     return -1;
 }
 
-static void namedVariable(Token name, bool canAssign) {
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
     uint8_t getOp, setOp;
-    int arg = resolveLocal(current, &name);
+    int arg = resolveLocal(parser->compiler, &name);
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     } else {
-        arg = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
+        arg = makeConstant(parser, OBJ_VAL(copyString(parser->heap, name.start, name.length)));
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(setOp, (Byte)arg);
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitBytes(parser, setOp, (Byte)arg);
     } else {
-        emitBytes(getOp, (Byte)arg);
+        emitBytes(parser, getOp, (Byte)arg);
     }
 }
 
-static void variable(bool canAssign) {
-    namedVariable(parser.previous, canAssign);
+static void variable(Parser* parser, bool canAssign) {
+    namedVariable(parser, parser->previous, canAssign);
 }
 
-static void unary(bool canAssign) {
-    TokenType operatorType = parser.previous.type;
-    parsePrecedence(PREC_UNARY);
+static void unary(Parser* parser, bool canAssign) {
+    TokenType operatorType = parser->previous.type;
+    parsePrecedence(parser, PREC_UNARY);
     switch (operatorType) {
-        case TOKEN_BANG:  emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+        case TOKEN_BANG:  emitNot(parser); break;
+        case TOKEN_MINUS: emitByte(parser, OP_NEGATE); break;
         default: return;
     }
 }
 
-static void inputExpr(bool canAssign) {
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'input'.");
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after 'input'.");
-    emitByte(OP_INPUT);
+// a and b is a when a is falsey and b otherwise; a or b is a when a is
+// truthy. b is only evaluated when it is the result. The jump from a
+// lands after b, so an OP_NOT that ends b can't be folded into a branch.
+static void and_(Parser* parser, bool canAssign) {
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND);
+    patchJump(parser, endJump);
+    parser->notChunk = NULL;
+}
+
+static void or_(Parser* parser, bool canAssign) {
+    int endJump = emitJump(parser, OP_JUMP_IF_TRUE);
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
+    parser->notChunk = NULL;
+}
+
+static void inputExpr(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'input'.");
+    if (match(parser, TOKEN_RIGHT_PAREN)) {
+        emitByte(parser, OP_INPUT);
+        return;
+    }
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after line count.");
+    emitByte(parser, OP_INPUT_LINES);
+}
+
+// import "path" evaluates to the module in the file at path, relative to
+// the working directory. Its code runs the first time a VM imports it;
+// after that, import only looks the module up.
+static void importExpr(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_STRING, "Expect module path after 'import'.");
+    ObjString* path = copyString(parser->heap, parser->previous.start + 1, parser->previous.length - 2);
+    emitBytes(parser, OP_IMPORT, (Byte)makeConstant(parser, OBJ_VAL(path)));
+}
+
+// How many values an instruction leaves on the stack, less how many it
+// takes. spawn and fiber take the captures of the block they start.
+static int stackEffect(Chunk* chunk, int offset) {
+    Byte* code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_INPUT:
+        case OP_IMPORT:
+            return 1;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_GET_INDEX:
+        case OP_PRINT:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+            return -1;
+        case OP_SET_INDEX:
+        case OP_DELETE_INDEX:
+            return -2;
+        case OP_ARRAY: return 1 - code[1];
+        case OP_MAP: return 1 - 2 * code[1];
+        case OP_CALL: return -code[1];
+        case OP_RESUME: return 1 - code[1];
+        case OP_SPAWN:
+        case OP_FIBER:
+            return 1 - AS_FUNCTION(chunk->constants.values[code[1]])->arity;
+        default:
+            return 0;
+    }
+}
+
+// Follows every path through a finished chunk, starting with depth values
+// (its parameters) on the stack. Every path the compiler emits into an
+// instruction arrives with the same depth, so each instruction is visited
+// once.
+int stackDepths(Chunk* chunk, int depth, int* depths) {
+    int* pending = (int*)malloc(sizeof(int) * chunk->count);
+    for (int i = 0; i < chunk->count; i++) depths[i] = -1;
+    int pendingCount = 0;
+    int maxDepth = depth;
+    depths[0] = depth;
+    pending[pendingCount++] = 0;
+    while (pendingCount > 0) {
+        int offset = pending[--pendingCount];
+        for (;;) {
+            Byte* code = &chunk->code[offset];
+            int after = depths[offset] + stackEffect(chunk, offset);
+            if (after > maxDepth) maxDepth = after;
+            int next = offset + 1 + opcodeOperands[code[0]];
+            int target = -1;
+            bool fallsThrough = true;
+            switch (code[0]) {
+                case OP_JUMP:
+                    fallsThrough = false;
+                    // Falls through.
+                case OP_JUMP_IF_FALSE:
+                case OP_JUMP_IF_TRUE:
+                case OP_POP_JUMP_IF_FALSE:
+                case OP_POP_JUMP_IF_TRUE:
+                    target = next + ((code[1] << 8) | code[2]);
+                    break;
+                case OP_LOOP:
+                    target = next - ((code[1] << 8) | code[2]);
+                    fallsThrough = false;
+                    break;
+                case OP_FOR_PREP:
+                case OP_FOR_IN:
+                    target = next + ((code[2] << 8) | code[3]);
+                    break;
+                case OP_FOR_LOOP:
+                    target = next - ((code[2] << 8) | code[3]);
+                    break;
+                case OP_RETURN:
+                case OP_RETURN_CALL:
+                    fallsThrough = false;
+                    break;
+            }
+            if (target >= 0 && target < chunk->count && depths[target] < 0) {
+                depths[target] = after;
+                pending[pendingCount++] = target;
+            }
+            if (!fallsThrough || next >= chunk->count || depths[next] >= 0) break;
+            depths[next] = after;
+            offset = next;
+        }
+    }
+    free(pending);
+    return maxDepth;
+}
+
+static int maxStackDepth(Chunk* chunk, int depth) {
+    int* depths = (int*)malloc(sizeof(int) * chunk->count);
+    int maxDepth = stackDepths(chunk, depth, depths);
+    free(depths);
+    return maxDepth;
+}
+
+// Compiles the body of a block or function, after its '{', with params as
+// its first locals. Falling off the end returns nil.
+static void functionBody(Parser* parser, ObjFunction* function, FunctionType type,
+                         Token* params, int paramCount) {
+    function->arity = paramCount;
+    function->module = parser->module;
+    function->chunk.id = ++parser->chunkCount;
+    function->chunk.module = parser->module;
+    Compiler compiler;
+    initCompiler(parser, &compiler, &function->chunk);
+    compiler.function = function;
+    compiler.type = type;
+    compiler.scopeDepth = 1;
+    for (int i = 0; i < paramCount; i++) addLocal(parser, params[i]);
+
+    block(parser);
+    emitBytes(parser, OP_NIL, type == TYPE_FUNCTION ? OP_RETURN_CALL : OP_RETURN);
+    if (!parser->hadError) function->chunk.maxDepth = maxStackDepth(&function->chunk, paramCount);
+    parser->compiler = compiler.enclosing;
+}
+
+// Compiles "(a, b) { ... }" into a function whose parameters are the
+// captured variables, after emitting code that pushes their values.
+static ObjFunction* capturingBlock(Parser* parser, FunctionType type) {
+    Token captures[UINT8_MAX];
+    int captureCount = 0;
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        if (parser->current.type != TOKEN_RIGHT_PAREN) {
+            do {
+                consume(parser, TOKEN_IDENTIFIER, "Expect variable name to capture.");
+                if (captureCount == UINT8_MAX) {
+                    errorAt(parser, &parser->previous, "Can't capture more than 255 variables.");
+                    break;
+                }
+                captures[captureCount++] = parser->previous;
+                namedVariable(parser, parser->previous, false);
+            } while (match(parser, TOKEN_COMMA));
+        }
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after captures.");
+    }
+
+    ObjFunction* function = newFunction(parser->heap);
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before block body.");
+    functionBody(parser, function, type, captures, captureCount);
+    return function;
+}
+
+// spawn (a, b) { ... } starts the block on a new thread and evaluates to a
+// worker handle for join(). The block runs in its own VM: the captured
+// variables are copied in as its locals, and everything else it names is
+// one of that VM's globals.
+static void spawnExpr(Parser* parser, bool canAssign) {
+    ObjFunction* function = capturingBlock(parser, TYPE_SPAWN);
+    emitBytes(parser, OP_SPAWN, (Byte)makeConstant(parser, OBJ_VAL(function)));
+}
+
+// fiber (a, b) { ... } makes a coroutine in this VM that starts running at
+// the first resume(). It shares the script's globals; captures are copied
+// into its locals.
+static void fiberExpr(Parser* parser, bool canAssign) {
+    ObjFunction* function = capturingBlock(parser, TYPE_FIBER);
+    emitBytes(parser, OP_FIBER, (Byte)makeConstant(parser, OBJ_VAL(function)));
+}
+
+// resume(fiber) or resume(fiber, value) runs the fiber until it yields or
+// returns and evaluates to that value; value is what its yield evaluates to.
+static void resumeExpr(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'resume'.");
+    expression(parser);
+    Byte argCount = 1;
+    if (match(parser, TOKEN_COMMA)) {
+        expression(parser);
+        argCount = 2;
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    emitBytes(parser, OP_RESUME, argCount);
+}
+
+static void yieldExpr(Parser* parser, bool canAssign) {
+    if (parser->compiler->type != TYPE_FIBER) {
+        errorAt(parser, &parser->previous, "Can't yield outside a fiber.");
+    }
+    switch (parser->current.type) {
+        case TOKEN_SEMICOLON:
+        case TOKEN_RIGHT_PAREN:
+        case TOKEN_COMMA:
+            emitByte(parser, OP_NIL);
+            break;
+        default:
+            expression(parser);
+            break;
+    }
+    emitByte(parser, OP_YIELD);
 }
 
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN]    = {grouping, NULL,   PREC_NONE},
+    [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
+    [TOKEN_LEFT_BRACE]    = {mapLiteral, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {arrayLiteral, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_DOT]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
     [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
@@ -215,16 +574,24 @@ ParseRule rules[] = {
     [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
     [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
-    [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_AND]           = {NULL,     and_,   PREC_AND},
+    [TOKEN_DELETE]        = {NULL,     NULL,   PREC_NONE},
     [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
     [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
     [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_IMPORT]        = {importExpr,NULL,  PREC_NONE},
+    [TOKEN_IN]            = {NULL,     NULL,   PREC_NONE},
     [TOKEN_NIL]           = {literal,  NULL,   PREC_NONE},
-    [TOKEN_OR]            = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
     [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_INPUT]         = {inputExpr,NULL,   PREC_NONE},
     [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_SPAWN]         = {spawnExpr,NULL,   PREC_NONE},
+    [TOKEN_FIBER]         = {fiberExpr,NULL,   PREC_NONE},
+    [TOKEN_RESUME]        = {resumeExpr,NULL,  PREC_NONE},
+    [TOKEN_YIELD]         = {yieldExpr,NULL,   PREC_NONE},
     [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
     [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
@@ -234,150 +601,424 @@ ParseRule rules[] = {
 
 static ParseRule* getRule(TokenType type) { return &rules[type]; }
 
-static void parsePrecedence(Precedence precedence) {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
-    if (prefixRule == NULL) { errorAtCurrent("Expect expression."); return; }
-    bool canAssign = precedence <= PREC_ASSIGNMENT;
-    prefixRule(canAssign);
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+// Parses operators that bind at least as tightly as precedence. Only an
+// expression parsed from the lowest precedence may be an assignment, but
+// the first operand of a condition also may.
+static void parseOperand(Parser* parser, Precedence precedence, bool canAssign) {
+    advance(parser);
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
+    if (prefixRule == NULL) { errorAtCurrent(parser, "Expect expression."); return; }
+    prefixRule(parser, canAssign);
+    while (precedence <= getRule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        infixRule(parser, canAssign);
     }
 }
 
-static void expression() { parsePrecedence(PREC_ASSIGNMENT); }
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    parseOperand(parser, precedence, precedence <= PREC_ASSIGNMENT);
+}
+
+static void expression(Parser* parser) { parsePrecedence(parser, PREC_ASSIGNMENT); }
 
-static void block() {
-    while (parser.current.type != TOKEN_RIGHT_BRACE && parser.current.type != TOKEN_EOF) {
-        declaration();
+static void block(Parser* parser) {
+    while (parser->current.type != TOKEN_RIGHT_BRACE && parser->current.type != TOKEN_EOF) {
+        declaration(parser);
     }
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void beginScope() { current->scopeDepth++; }
-static void endScope() {
-    current->scopeDepth--;
-    while (current->localCount > 0 &&
-           current->locals[current->localCount - 1].depth > current->scopeDepth) {
-        emitByte(OP_POP);
-        current->localCount--;
+static void beginScope(Parser* parser) { parser->compiler->scopeDepth++; }
+static void endScope(Parser* parser) {
+    parser->compiler->scopeDepth--;
+    while (parser->compiler->localCount > 0 &&
+           parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth) {
+        emitByte(parser, OP_POP);
+        parser->compiler->localCount--;
     }
 }
 
-static void varDeclaration() {
+static void varDeclaration(Parser* parser) {
     uint8_t global = 0;
-    if (current->scopeDepth == 0) {
-        consume(TOKEN_IDENTIFIER, "Expect variable name.");
-        global = makeConstant(OBJ_VAL(copyString(parser.previous.start, parser.previous.length)));
+    if (parser->compiler->scopeDepth == 0) {
+        consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+        global = makeConstant(parser, OBJ_VAL(copyString(parser->heap, parser->previous.start, parser->previous.length)));
     } else {
-        consume(TOKEN_IDENTIFIER, "Expect variable name.");
-        Local* local = &current->locals[current->localCount++];
-        local->name = parser.previous;
-        local->depth = current->scopeDepth;
+        consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+        addLocal(parser, parser->previous);
     }
 
-    if (match(TOKEN_EQUAL)) { expression(); } else { emitByte(OP_NIL); }
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    if (match(parser, TOKEN_EQUAL)) { expression(parser); } else { emitByte(parser, OP_NIL); }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
-    if (current->scopeDepth == 0) {
-        emitBytes(OP_DEFINE_GLOBAL, global);
+    if (parser->compiler->scopeDepth == 0) {
+        emitBytes(parser, OP_DEFINE_GLOBAL, global);
     } else {
         // Value is already on stack
     }
 }
 
-static void expressionStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);
+static void expressionStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(parser, OP_POP);
 }
 
-static int emitJump(Byte instruction) {
-    emitByte(instruction);
-    emitByte(0xff); emitByte(0xff);
-    return currentChunk()->count - 2;
+static int emitJump(Parser* parser, Byte instruction) {
+    emitByte(parser, instruction);
+    emitByte(parser, 0xff); emitByte(parser, 0xff);
+    return currentChunk(parser)->count - 2;
 }
 
-static void patchJump(int offset) {
-    int jump = currentChunk()->count - offset - 2;
-    if (jump > 65535) errorAtCurrent("Too much code to jump over.");
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+static void patchJump(Parser* parser, int offset) {
+    int jump = currentChunk(parser)->count - offset - 2;
+    if (jump > 65535) errorAtCurrent(parser, "Too much code to jump over.");
+    currentChunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    currentChunk(parser)->code[offset + 1] = jump & 0xff;
 }
 
-static void emitLoop(int loopStart) {
-    emitByte(OP_LOOP);
-    int offset = currentChunk()->count - loopStart + 2;
-    if (offset > 65535) errorAtCurrent("Loop body too large.");
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+static void emitLoop(Parser* parser, int loopStart) {
+    emitByte(parser, OP_LOOP);
+    int offset = currentChunk(parser)->count - loopStart + 2;
+    if (offset > 65535) errorAtCurrent(parser, "Loop body too large.");
+    emitByte(parser, (offset >> 8) & 0xff);
+    emitByte(parser, offset & 0xff);
 }
 
-static void ifStatement() {
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+static void addLocal(Parser* parser, Token name) {
+    if (parser->compiler->localCount == 256) {
+        errorAt(parser, &name, "Too many local variables in function.");
+        return;
+    }
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
+    local->name = name;
+    local->depth = parser->compiler->scopeDepth;
+}
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    statement();
-    
-    int elseJump = emitJump(OP_JUMP);
-    patchJump(thenJump);
-    emitByte(OP_POP);
+// for (var i = first, limit[, step]) runs its body with i counting from
+// first by step, 1 unless given, while it is below limit (above it, for a
+// negative step). The counter, limit and step sit in hidden locals under i
+// and are only type checked once, by OP_FOR_PREP; OP_FOR_LOOP then steps,
+// compares and jumps back in one instruction. The body gets a copy of the
+// counter in i, so assigning to i doesn't change how often it runs.
+// for (var name in collection): the collection and a cursor into it are
+// hidden locals, and OP_FOR_IN moves the cursor on and sets the variable
+// at the top of each iteration.
+static void forInLoop(Parser* parser, Token name) {
+    Token hidden = {TOKEN_IDENTIFIER, "(for)", 5, name.line};
+    int base = parser->compiler->localCount;
+    expression(parser);
+    addLocal(parser, hidden);
+    emitConstant(parser, INT_VAL(0));
+    addLocal(parser, hidden);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    emitByte(parser, OP_NIL);
+    addLocal(parser, name);
 
-    if (match(TOKEN_ELSE)) statement();
-    patchJump(elseJump);
+    int loopStart = currentChunk(parser)->count;
+    emitByte(parser, OP_FOR_IN);
+    int exitJump = emitJump(parser, (Byte)base);
+    statement(parser);
+    emitLoop(parser, loopStart);
+    patchJump(parser, exitJump);
 }
 
-static void whileStatement() {
-    int loopStart = currentChunk()->count;
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+static void forStatement(Parser* parser) {
+    beginScope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    consume(parser, TOKEN_VAR, "Expect 'var' after '('.");
+    consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+    Token name = parser->previous;
+    if (match(parser, TOKEN_IN)) {
+        forInLoop(parser, name);
+        endScope(parser);
+        return;
+    }
+    Token hidden = {TOKEN_IDENTIFIER, "(for)", 5, name.line};
+    int base = parser->compiler->localCount;
 
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    statement();
-    emitLoop(loopStart);
+    consume(parser, TOKEN_EQUAL, "Expect '=' after loop variable.");
+    expression(parser);
+    addLocal(parser, hidden);
+    consume(parser, TOKEN_COMMA, "Expect ',' after loop start.");
+    expression(parser);
+    addLocal(parser, hidden);
+    if (match(parser, TOKEN_COMMA)) {
+        expression(parser);
+    } else {
+        emitConstant(parser, INT_VAL(1));
+    }
+    addLocal(parser, hidden);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    emitByte(parser, OP_NIL);
+    addLocal(parser, name);
+
+    emitByte(parser, OP_FOR_PREP);
+    int exitJump = emitJump(parser, (Byte)base);
+    int bodyStart = currentChunk(parser)->count;
+    statement(parser);
 
-    patchJump(exitJump);
-    emitByte(OP_POP);
+    emitBytes(parser, OP_FOR_LOOP, (Byte)base);
+    int offset = currentChunk(parser)->count - bodyStart + 2;
+    if (offset > 65535) errorAtCurrent(parser, "Loop body too large.");
+    emitByte(parser, (offset >> 8) & 0xff);
+    emitByte(parser, offset & 0xff);
+
+    patchJump(parser, exitJump);
+    endScope(parser);
 }
 
-static void printStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+// The jumps out of a condition that lead to the same place are chained
+// through their unpatched operands, each holding how far back the one
+// before it is, or 0 for the first. A list is the offset of the last
+// jump's operand, or -1 when it is empty.
+static void addJump(Parser* parser, int* jumps, int jump) {
+    int link = *jumps < 0 ? 0 : jump - *jumps;
+    if (link > 65535) errorAtCurrent(parser, "Too much code to jump over.");
+    currentChunk(parser)->code[jump] = (link >> 8) & 0xff;
+    currentChunk(parser)->code[jump + 1] = link & 0xff;
+    *jumps = jump;
 }
 
-static void statement() {
-    if (match(TOKEN_PRINT)) printStatement();
-    else if (match(TOKEN_IF)) ifStatement();
-    else if (match(TOKEN_WHILE)) whileStatement();
-    else if (match(TOKEN_LEFT_BRACE)) {
-        beginScope();
-        block();
-        endScope();
-    } else expressionStatement();
+static int previousJump(Parser* parser, int jump) {
+    Byte* code = currentChunk(parser)->code;
+    int link = (code[jump] << 8) | code[jump + 1];
+    return link == 0 ? -1 : jump - link;
 }
 
-static void declaration() {
-    if (match(TOKEN_VAR)) varDeclaration();
-    else statement();
+static void patchJumps(Parser* parser, int jumps) {
+    while (jumps >= 0) {
+        int previous = previousJump(parser, jumps);
+        patchJump(parser, jumps);
+        jumps = previous;
+    }
 }
 
-bool compile(const char* source, Chunk* chunk) {
-    initScanner(source);
-    Compiler compiler;
-    initCompiler(&compiler);
-    compilingChunk = chunk;
+// Compiles the condition of an if or while. Each operand of its and/or
+// chain pops itself and branches straight to where its value decides the
+// condition goes: on past the condition when it holds, or to the jumps
+// returned when it doesn't. An operand that ends in OP_NOT branches on
+// the value under it the other way. Operands in parentheses are compiled
+// as values, with and/or short-circuiting there too.
+static int condition(Parser* parser) {
+    int trueJumps = -1;
+    int falseJumps = -1;
+    bool canAssign = true;
+    for (;;) {
+        parseOperand(parser, (Precedence)(PREC_AND + 1), canAssign);
+        canAssign = false;
+        Chunk* chunk = currentChunk(parser);
+        Byte branch = OP_POP_JUMP_IF_FALSE;
+        if (parser->notChunk == chunk && parser->notOffset == chunk->count - 1) {
+            chunk->count--;
+            branch = OP_POP_JUMP_IF_TRUE;
+        }
+        addJump(parser, &falseJumps, emitJump(parser, branch));
+        if (match(parser, TOKEN_AND)) continue;
+        if (!match(parser, TOKEN_OR)) break;
+        // The operand before or jumps past the condition when it holds
+        // instead, and the rest of its and chain goes on to the next one.
+        int last = falseJumps;
+        falseJumps = previousJump(parser, last);
+        chunk->code[last - 1] = chunk->code[last - 1] == OP_POP_JUMP_IF_FALSE ? OP_POP_JUMP_IF_TRUE
+                                                                             : OP_POP_JUMP_IF_FALSE;
+        addJump(parser, &trueJumps, last);
+        patchJumps(parser, falseJumps);
+        falseJumps = -1;
+    }
+    patchJumps(parser, trueJumps);
+    return falseJumps;
+}
+
+static void ifStatement(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    int elseJumps = condition(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    statement(parser);
+
+    if (match(parser, TOKEN_ELSE)) {
+        int endJump = emitJump(parser, OP_JUMP);
+        patchJumps(parser, elseJumps);
+        statement(parser);
+        patchJump(parser, endJump);
+    } else {
+        patchJumps(parser, elseJumps);
+    }
+}
+
+static void whileStatement(Parser* parser) {
+    int loopStart = currentChunk(parser)->count;
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    int exitJumps = condition(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    statement(parser);
+    emitLoop(parser, loopStart);
+    patchJumps(parser, exitJumps);
+}
+
+static void printStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
+}
+
+// delete map[key]; is compiled as the read of map[key], whose
+// OP_GET_INDEX is then turned into OP_DELETE_INDEX.
+static void deleteStatement(Parser* parser) {
+    expression(parser);
+    Chunk* chunk = currentChunk(parser);
+    if (parser->indexChunk == chunk && parser->indexOffset == chunk->count - 1) {
+        chunk->code[parser->indexOffset] = OP_DELETE_INDEX;
+    } else {
+        errorAt(parser, &parser->previous, "Can only delete a map element.");
+    }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after delete.");
+}
+
+static void returnStatement(Parser* parser) {
+    if (parser->compiler->type == TYPE_SCRIPT) {
+        errorAt(parser, &parser->previous, "Can't return from top-level code.");
+    }
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emitByte(parser, OP_NIL);
+    } else {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    }
+    emitByte(parser, parser->compiler->type == TYPE_FUNCTION ? OP_RETURN_CALL : OP_RETURN);
+}
+
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) printStatement(parser);
+    else if (match(parser, TOKEN_RETURN)) returnStatement(parser);
+    else if (match(parser, TOKEN_IF)) ifStatement(parser);
+    else if (match(parser, TOKEN_WHILE)) whileStatement(parser);
+    else if (match(parser, TOKEN_FOR)) forStatement(parser);
+    else if (match(parser, TOKEN_DELETE)) deleteStatement(parser);
+    else if (match(parser, TOKEN_LEFT_BRACE)) {
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
+    } else expressionStatement(parser);
+}
+
+// fun name(a, b) { ... } declares a function. Like the body of a spawn,
+// it sees its parameters, its own locals and the globals, but not the
+// locals around it. Declared in a block, it is one of that block's locals.
+static void funDeclaration(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect function name.");
+    Token name = parser->previous;
+    bool global = parser->compiler->scopeDepth == 0;
+    Byte nameConstant = 0;
+    if (global) {
+        nameConstant = (Byte)makeConstant(parser, OBJ_VAL(copyString(parser->heap, name.start, name.length)));
+    }
+
+    Token params[UINT8_MAX];
+    int paramCount = 0;
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (parser->current.type != TOKEN_RIGHT_PAREN) {
+        do {
+            consume(parser, TOKEN_IDENTIFIER, "Expect parameter name.");
+            if (paramCount == UINT8_MAX) {
+                errorAt(parser, &parser->previous, "Can't have more than 255 parameters.");
+                break;
+            }
+            params[paramCount++] = parser->previous;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+    ObjFunction* function = newFunction(parser->heap);
+    function->name = copyString(parser->heap, name.start, name.length);
+    functionBody(parser, function, TYPE_FUNCTION, params, paramCount);
+    emitConstant(parser, OBJ_VAL(function));
+    if (global) {
+        emitBytes(parser, OP_DEFINE_GLOBAL, nameConstant);
+    } else {
+        addLocal(parser, name);
+    }
+}
+
+static void declaration(Parser* parser) {
+    if (match(parser, TOKEN_VAR)) varDeclaration(parser);
+    else if (match(parser, TOKEN_FUN)) funDeclaration(parser);
+    else statement(parser);
+}
+
+void initProgram(Program* program) {
+    initChunk(&program->chunk);
+    program->body = NULL;
+    initHeap(&program->heap);
+}
+
+void freeProgram(Program* program) {
+    freeChunk(&program->chunk);
+    freeHeap(&program->heap);
+}
+
+// The script's top-level code and a module's compile alike; only the end
+// differs. A module keeps its globals in slot 0, which no name resolves
+// to, and returns them.
+static bool compileTopLevel(const char* source, Program* program, Chunk* chunk, int module,
+                            Output* errors) {
+    Parser parser;
+    initScanner(&parser.scanner, source);
     parser.hadError = false;
     parser.panicMode = false;
-    advance();
-    while (!match(TOKEN_EOF)) declaration();
-    emitReturn();
+    parser.heap = &program->heap;
+    parser.errors = errors;
+    parser.module = module;
+    parser.chunkCount = 0;
+    parser.indexChunk = NULL;
+    parser.indexOffset = -1;
+    parser.notChunk = NULL;
+    parser.compiler = NULL;
+    chunk->module = module;
+    Compiler compiler;
+    initCompiler(&parser, &compiler, chunk);
+    if (module != 0) {
+        Token globals = {TOKEN_IDENTIFIER, "", 0, 0};
+        addLocal(&parser, globals);
+    }
+
+    advance(&parser);
+    while (!match(&parser, TOKEN_EOF)) declaration(&parser);
+    if (module != 0) {
+        emitBytes(&parser, OP_GET_LOCAL, 0);
+        emitByte(&parser, OP_RETURN_CALL);
+    } else {
+        emitReturn(&parser);
+    }
+    if (!parser.hadError) chunk->maxDepth = maxStackDepth(chunk, compiler.localCount);
+#ifdef DEBUG_PRINT_CODE
+    if (!parser.hadError) {
+        Output output;
+        initOutput(&output, stdout);
+        disassembleChunk(&output, chunk, module != 0 ? "module" : "script");
+        freeOutput(&output);
+    }
+#endif
+
+    // A program is shared by every VM that executes it. Its objects start
+    // out marked, so collectors never write to them or trace into them.
+    for (Obj* object = program->heap.objects; object != NULL; object = object->next) {
+        object->isMarked = true;
+    }
+    flushOutput(errors);
     return !parser.hadError;
-}
\ No newline at end of file
+}
+
+bool compile(const char* source, Program* program, Output* errors) {
+    return compileTopLevel(source, program, &program->chunk, 0, errors);
+}
+
+bool compileModule(const char* source, const char* path, int module, Program* program, Output* errors) {
+    ObjFunction* body = newFunction(&program->heap);
+    body->module = module;
+    body->name = copyString(&program->heap, path, (int)strlen(path));
+    program->body = body;
+    return compileTopLevel(source, program, &body->chunk, module, errors);
+}
@@ -1,9 +1,30 @@
 #ifndef APOLO_COMPILER_H
 #define APOLO_COMPILER_H
 
+#include "chunk.h"
 #include "object.h"
-#include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// The result of compiling a script: its bytecode and the heap holding its
+// constants. A program is immutable once compiled and can be executed by
+// any number of VMs, on any threads, for as long as it is not freed. A
+// module's program keeps its top-level code in body instead of chunk.
+typedef struct {
+    Chunk chunk;
+    ObjFunction* body;
+    Heap heap;
+} Program;
+
+void initProgram(Program* program);
+void freeProgram(Program* program);
+// Error messages are written to errors, which is flushed before returning.
+bool compile(const char* source, Program* program, Output* errors);
+// Compiles the module numbered module, named path in stack traces. Its
+// top-level code compiles like a script's, into a function the VM calls
+// with the module's globals in slot 0 and that returns them.
+bool compileModule(const char* source, const char* path, int module, Program* program, Output* errors);
+// Fills depths with how many values are on the stack before each
+// instruction of chunk, entered with depth, or -1 where no path reaches,
+// and returns the most there ever are.
+int stackDepths(Chunk* chunk, int depth, int* depths);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "debug.h"
+#include "object.h"
+
+static int simpleInstruction(Output* output, const char* name, int offset) {
+    writeOutputFormat(output, "%s", name);
+    return offset + 1;
+}
+
+static int byteInstruction(Output* output, const char* name, Chunk* chunk, int offset) {
+    writeOutputFormat(output, "%-16s %4d", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static int constantInstruction(Output* output, const char* name, Chunk* chunk, int offset) {
+    Byte constant = chunk->code[offset + 1];
+    writeOutputFormat(output, "%-16s %4d '", name, constant);
+    printValue(output, chunk->constants.values[constant]);
+    writeOutputFormat(output, "'");
+    return offset + 2;
+}
+
+static int jumpInstruction(Output* output, const char* name, int sign, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    writeOutputFormat(output, "%-16s %4d -> %d", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+static int forInstruction(Output* output, const char* name, int sign, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    writeOutputFormat(output, "%-16s %4d %4d -> %d", name, chunk->code[offset + 1], offset,
+                      offset + 4 + sign * jump);
+    return offset + 4;
+}
+
+int disassembleInstruction(Output* output, Chunk* chunk, int offset) {
+    writeOutputFormat(output, "%04d ", offset);
+    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+        writeOutputFormat(output, "   | ");
+    } else {
+        writeOutputFormat(output, "%4d ", chunk->lines[offset]);
+    }
+
+    Byte instruction = chunk->code[offset];
+    if (instruction >= OP_COUNT) {
+        writeOutputFormat(output, "unknown opcode %d", instruction);
+        return offset + 1;
+    }
+    const char* name = opcodeNames[instruction];
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_FIELD:
+        case OP_SPAWN:
+        case OP_FIBER:
+        case OP_IMPORT:
+            return constantInstruction(output, name, chunk, offset);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_ARRAY:
+        case OP_MAP:
+        case OP_CALL:
+        case OP_RESUME:
+            return byteInstruction(output, name, chunk, offset);
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+            return jumpInstruction(output, name, 1, chunk, offset);
+        case OP_LOOP:
+            return jumpInstruction(output, name, -1, chunk, offset);
+        case OP_FOR_PREP:
+        case OP_FOR_IN:
+            return forInstruction(output, name, 1, chunk, offset);
+        case OP_FOR_LOOP:
+            return forInstruction(output, name, -1, chunk, offset);
+        default:
+            return simpleInstruction(output, name, offset);
+    }
+}
+
+void disassembleChunk(Output* output, Chunk* chunk, const char* name) {
+    writeOutputFormat(output, "== %s ==\n", name);
+    for (int offset = 0; offset < chunk->count;) {
+        offset = disassembleInstruction(output, chunk, offset);
+        writeOutputFormat(output, "\n");
+    }
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (!IS_OBJ(constant) || OBJ_TYPE(constant) != OBJ_FUNCTION) continue;
+        ObjFunction* function = AS_FUNCTION(constant);
+        Chunk* block = &function->chunk;
+        char blockName[64];
+        if (function->name != NULL) {
+            snprintf(blockName, sizeof(blockName), "%.*s", function->name->length, function->name->chars);
+        } else {
+            snprintf(blockName, sizeof(blockName), "block@%d", block->count > 0 ? block->lines[0] : 0);
+        }
+        disassembleChunk(output, block, blockName);
+    }
+}
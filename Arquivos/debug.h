@@ -0,0 +1,14 @@
+#ifndef APOLO_DEBUG_H
+#define APOLO_DEBUG_H
+
+#include "chunk.h"
+#include "io.h"
+
+// Lists chunk one instruction per line, then every block among its
+// constants, each under its own header.
+void disassembleChunk(Output* output, Chunk* chunk, const char* name);
+// Writes the instruction at offset, without a newline, and returns the
+// offset of the next one.
+int disassembleInstruction(Output* output, Chunk* chunk, int offset);
+
+#endif
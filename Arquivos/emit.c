@@ -0,0 +1,496 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "compiler.h"
+#include "emit.h"
+
+typedef struct {
+    Output* out;
+    int count;
+    ObjFunction** functions;
+    bool* spawned;
+    bool* labels;
+    int* depths;
+} Emitter;
+
+// Files every block under its id, as traces do. Blocks started by spawn
+// run in a worker's VM, on its interpreter, and get no C code.
+static void indexChunk(Emitter* emitter, Chunk* chunk, ObjFunction* function) {
+    if (chunk->id >= emitter->count) {
+        int count = chunk->id + 1;
+        emitter->functions = (ObjFunction**)realloc(emitter->functions, sizeof(ObjFunction*) * count);
+        emitter->spawned = (bool*)realloc(emitter->spawned, sizeof(bool) * count);
+        for (int i = emitter->count; i < count; i++) {
+            emitter->functions[i] = NULL;
+            emitter->spawned[i] = false;
+        }
+        emitter->count = count;
+    }
+    emitter->functions[chunk->id] = function;
+    for (int i = 0; i < chunk->count; i += 1 + opcodeOperands[chunk->code[i]]) {
+        if (chunk->code[i] == OP_SPAWN) {
+            emitter->spawned[AS_FUNCTION(chunk->constants.values[chunk->code[i + 1]])->chunk.id] = true;
+        }
+    }
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_OBJ(constant) && OBJ_TYPE(constant) == OBJ_FUNCTION) {
+            indexChunk(emitter, &AS_FUNCTION(constant)->chunk, AS_FUNCTION(constant));
+        }
+    }
+}
+
+static Chunk* chunkOf(Emitter* emitter, int id, Program* program) {
+    return id == 0 ? &program->chunk : &emitter->functions[id]->chunk;
+}
+
+static void emitString(Output* out, const char* chars, int length) {
+    writeOutputChar(out, '"');
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (c == '"' || c == '\\' || c == '?') {
+            writeOutputFormat(out, "\\%c", c);
+        } else if (c < 32 || c >= 127) {
+            writeOutputFormat(out, "\\%03o", c);
+        } else {
+            writeOutputChar(out, (char)c);
+        }
+    }
+    writeOutputChar(out, '"');
+}
+
+static void emitDouble(Output* out, double number) {
+    if (isnan(number)) {
+        writeOutputFormat(out, "NAN");
+    } else if (isinf(number)) {
+        writeOutputFormat(out, number > 0 ? "INFINITY" : "-INFINITY");
+    } else {
+        writeOutputFormat(out, "%a", number);
+    }
+}
+
+// The bytecode, lines and constants the runtime rebuilds the program from.
+static void emitChunkData(Emitter* emitter, Chunk* chunk) {
+    Output* out = emitter->out;
+    int id = chunk->id;
+    writeOutputFormat(out, "static const Byte code%d[] = {", id);
+    for (int i = 0; i < chunk->count; i++) {
+        writeOutputFormat(out, "%s%d", i % 16 == 0 ? "\n    " : " ", chunk->code[i]);
+        if (i + 1 < chunk->count) writeOutputChar(out, ',');
+    }
+    writeOutputFormat(out, "\n};\nstatic const int lines%d[] = {", id);
+    for (int i = 0; i < chunk->count; i++) {
+        writeOutputFormat(out, "%s%d", i % 16 == 0 ? "\n    " : " ", chunk->lines[i]);
+        if (i + 1 < chunk->count) writeOutputChar(out, ',');
+    }
+    writeOutputFormat(out, "\n};\n");
+    if (chunk->constants.count == 0) return;
+    writeOutputFormat(out, "static const AotConstant constants%d[] = {\n", id);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        writeOutputFormat(out, "    ");
+        if (IS_INT(constant)) {
+            writeOutputFormat(out, "{.type = AOT_INT, .integer = INT64_C(%lld)}", (long long)AS_INT(constant));
+        } else if (IS_DOUBLE(constant)) {
+            writeOutputFormat(out, "{.type = AOT_DOUBLE, .number = ");
+            emitDouble(out, AS_DOUBLE(constant));
+            writeOutputChar(out, '}');
+        } else if (OBJ_TYPE(constant) == OBJ_STRING) {
+            ObjString* string = AS_STRING(constant);
+            writeOutputFormat(out, "{.type = AOT_STRING, .chars = ");
+            emitString(out, string->chars, string->length);
+            writeOutputFormat(out, ", .length = %d}", string->length);
+        } else {
+            writeOutputFormat(out, "{.type = AOT_FUNCTION, .integer = %d}", AS_FUNCTION(constant)->chunk.id);
+        }
+        writeOutputFormat(out, ",\n");
+    }
+    writeOutputFormat(out, "};\n");
+}
+
+// Stores the first count locals where the VM's stack has room for them.
+static void emitSpill(Output* out, int count) {
+    for (int i = 0; i < count; i++) writeOutputFormat(out, "    vm->stack[%d] = s%d;\n", i, i);
+    writeOutputFormat(out, "    vm->stackTop = vm->stack + %d;\n", count);
+}
+
+// Backward jumps collect garbage, as OP_LOOP does, with the live locals
+// stored where the collector looks for them.
+static void emitSafepoint(Output* out, const char* indent, int depth, int offset) {
+    writeOutputFormat(out, "%sif (AOT_MUST_COLLECT()) {\n", indent);
+    for (int i = 0; i < depth; i++) writeOutputFormat(out, "%s    vm->stack[%d] = s%d;\n", indent, i, i);
+    writeOutputFormat(out, "%s    vm->stackTop = vm->stack + %d;\n", indent, depth);
+    writeOutputFormat(out, "%s    AOT_AT(%d);\n", indent, offset);
+    writeOutputFormat(out, "%s    if (!aotCollect(vm)) return false;\n", indent);
+    writeOutputFormat(out, "%s}\n", indent);
+}
+
+// Copies count locals from first into a temporary array, for the helpers
+// that take several values at once.
+static void emitValues(Output* out, const char* name, int first, int count) {
+    if (count == 0) {
+        writeOutputFormat(out, "        Value* %s = NULL;\n", name);
+        return;
+    }
+    writeOutputFormat(out, "        Value %s[] = {", name);
+    for (int i = 0; i < count; i++) writeOutputFormat(out, "%ss%d", i == 0 ? "" : ", ", first + i);
+    writeOutputFormat(out, "};\n");
+}
+
+static int jumpTarget(Chunk* chunk, int offset) {
+    Byte* code = &chunk->code[offset];
+    int next = offset + 1 + opcodeOperands[code[0]];
+    switch (code[0]) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE: return next + ((code[1] << 8) | code[2]);
+        case OP_LOOP: return next - ((code[1] << 8) | code[2]);
+        case OP_FOR_PREP:
+        case OP_FOR_IN: return next + ((code[2] << 8) | code[3]);
+        case OP_FOR_LOOP: return next - ((code[2] << 8) | code[3]);
+        default: return -1;
+    }
+}
+
+static void emitInstruction(Emitter* emitter, Chunk* chunk, int offset) {
+    Output* out = emitter->out;
+    Byte* code = &chunk->code[offset];
+    int depth = emitter->depths[offset];
+    int next = offset + 1 + opcodeOperands[code[0]];
+    int top = depth - 1;
+    switch (code[0]) {
+        case OP_CONSTANT: {
+            Value constant = chunk->constants.values[code[1]];
+            if (IS_INT(constant)) {
+                writeOutputFormat(out, "    s%d = INT_VAL(INT64_C(%lld));\n", depth, (long long)AS_INT(constant));
+            } else if (IS_DOUBLE(constant)) {
+                writeOutputFormat(out, "    s%d = DOUBLE_VAL(", depth);
+                emitDouble(out, AS_DOUBLE(constant));
+                writeOutputFormat(out, ");\n");
+            } else {
+                writeOutputFormat(out, "    s%d = k[%d];\n", depth, code[1]);
+            }
+            break;
+        }
+        case OP_NIL: writeOutputFormat(out, "    s%d = NIL_VAL;\n", depth); break;
+        case OP_TRUE: writeOutputFormat(out, "    s%d = BOOL_VAL(true);\n", depth); break;
+        case OP_FALSE: writeOutputFormat(out, "    s%d = BOOL_VAL(false);\n", depth); break;
+        case OP_POP: break;
+        case OP_GET_LOCAL: writeOutputFormat(out, "    s%d = s%d;\n", depth, code[1]); break;
+        case OP_SET_LOCAL: writeOutputFormat(out, "    s%d = s%d;\n", code[1], top); break;
+        case OP_GET_GLOBAL:
+            writeOutputFormat(out, "    AOT_GET_GLOBAL(s%d, k[%d], %d);\n", depth, code[1], offset);
+            break;
+        case OP_DEFINE_GLOBAL:
+            writeOutputFormat(out, "    tableSet(vm->currentGlobals, k[%d], s%d);\n", code[1], top);
+            break;
+        case OP_SET_GLOBAL:
+            writeOutputFormat(out, "    AOT_SET_GLOBAL(k[%d], s%d, %d);\n", code[1], top, offset);
+            break;
+        case OP_EQUAL: writeOutputFormat(out, "    AOT_EQUAL(s%d, s%d);\n", top - 1, top); break;
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            // The macros are named after the opcodes.
+            writeOutputFormat(out, "    AOT_%s(s%d, s%d, %d);\n", opcodeNames[code[0]] + 3, top - 1, top, offset);
+            break;
+        case OP_NOT: writeOutputFormat(out, "    s%d = BOOL_VAL(AOT_FALSEY(s%d));\n", top, top); break;
+        case OP_NEGATE: writeOutputFormat(out, "    AOT_NEGATE(s%d, %d);\n", top, offset); break;
+        case OP_ARRAY: {
+            int first = depth - code[1];
+            writeOutputFormat(out, "    {\n");
+            emitValues(out, "elements", first, code[1]);
+            writeOutputFormat(out, "        Value array;\n        AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "        if (!aotArray(vm, elements, %d, &array)) return false;\n", code[1]);
+            writeOutputFormat(out, "        s%d = array;\n    }\n", first);
+            break;
+        }
+        case OP_MAP: {
+            int first = depth - 2 * code[1];
+            writeOutputFormat(out, "    {\n");
+            emitValues(out, "entries", first, 2 * code[1]);
+            writeOutputFormat(out, "        Value map;\n        AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "        if (!aotMap(vm, entries, %d, &map)) return false;\n", code[1]);
+            writeOutputFormat(out, "        s%d = map;\n    }\n", first);
+            break;
+        }
+        case OP_GET_INDEX:
+            writeOutputFormat(out, "    AOT_GET_INDEX(s%d, s%d, %d);\n", top - 1, top, offset);
+            break;
+        case OP_SET_INDEX:
+            writeOutputFormat(out, "    AOT_SET_INDEX(s%d, s%d, s%d, %d);\n", top - 2, top - 1, top, offset);
+            break;
+        case OP_DELETE_INDEX:
+            writeOutputFormat(out, "    AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "    if (!aotDeleteIndex(vm, s%d, s%d)) return false;\n", top - 1, top);
+            break;
+        case OP_GET_FIELD:
+            writeOutputFormat(out, "    {\n        Value field;\n        AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "        if (!aotGetField(vm, s%d, k[%d], &field)) return false;\n", top, code[1]);
+            writeOutputFormat(out, "        s%d = field;\n    }\n", top);
+            break;
+        case OP_PRINT:
+            writeOutputFormat(out, "    printValue(&vm->out, s%d);\n    endOutputLine(&vm->out);\n", top);
+            break;
+        case OP_INPUT: writeOutputFormat(out, "    s%d = aotInput(vm);\n", depth); break;
+        case OP_INPUT_LINES:
+            writeOutputFormat(out, "    {\n        Value lines;\n        AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "        if (!aotInputLines(vm, s%d, &lines)) return false;\n", top);
+            writeOutputFormat(out, "        s%d = lines;\n    }\n", top);
+            break;
+        case OP_JUMP: writeOutputFormat(out, "    goto L%d;\n", jumpTarget(chunk, offset)); break;
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+            writeOutputFormat(out, "    if (AOT_FALSEY(s%d)) goto L%d;\n", top, jumpTarget(chunk, offset));
+            break;
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_TRUE:
+            writeOutputFormat(out, "    if (!AOT_FALSEY(s%d)) goto L%d;\n", top, jumpTarget(chunk, offset));
+            break;
+        case OP_LOOP:
+            emitSafepoint(out, "    ", depth, offset);
+            writeOutputFormat(out, "    goto L%d;\n", jumpTarget(chunk, offset));
+            break;
+        case OP_FOR_PREP:
+        case OP_FOR_IN: {
+            int slot = code[1];
+            int count = code[0] == OP_FOR_PREP ? 4 : 3;
+            writeOutputFormat(out, "    {\n");
+            emitValues(out, "slots", slot, count);
+            writeOutputFormat(out, "        AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "        ForPrep prep = %s(vm, slots);\n",
+                              code[0] == OP_FOR_PREP ? "aotForPrep" : "aotForIn");
+            writeOutputFormat(out, "        if (prep == FOR_ERROR) return false;\n");
+            for (int i = 0; i < count; i++) writeOutputFormat(out, "        s%d = slots[%d];\n", slot + i, i);
+            writeOutputFormat(out, "        if (prep == FOR_SKIP) goto L%d;\n    }\n", jumpTarget(chunk, offset));
+            break;
+        }
+        case OP_FOR_LOOP: {
+            int slot = code[1];
+            writeOutputFormat(out, "    {\n        bool more;\n");
+            writeOutputFormat(out, "        AOT_FOR_STEP(s%d, s%d, s%d, more);\n", slot, slot + 1, slot + 2);
+            writeOutputFormat(out, "        if (more) {\n            s%d = s%d;\n", slot + 3, slot);
+            // The jump back is a safepoint like OP_LOOP's.
+            emitSafepoint(out, "            ", depth, offset);
+            writeOutputFormat(out, "            goto L%d;\n        }\n    }\n", jumpTarget(chunk, offset));
+            break;
+        }
+        case OP_CALL:
+            emitSpill(out, depth);
+            writeOutputFormat(out, "    AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "    if (!aotCall(vm, %d)) return false;\n", code[1]);
+            writeOutputFormat(out, "    s%d = vm->stackTop[-1];\n", depth - code[1] - 1);
+            break;
+        case OP_SPAWN: {
+            int arity = AS_FUNCTION(chunk->constants.values[code[1]])->arity;
+            emitSpill(out, depth);
+            writeOutputFormat(out, "    AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "    if (!aotSpawn(vm, AS_FUNCTION(k[%d]))) return false;\n", code[1]);
+            writeOutputFormat(out, "    s%d = vm->stackTop[-1];\n", depth - arity);
+            break;
+        }
+        case OP_FIBER: {
+            int arity = AS_FUNCTION(chunk->constants.values[code[1]])->arity;
+            writeOutputFormat(out, "    {\n");
+            emitValues(out, "captures", depth - arity, arity);
+            writeOutputFormat(out, "        s%d = aotFiber(vm, AS_FUNCTION(k[%d]), captures);\n    }\n",
+                              depth - arity, code[1]);
+            break;
+        }
+        case OP_RESUME:
+            emitSpill(out, depth);
+            writeOutputFormat(out, "    AOT_AT(%d);\n", offset);
+            writeOutputFormat(out, "    if (!aotResume(vm, %d)) return false;\n", code[1]);
+            writeOutputFormat(out, "    s%d = vm->stackTop[-1];\n", depth - code[1]);
+            break;
+        case OP_YIELD:
+            // Comes back in at the next instruction, through the switch at
+            // the top of the function.
+            emitSpill(out, top);
+            writeOutputFormat(out, "    vm->ip = vm->chunk->code + %d;\n", next);
+            writeOutputFormat(out, "    aotYield(vm);\n    *result = s%d;\n    return true;\n", top);
+            break;
+        case OP_RETURN_CALL:
+            writeOutputFormat(out, "    *result = s%d;\n    return true;\n", top);
+            break;
+        case OP_RETURN:
+            if (chunk->id == 0) {
+                writeOutputFormat(out, "    return true;\n");
+            } else {
+                writeOutputFormat(out, "    *result = s%d;\n    aotFinishFiber(vm);\n    return true;\n", top);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool usesConstants(Chunk* chunk) {
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (IS_OBJ(chunk->constants.values[i])) return true;
+    }
+    return false;
+}
+
+static void emitFunction(Emitter* emitter, Chunk* chunk) {
+    Output* out = emitter->out;
+    ObjFunction* function = emitter->functions[chunk->id];
+    int arity = function != NULL ? function->arity : 0;
+    emitter->depths = (int*)malloc(sizeof(int) * chunk->count);
+    emitter->labels = (bool*)calloc(chunk->count + 1, sizeof(bool));
+    stackDepths(chunk, arity, emitter->depths);
+    bool resumes = false;
+    for (int i = 0; i < chunk->count; i += 1 + opcodeOperands[chunk->code[i]]) {
+        if (emitter->depths[i] < 0) continue;
+        int target = jumpTarget(chunk, i);
+        if (target >= 0) emitter->labels[target] = true;
+        if (chunk->code[i] == OP_YIELD) resumes = true;
+    }
+
+    if (function == NULL) {
+        writeOutputFormat(out, "// script\n");
+    } else if (function->name != NULL) {
+        writeOutputFormat(out, "// %s()\n", function->name->chars);
+    } else {
+        writeOutputFormat(out, "// block at line %d\n", chunk->lines[0]);
+    }
+    writeOutputFormat(out, "static bool chunk%d(VM* vm, Value* result) {\n", chunk->id);
+    if (usesConstants(chunk)) writeOutputFormat(out, "    const Value* k = vm->chunk->constants.values;\n");
+    for (int i = 0; i < chunk->maxDepth; i++) {
+        if (i < arity) {
+            writeOutputFormat(out, "    Value s%d = vm->stack[%d];\n", i, i);
+        } else {
+            writeOutputFormat(out, "    Value s%d = NIL_VAL;\n", i);
+        }
+    }
+    if (chunk->id == 0) writeOutputFormat(out, "    (void)result;\n");
+    if (resumes) {
+        // A resumed fiber picks up its locals from its stack, where it left
+        // them when it yielded, with the value it was resumed with on top.
+        writeOutputFormat(out, "    switch ((int)(vm->ip - vm->chunk->code)) {\n");
+        for (int i = 0; i < chunk->count; i += 1 + opcodeOperands[chunk->code[i]]) {
+            if (chunk->code[i] != OP_YIELD || emitter->depths[i] < 0) continue;
+            int next = i + 1 + opcodeOperands[OP_YIELD];
+            writeOutputFormat(out, "        case %d:\n", next);
+            for (int slot = 0; slot < emitter->depths[i]; slot++) {
+                writeOutputFormat(out, "            s%d = vm->stack[%d];\n", slot, slot);
+            }
+            writeOutputFormat(out, "            goto L%d;\n", next);
+            emitter->labels[next] = true;
+        }
+        writeOutputFormat(out, "    }\n");
+    }
+
+    int line = -1;
+    for (int i = 0; i < chunk->count; i += 1 + opcodeOperands[chunk->code[i]]) {
+        if (emitter->labels[i]) writeOutputFormat(out, "L%d: ;\n", i);
+        if (emitter->depths[i] < 0) continue;
+        if (chunk->lines[i] != line) {
+            line = chunk->lines[i];
+            writeOutputFormat(out, "    // line %d\n", line);
+        }
+        emitInstruction(emitter, chunk, i);
+    }
+    writeOutputFormat(out, "}\n\n");
+    free(emitter->depths);
+    free(emitter->labels);
+}
+
+// Imports are the one thing compiled programs can't do: a module compiles
+// when the script runs, too late to be turned into C.
+static bool checkSupported(Emitter* emitter, Program* program) {
+    for (int id = 0; id < emitter->count; id++) {
+        if (id > 0 && emitter->functions[id] == NULL) continue;
+        Chunk* chunk = chunkOf(emitter, id, program);
+        for (int i = 0; i < chunk->count; i += 1 + opcodeOperands[chunk->code[i]]) {
+            if (chunk->code[i] == OP_IMPORT) {
+                fprintf(stderr, "[Line %d] Error: Can't compile imports to C.\n", chunk->lines[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int emitC(const char* path) {
+    FileView source;
+    if (!openFileView(path, &source)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return 74;
+    }
+    Output errors;
+    initOutput(&errors, stderr);
+    Program program;
+    initProgram(&program);
+    bool compiled = compile(source.chars, &program, &errors);
+    freeOutput(&errors);
+    closeFileView(&source);
+    if (!compiled) {
+        freeProgram(&program);
+        return 65;
+    }
+
+    Emitter emitter = {NULL, 0, NULL, NULL, NULL, NULL};
+    indexChunk(&emitter, &program.chunk, NULL);
+    if (!checkSupported(&emitter, &program)) {
+        free(emitter.functions);
+        free(emitter.spawned);
+        freeProgram(&program);
+        return 65;
+    }
+
+    Output out;
+    initOutput(&out, stdout);
+    emitter.out = &out;
+    writeOutputFormat(&out, "// Translated from %s by apolo --emit-c. Build it with every source\n", path);
+    writeOutputFormat(&out, "// file of apolo but main.c, like apolo itself.\n");
+    writeOutputFormat(&out, "#include <math.h>\n\n#include \"aot.h\"\n\n");
+    for (int id = 0; id < emitter.count; id++) {
+        if (!emitter.spawned[id]) writeOutputFormat(&out, "static bool chunk%d(VM* vm, Value* result);\n", id);
+    }
+    writeOutputFormat(&out, "\n");
+    for (int id = 0; id < emitter.count; id++) {
+        emitChunkData(&emitter, chunkOf(&emitter, id, &program));
+    }
+    writeOutputFormat(&out, "\n");
+    for (int id = 0; id < emitter.count; id++) {
+        if (!emitter.spawned[id]) emitFunction(&emitter, chunkOf(&emitter, id, &program));
+    }
+
+    writeOutputFormat(&out, "static const AotChunk chunks[] = {\n");
+    for (int id = 0; id < emitter.count; id++) {
+        Chunk* chunk = chunkOf(&emitter, id, &program);
+        ObjFunction* function = emitter.functions[id];
+        writeOutputFormat(&out, "    {");
+        if (function != NULL && function->name != NULL) {
+            emitString(&out, function->name->chars, function->name->length);
+        } else {
+            writeOutputFormat(&out, "NULL");
+        }
+        writeOutputFormat(&out, ", %d, %d, %d, code%d, lines%d, %d, ", function != NULL ? function->arity : 0,
+                          chunk->maxDepth, chunk->count, id, id, chunk->constants.count);
+        if (chunk->constants.count > 0) {
+            writeOutputFormat(&out, "constants%d, ", id);
+        } else {
+            writeOutputFormat(&out, "NULL, ");
+        }
+        if (emitter.spawned[id]) {
+            writeOutputFormat(&out, "NULL},\n");
+        } else {
+            writeOutputFormat(&out, "chunk%d},\n", id);
+        }
+    }
+    writeOutputFormat(&out, "};\n\nint main(void) {\n");
+    writeOutputFormat(&out, "    return runCompiled(chunks, %d);\n}\n", emitter.count);
+    freeOutput(&out);
+
+    free(emitter.functions);
+    free(emitter.spawned);
+    freeProgram(&program);
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef APOLO_EMIT_H
+#define APOLO_EMIT_H
+
+// Translates the script at path into a C program on stdout that runs it
+// as the interpreter would, once built with the runtime: every source
+// file of apolo but main.c. Scripts that import modules can't be
+// translated. Returns an exit status.
+int emitC(const char* path);
+
+#endif
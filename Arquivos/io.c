@@ -0,0 +1,229 @@
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "io.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#define read _read
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void initOutput(Output* output, FILE* file) {
+    output->file = file;
+    output->lineBuffered = file != NULL && isatty(fileno(file));
+    output->count = 0;
+    output->capacity = 0;
+    output->chars = NULL;
+}
+
+void freeOutput(Output* output) {
+    flushOutput(output);
+    free(output->chars);
+    output->chars = NULL;
+    output->count = 0;
+    output->capacity = 0;
+}
+
+// Buffers are allocated on first use, so idle VMs stay small.
+static void makeRoom(Output* output, int length) {
+    if (output->file != NULL) flushOutput(output);
+    int needed = output->count + length;
+    if (needed <= output->capacity) return;
+    int capacity = output->capacity == 0 ? OUTPUT_BUFFER_SIZE : output->capacity;
+    while (capacity < needed) capacity *= 2;
+    output->chars = (char*)realloc(output->chars, capacity);
+    output->capacity = capacity;
+}
+
+void writeOutput(Output* output, const char* chars, int length) {
+    if (output->count + length > output->capacity) makeRoom(output, length);
+    memcpy(output->chars + output->count, chars, length);
+    output->count += length;
+}
+
+void writeOutputChar(Output* output, char c) {
+    if (output->count == output->capacity) makeRoom(output, 1);
+    output->chars[output->count++] = c;
+}
+
+void writeOutputFormat(Output* output, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buffer[256];
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if (length < (int)sizeof(buffer)) {
+        writeOutput(output, buffer, length);
+        return;
+    }
+    char* chars = (char*)malloc(length + 1);
+    va_start(args, format);
+    vsnprintf(chars, length + 1, format, args);
+    va_end(args);
+    writeOutput(output, chars, length);
+    free(chars);
+}
+
+void endOutputLine(Output* output) {
+    writeOutputChar(output, '\n');
+    if (output->lineBuffered) flushOutput(output);
+}
+
+void flushOutput(Output* output) {
+    if (output->file == NULL || output->count == 0) return;
+    fwrite(output->chars, 1, output->count, output->file);
+    fflush(output->file);
+    output->count = 0;
+}
+
+
+// A NULL file gives a reader that is always at end of input.
+void initInput(Input* input, FILE* file) {
+    input->fd = file != NULL ? fileno(file) : -1;
+    input->atEnd = file == NULL;
+    input->start = 0;
+    input->end = 0;
+    input->capacity = 0;
+    input->chars = NULL;
+}
+
+void freeInput(Input* input) {
+    free(input->chars);
+    input->chars = NULL;
+    input->capacity = 0;
+}
+
+// Moves the unread bytes to the front of the buffer, grows it when a single
+// line fills it, and reads as much as the descriptor has available. read()
+// returns as soon as a line is typed on a terminal, where fread() would wait
+// for the whole block. False if the buffer needed to grow and couldn't.
+static bool fillInput(Input* input) {
+    if (input->start > 0) {
+        memmove(input->chars, input->chars + input->start, input->end - input->start);
+        input->end -= input->start;
+        input->start = 0;
+    }
+    if (input->end == input->capacity) {
+        if (input->capacity > INT_MAX / 2) return false;
+        int capacity = input->capacity == 0 ? INPUT_BUFFER_SIZE : input->capacity * 2;
+        char* chars = (char*)realloc(input->chars, capacity);
+        if (chars == NULL) return false;
+        input->chars = chars;
+        input->capacity = capacity;
+    }
+    int bytesRead = (int)read(input->fd, input->chars + input->end, input->capacity - input->end);
+    if (bytesRead <= 0) input->atEnd = true;
+    else input->end += bytesRead;
+    return true;
+}
+
+// Reads up to count lines as one block, separated by '\n' and without the
+// final terminator. Returns how many lines were read, 0 at end of input,
+// or -1 if they don't fit in memory.
+int readLines(Input* input, int count, const char** lines, int* length) {
+    int found = 0;
+    int scanned = input->start;
+    int lineEnd = input->start;
+    while (found < count) {
+        char* newline = scanned < input->end
+            ? (char*)memchr(input->chars + scanned, '\n', input->end - scanned) : NULL;
+        if (newline != NULL) {
+            found++;
+            lineEnd = (int)(newline - input->chars);
+            scanned = lineEnd + 1;
+            continue;
+        }
+        if (input->atEnd) {
+            if (scanned < input->end) {
+                found++;
+                lineEnd = input->end;
+                scanned = input->end;
+            }
+            break;
+        }
+        int offset = input->start;
+        if (!fillInput(input)) return -1;
+        scanned -= offset;
+        lineEnd -= offset;
+    }
+
+    *lines = input->chars + input->start;
+    *length = lineEnd - input->start;
+    input->start = scanned;
+    return found;
+}
+
+bool readLine(Input* input, const char** line, int* length) {
+    return readLines(input, 1, line, length) == 1;
+}
+
+static bool readWholeFile(const char* path, FileView* view) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    size_t capacity = 64 * 1024;
+    size_t length = 0;
+    char* chars = (char*)malloc(capacity);
+    for (;;) {
+        if (chars == NULL) {
+            fclose(file);
+            return false;
+        }
+        length += fread(chars + length, 1, capacity - length - 1, file);
+        if (length < capacity - 1) break;
+        capacity *= 2;
+        chars = (char*)realloc(chars, capacity);
+    }
+    fclose(file);
+    chars[length] = '\0';
+    view->chars = chars;
+    view->length = length;
+    view->mapped = false;
+    return true;
+}
+
+bool openFileView(const char* path, FileView* view) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t size = (size_t)st.st_size;
+        // The terminator comes for free from the zero-filled tail of the last
+        // page, unless the file ends exactly on a page boundary.
+        if (size > 0 && size % (size_t)sysconf(_SC_PAGESIZE) != 0) {
+            void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                close(fd);
+                madvise(data, size, MADV_SEQUENTIAL);
+                view->chars = (const char*)data;
+                view->length = size;
+                view->mapped = true;
+                return true;
+            }
+        }
+    }
+    close(fd);
+#endif
+    return readWholeFile(path, view);
+}
+
+void closeFileView(FileView* view) {
+#ifndef _WIN32
+    if (view->mapped) {
+        munmap((void*)view->chars, view->length);
+        view->chars = NULL;
+        return;
+    }
+#endif
+    free((void*)view->chars);
+    view->chars = NULL;
+}
\ No newline at end of file
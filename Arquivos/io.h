@@ -0,0 +1,55 @@
+#ifndef APOLO_IO_H
+#define APOLO_IO_H
+
+#include <stdio.h>
+#include "common.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define INPUT_BUFFER_SIZE (256 * 1024)
+
+// Buffered sink for everything a script prints. With a NULL file the output
+// is kept in memory until the owner reads it.
+typedef struct {
+    FILE* file;
+    bool lineBuffered;
+    int count;
+    int capacity;
+    char* chars;
+} Output;
+
+// Block-buffered line reader. Lines handed out point into the buffer and
+// stay valid until the next read.
+typedef struct {
+    int fd;
+    bool atEnd;
+    int start;
+    int end;
+    int capacity;
+    char* chars;
+} Input;
+
+// Read-only, NUL-terminated contents of a file. Regular files are memory
+// mapped; anything else is read into a heap buffer.
+typedef struct {
+    const char* chars;
+    size_t length;
+    bool mapped;
+} FileView;
+
+void initOutput(Output* output, FILE* file);
+void freeOutput(Output* output);
+void writeOutput(Output* output, const char* chars, int length);
+void writeOutputChar(Output* output, char c);
+void writeOutputFormat(Output* output, const char* format, ...);
+void endOutputLine(Output* output);
+void flushOutput(Output* output);
+
+void initInput(Input* input, FILE* file);
+void freeInput(Input* input);
+bool readLine(Input* input, const char** line, int* length);
+int readLines(Input* input, int count, const char** lines, int* length);
+
+bool openFileView(const char* path, FileView* view);
+void closeFileView(FileView* view);
+
+#endif
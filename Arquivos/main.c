@@ -1,66 +1,205 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "batch.h"
 #include "chunk.h"
+#include "emit.h"
+#include "module.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 #include "vm.h"
 
 static void repl() {
-    char line[1024];
+    VM vm;
     initVM(&vm);
     printf("Apolo Lang v2.0\nType 'exit' to close.\n");
     
     for (;;) {
         printf("apolo > ");
-        if (!fgets(line, sizeof(line), stdin)) { printf("\n"); break; }
+        fflush(stdout);
+        // Lines come from the VM's reader so input() in a statement sees the
+        // lines that follow it, not whatever was left in a second buffer.
+        const char* chars;
+        int length;
+        if (!readLine(&vm.in, &chars, &length)) { printf("\n"); break; }
         
-        line[strcspn(line, "\n")] = 0;
-        if (strcmp(line, "exit") == 0) break;
+        char* line = (char*)malloc(length + 1);
+        memcpy(line, chars, length);
+        line[length] = '\0';
+        if (strcmp(line, "exit") == 0) { free(line); break; }
         
         interpret(&vm, line);
+        free(line);
     }
     freeVM(&vm);
+    freeModules();
 }
 
-static char* readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
+typedef struct {
+    Profiler* profiler;
+    bool folded;
+    bool memoryStats;
+    size_t memoryLimit;
+    const char* tracePath;
+} RunOptions;
+
+// Reports are printed while the VM still holds the compiled program the
+// profiler's samples point into and the objects the census counts.
+static int runFile(const char* path, RunOptions* options) {
+    FileView source;
+    if (!openFileView(path, &source)) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        return 74;
+    }
+    VM vm;
+    initVM(&vm);
+    setMemoryLimit(&vm, options->memoryLimit);
+    Trace trace;
+    if (options->tracePath != NULL) {
+        initTrace(&trace, TRACE_DEFAULT_CAPACITY, options->tracePath, source.chars);
+        handleTraceSignals(&trace);
+        vm.trace = &trace;
     }
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    Profiler* profiler = options->profiler;
+    if (profiler != NULL && !startProfiler(profiler, &vm)) {
+        fprintf(stderr, "Could not start the profiler.\n");
+        profiler = NULL;
     }
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    buffer[bytesRead] = '\0';
-    fclose(file);
-    return buffer;
+    InterpretResult result = interpret(&vm, source.chars);
+    if (profiler != NULL) {
+        stopProfiler(profiler);
+        if (options->folded) {
+            printFoldedStacks(profiler, stderr);
+        } else {
+            printProfile(profiler, source.chars, stderr);
+        }
+    }
+    if (options->memoryStats) printMemoryStats(&vm, stderr);
+    freeVM(&vm);
+    if (options->tracePath != NULL) freeTrace(&trace);
+    closeFileView(&source);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
 }
 
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    initVM(&vm);
-    InterpretResult result = interpret(&vm, source);
-    freeVM(&vm);
-    free(source);
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void usage() {
+    fprintf(stderr,
+            "Usage: apolo [path]\n"
+            "       apolo --stats[=json] path\n"
+            "       apolo --profile[=folded] path\n"
+            "       apolo --mem-stats path\n"
+            "       apolo --mem-limit=<bytes>[k|m|g] path\n"
+            "       apolo --trace[=file] path\n"
+            "       apolo --decode-trace <file> path\n"
+            "       apolo --emit-c path\n"
+            "       apolo --batch <dir|list> [--jobs n]\n");
+    exit(64);
+}
+
+// Accepts a byte count with an optional k, m or g suffix. Signs, and
+// counts too big for a size_t, are rejected rather than wrapped.
+static bool parseSize(const char* text, size_t* size) {
+    if (*text < '0' || *text > '9') return false;
+    errno = 0;
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE || value > SIZE_MAX) return false;
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value == 0 || value > (SIZE_MAX >> shift)) return false;
+    *size = (size_t)value << shift;
+    return true;
+}
+
+static int defaultJobs() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc == 1) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        if (argc != 3 && argc != 5) usage();
+        int jobs = defaultJobs();
+        if (argc == 5) {
+            if (strcmp(argv[3], "--jobs") != 0 && strcmp(argv[3], "-j") != 0) usage();
+            jobs = atoi(argv[4]);
+            if (jobs < 1) usage();
+        }
+        int status = runBatch(argv[2], jobs);
+        freeModules();
+        return status;
+    }
+    if (argc > 1 && strcmp(argv[1], "--decode-trace") == 0) {
+        if (argc != 4) usage();
+        int status = decodeTrace(argv[2], argv[3]);
+        freeModules();
+        return status;
+    }
+    if (argc > 1 && strcmp(argv[1], "--emit-c") == 0) {
+        if (argc != 3) usage();
+        return emitC(argv[2]);
+    }
+
+    bool stats = false;
+    bool statsJson = false;
+    bool profile = false;
+    RunOptions options = {NULL, false, false, MEMORY_UNLIMITED, NULL};
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[arg], "--stats=json") == 0) {
+            stats = true;
+            statsJson = true;
+        } else if (strcmp(argv[arg], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[arg], "--profile=folded") == 0) {
+            profile = true;
+            options.folded = true;
+        } else if (strcmp(argv[arg], "--trace") == 0) {
+            options.tracePath = "apolo.trace";
+        } else if (strncmp(argv[arg], "--trace=", 8) == 0 && argv[arg][8] != '\0') {
+            options.tracePath = argv[arg] + 8;
+        } else if (strcmp(argv[arg], "--mem-stats") == 0) {
+            options.memoryStats = true;
+        } else if (strncmp(argv[arg], "--mem-limit=", 12) == 0) {
+            if (!parseSize(argv[arg] + 12, &options.memoryLimit)) usage();
+        } else {
+            usage();
+        }
+    }
+    if (argc - arg > 1 || (arg > 1 && arg == argc)) usage();
+    if (arg == argc) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
-    } else {
-        fprintf(stderr, "Usage: apolo [path]\n");
-        exit(64);
+        return 0;
     }
-    return 0;
+
+    Stats counters;
+    initStats(&counters);
+    if (stats && !setActiveStats(&counters)) {
+        fprintf(stderr, "This build has no statistics (APOLO_NO_STATS).\n");
+        return 64;
+    }
+    Profiler profiler;
+    if (profile) {
+        initProfiler(&profiler, 1000);
+        options.profiler = &profiler;
+    }
+    int status = runFile(argv[arg], &options);
+    freeModules();
+    if (profile) freeProfiler(&profiler);
+    if (stats) printStats(&counters, stderr, statsJson);
+    return status;
 }
\ No newline at end of file
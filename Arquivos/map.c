@@ -0,0 +1,64 @@
+#include "map.h"
+#include "memory.h"
+
+bool mapKey(Value value, Value* key) {
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (number != number) return false;
+        *key = IS_INT(value) ? value : numberKey(number);
+        return true;
+    }
+    if (IS_BOOL(value) || IS_STRING(value)) {
+        *key = value;
+        return true;
+    }
+    return false;
+}
+
+size_t mapEntryBytes(ObjMap* map) {
+    return sizeof(Entry) * map->table.capacity;
+}
+
+bool mapGet(ObjMap* map, Value key, Value* value) {
+    return tableGet(&map->table, key, value);
+}
+
+void mapSet(Heap* heap, ObjMap* map, Value key, Value value) {
+    // A slice key would keep the whole file or string it points into alive
+    // for as long as the map.
+    if (IS_STRING(key) && AS_STRING(key)->owner != NULL) {
+        key = OBJ_VAL(copyString(heap, AS_STRING(key)->chars, AS_STRING(key)->length));
+    }
+    size_t before = mapEntryBytes(map);
+    if (tableSet(&map->table, key, value)) map->count++;
+    heap->bytesAllocated += mapEntryBytes(map) - before;
+}
+
+bool mapDelete(ObjMap* map, Value key) {
+    if (!tableDelete(&map->table, key)) return false;
+    map->count--;
+    return true;
+}
+
+bool mapReserve(Heap* heap, ObjMap* map, int count) {
+    size_t before = mapEntryBytes(map);
+    if (!tableReserve(&map->table, count)) return false;
+    heap->bytesAllocated += mapEntryBytes(map) - before;
+    return true;
+}
+
+bool mapNext(ObjMap* map, int* cursor, Value* key) {
+    for (int i = *cursor; i < map->table.capacity; i++) {
+        if (IS_NIL(map->table.entries[i].key)) continue;
+        *key = map->table.entries[i].key;
+        *cursor = i + 1;
+        return true;
+    }
+    *cursor = map->table.capacity;
+    return false;
+}
+
+void freeMapEntries(Heap* heap, ObjMap* map) {
+    heap->bytesAllocated -= mapEntryBytes(map);
+    freeTable(&map->table);
+}
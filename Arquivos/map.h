@@ -0,0 +1,29 @@
+#ifndef APOLO_MAP_H
+#define APOLO_MAP_H
+
+#include "object.h"
+
+// The largest capacity hint map() takes.
+#define MAP_MAX (1 << 28)
+
+// The key a script value is stored under, from numberKey() for numbers.
+// False for values that can't be keys: nil, nan, and objects other than
+// strings.
+bool mapKey(Value value, Value* key);
+
+// Entries are charged to MEMORY_TABLES and count towards the heap's
+// bytesAllocated, like array elements. Keys must come from mapKey().
+bool mapGet(ObjMap* map, Value key, Value* value);
+void mapSet(Heap* heap, ObjMap* map, Value key, Value value);
+bool mapDelete(ObjMap* map, Value key);
+// False, with the map unchanged, when there is no memory for count keys.
+bool mapReserve(Heap* heap, ObjMap* map, int count);
+// Finds the first key at or after *cursor, an entry index starting at 0,
+// and moves the cursor past it. False when there are no more. Keys added
+// during a walk may or may not be visited, and growing the map can visit
+// some keys twice.
+bool mapNext(ObjMap* map, int* cursor, Value* key);
+void freeMapEntries(Heap* heap, ObjMap* map);
+size_t mapEntryBytes(ObjMap* map);
+
+#endif
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "channel.h"
+#include "map.h"
+#include "memory.h"
+#include "vm.h"
+
+_Thread_local MemoryAccount* currentAccount = NULL;
+
+void initMemoryAccount(MemoryAccount* account) {
+    memset(account, 0, sizeof(MemoryAccount));
+    account->limit = MEMORY_UNLIMITED;
+}
+
+MemoryAccount* useMemoryAccount(MemoryAccount* account) {
+    MemoryAccount* previous = currentAccount;
+    currentAccount = account;
+    return previous;
+}
+
+bool overMemoryLimit(MemoryAccount* account) {
+    return account->total > account->limit;
+}
+
+// Freeing more than was charged, which happens when memory changes hands
+// between accounts, stops at zero.
+void trackMemory(MemoryCategory category, size_t oldSize, size_t newSize) {
+    MemoryAccount* account = currentAccount;
+    if (account == NULL) return;
+    size_t freed = oldSize < account->live[category] ? oldSize : account->live[category];
+    account->live[category] = account->live[category] - freed + newSize;
+    account->total = account->total - freed + newSize;
+    if (account->live[category] > account->peak[category]) {
+        account->peak[category] = account->live[category];
+    }
+    if (account->total > account->peakTotal) account->peakTotal = account->total;
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize, MemoryCategory category) {
+    trackMemory(category, oldSize, newSize);
+    if (newSize == 0) {
+        free(pointer);
+        return NULL;
+    }
+    void* result = realloc(pointer, newSize);
+    if (result == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    return result;
+}
+
+bool withinMemoryLimit(size_t bytes) {
+    return currentAccount == NULL || bytes <= currentAccount->limit;
+}
+
+void* tryReallocate(void* pointer, size_t oldSize, size_t newSize, MemoryCategory category) {
+    if (newSize > oldSize && !withinMemoryLimit(newSize - oldSize)) return NULL;
+    void* result = realloc(pointer, newSize);
+    if (result == NULL) return NULL;
+    trackMemory(category, oldSize, newSize);
+    return result;
+}
+
+static void markObject(VM* vm, Obj* object) {
+    if (object == NULL || object->isMarked) return;
+    object->isMarked = true;
+
+    if (vm->grayCapacity < vm->grayCount + 1) {
+        vm->grayCapacity = vm->grayCapacity < 8 ? 8 : vm->grayCapacity * 2;
+        vm->grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
+        if (vm->grayStack == NULL) exit(1);
+    }
+    vm->grayStack[vm->grayCount++] = object;
+}
+
+static void markValue(VM* vm, Value value) {
+    if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+}
+
+static void markTable(VM* vm, Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        markValue(vm, entry->key);
+        markValue(vm, entry->value);
+    }
+}
+
+static void blackenObject(VM* vm, Obj* object) {
+    switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->packed) break;
+            for (int i = 0; i < array->count; i++) markValue(vm, array->values[i]);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            for (Value* slot = fiber->stack; slot < fiber->stackTop; slot++) markValue(vm, *slot);
+            markObject(vm, (Obj*)fiber->caller);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            markObject(vm, (Obj*)((ObjFunction*)object)->name);
+            ValueArray* constants = &((ObjFunction*)object)->chunk.constants;
+            for (int i = 0; i < constants->count; i++) markValue(vm, constants->values[i]);
+            break;
+        }
+        case OBJ_MAP:
+            markTable(vm, &((ObjMap*)object)->table);
+            break;
+        case OBJ_MODULE:
+            markObject(vm, (Obj*)((ObjModule*)object)->name);
+            markTable(vm, &((ObjModule*)object)->globals);
+            break;
+        case OBJ_STRING:
+            markObject(vm, ((ObjString*)object)->owner);
+            break;
+        case OBJ_WORKER:
+            markValue(vm, ((ObjWorker*)object)->result);
+            break;
+        case OBJ_CHANNEL:
+        case OBJ_FILE:
+        case OBJ_NATIVE:
+            break;
+    }
+}
+
+static const size_t objectSizes[OBJ_TYPE_COUNT] = {
+    [OBJ_ARRAY] = sizeof(ObjArray),
+    [OBJ_CHANNEL] = sizeof(ObjChannel),
+    [OBJ_FIBER] = sizeof(ObjFiber),
+    [OBJ_FILE] = sizeof(ObjFile),
+    [OBJ_FUNCTION] = sizeof(ObjFunction),
+    [OBJ_MAP] = sizeof(ObjMap),
+    [OBJ_MODULE] = sizeof(ObjModule),
+    [OBJ_NATIVE] = sizeof(ObjNative),
+    [OBJ_STRING] = sizeof(ObjString),
+    [OBJ_WORKER] = sizeof(ObjWorker),
+};
+
+static void freeObject(Heap* heap, Obj* object) {
+    switch (object->type) {
+        case OBJ_ARRAY:
+            freeArrayElements(heap, (ObjArray*)object);
+            break;
+        case OBJ_CHANNEL:
+            releaseChannel(((ObjChannel*)object)->channel);
+            break;
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            reallocate(fiber->stack, sizeof(Value) * fiber->capacity, 0, MEMORY_STACKS);
+            heap->bytesAllocated -= sizeof(Value) * fiber->capacity;
+            break;
+        }
+        case OBJ_FILE:
+            closeFileView(&((ObjFile*)object)->view);
+            break;
+        case OBJ_FUNCTION:
+            freeChunk(&((ObjFunction*)object)->chunk);
+            break;
+        case OBJ_MAP:
+            freeMapEntries(heap, (ObjMap*)object);
+            break;
+        case OBJ_MODULE:
+            freeTable(&((ObjModule*)object)->globals);
+            break;
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            if (string->ownsChars) {
+                reallocate(string->chars, string->length + 1, 0, MEMORY_STRING_CHARS);
+                heap->bytesAllocated -= string->length + 1;
+            }
+            break;
+        }
+        case OBJ_WORKER: {
+            // An unjoined worker stays on its VM's list until the script
+            // ends; it just loses the handle to report back to.
+            Worker* worker = ((ObjWorker*)object)->worker;
+            if (worker != NULL) worker->handle = NULL;
+            break;
+        }
+        case OBJ_NATIVE:
+            break;
+    }
+    size_t size = objectSizes[object->type];
+    heap->bytesAllocated -= size;
+    reallocate(object, size, 0, object->type == OBJ_STRING ? MEMORY_STRINGS : MEMORY_OBJECTS);
+}
+
+void initHeap(Heap* heap) {
+    heap->objects = NULL;
+    heap->bytesAllocated = 0;
+    initTable(&heap->strings);
+}
+
+void freeHeap(Heap* heap) {
+    freeTable(&heap->strings);
+    Obj* object = heap->objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(heap, object);
+        object = next;
+    }
+    heap->objects = NULL;
+}
+
+// Constants belong to the program, whose objects are permanently marked.
+// While a fiber runs, the VM's stack is the fiber's, and the script's own
+// stack ends at rootStackTop; suspended fibers are reached through values.
+// Modules stay alive for as long as the VM has them imported.
+static void markRoots(VM* vm) {
+    Value* rootTop = vm->stackTop;
+    if (vm->fiber != NULL) {
+        vm->fiber->stackTop = vm->stackTop;
+        markObject(vm, (Obj*)vm->fiber);
+        rootTop = vm->rootStackTop;
+    }
+    for (Value* slot = vm->rootStack; slot < rootTop; slot++) {
+        markValue(vm, *slot);
+    }
+    markTable(vm, &vm->globals);
+    markTable(vm, &vm->natives);
+    markTable(vm, &vm->modules);
+}
+
+static void sweep(VM* vm) {
+    Obj* previous = NULL;
+    Obj* object = vm->heap.objects;
+    while (object != NULL) {
+        if (object->isMarked) {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+        } else {
+            Obj* unreached = object;
+            object = object->next;
+            if (previous != NULL) previous->next = object;
+            else vm->heap.objects = object;
+            freeObject(&vm->heap, unreached);
+        }
+    }
+}
+
+// Only called between instructions, when every live value is reachable from
+// the roots; natives and the compiler never trigger a collection.
+void collectGarbage(VM* vm) {
+    markRoots(vm);
+    while (vm->grayCount > 0) {
+        blackenObject(vm, vm->grayStack[--vm->grayCount]);
+    }
+    tableRemoveWhite(&vm->heap.strings);
+    sweep(vm);
+    vm->nextGC = vm->heap.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (vm->nextGC < GC_INITIAL_HEAP) vm->nextGC = GC_INITIAL_HEAP;
+}
+
+
+void takeCensus(Heap* heap, Census* census) {
+    for (Obj* object = heap->objects; object != NULL; object = object->next) {
+        census->objects[object->type]++;
+        census->bytes[object->type] += objectSizes[object->type];
+        if (object->type == OBJ_ARRAY) census->bytes[OBJ_ARRAY] += arrayElementBytes((ObjArray*)object);
+        if (object->type == OBJ_MAP) census->bytes[OBJ_MAP] += mapEntryBytes((ObjMap*)object);
+        if (object->type == OBJ_MODULE) census->bytes[OBJ_MODULE] += sizeof(Entry) * ((ObjModule*)object)->globals.capacity;
+        if (object->type == OBJ_FIBER) census->bytes[OBJ_FIBER] += sizeof(Value) * ((ObjFiber*)object)->capacity;
+        if (object->type != OBJ_STRING) continue;
+        ObjString* string = (ObjString*)object;
+        if (string->ownsChars) census->bytes[OBJ_STRING] += string->length + 1;
+        int bucket = 0;
+        while (bucket < CENSUS_LENGTH_BUCKETS - 1 && string->length >= (1 << bucket)) bucket++;
+        census->stringLengths[bucket]++;
+    }
+}
+
+static const char* const categoryNames[MEMORY_CATEGORY_COUNT] = {
+    [MEMORY_STRINGS] = "strings",
+    [MEMORY_STRING_CHARS] = "string chars",
+    [MEMORY_OBJECTS] = "other objects",
+    [MEMORY_TABLES] = "table entries",
+    [MEMORY_CODE] = "code and lines",
+    [MEMORY_CONSTANTS] = "constants",
+    [MEMORY_ARRAYS] = "array elements",
+    [MEMORY_STACKS] = "value stacks",
+};
+
+static const char* const typeNames[OBJ_TYPE_COUNT] = {
+    [OBJ_ARRAY] = "array",
+    [OBJ_CHANNEL] = "channel",
+    [OBJ_FIBER] = "fiber",
+    [OBJ_FILE] = "file",
+    [OBJ_FUNCTION] = "block",
+    [OBJ_MAP] = "map",
+    [OBJ_MODULE] = "module",
+    [OBJ_NATIVE] = "native",
+    [OBJ_STRING] = "string",
+    [OBJ_WORKER] = "worker",
+};
+
+void printMemoryStats(VM* vm, FILE* file) {
+    MemoryAccount* previous = useMemoryAccount(&vm->memory);
+    collectGarbage(vm);
+    useMemoryAccount(previous);
+
+    MemoryAccount* account = &vm->memory;
+    fprintf(file, "%-20s %14s %14s\n", "memory", "live", "peak");
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        fprintf(file, "  %-18s %14zu %14zu\n", categoryNames[i], account->live[i], account->peak[i]);
+    }
+    fprintf(file, "  %-18s %14zu %14zu\n", "total", account->total, account->peakTotal);
+    if (account->limit != MEMORY_UNLIMITED) {
+        fprintf(file, "  %-18s %14zu\n", "limit", account->limit);
+    }
+
+    Census census;
+    memset(&census, 0, sizeof(Census));
+    takeCensus(&vm->heap, &census);
+    for (int i = 0; i < vm->programCount; i++) takeCensus(&vm->programs[i]->heap, &census);
+    fprintf(file, "%-20s %14s %14s\n", "objects", "count", "bytes");
+    for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+        if (census.objects[i] == 0) continue;
+        fprintf(file, "  %-18s %14zu %14zu\n", typeNames[i], census.objects[i], census.bytes[i]);
+    }
+    fprintf(file, "%-20s %14s\n", "string lengths", "count");
+    for (int i = 0; i < CENSUS_LENGTH_BUCKETS; i++) {
+        if (census.stringLengths[i] == 0) continue;
+        char range[32];
+        if (i == 0) snprintf(range, sizeof(range), "0");
+        else if (i == 1) snprintf(range, sizeof(range), "1");
+        else if (i == CENSUS_LENGTH_BUCKETS - 1) snprintf(range, sizeof(range), "%d+", 1 << (i - 1));
+        else snprintf(range, sizeof(range), "%d-%d", 1 << (i - 1), (1 << i) - 1);
+        fprintf(file, "  %-18s %14zu\n", range, census.stringLengths[i]);
+    }
+}
\ No newline at end of file
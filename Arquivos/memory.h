@@ -0,0 +1,82 @@
+#ifndef APOLO_MEMORY_H
+#define APOLO_MEMORY_H
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+#define GC_INITIAL_HEAP (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
+#define MEMORY_UNLIMITED SIZE_MAX
+
+typedef enum {
+    MEMORY_STRINGS,
+    MEMORY_STRING_CHARS,
+    MEMORY_OBJECTS,
+    MEMORY_TABLES,
+    MEMORY_CODE,
+    MEMORY_CONSTANTS,
+    MEMORY_ARRAYS,
+    MEMORY_STACKS,
+    MEMORY_CATEGORY_COUNT
+} MemoryCategory;
+
+// Bytes in use and the most ever in use at once, by category and in total.
+// MEMORY_STRINGS is the string objects themselves, MEMORY_OBJECTS every
+// other object, MEMORY_CODE bytecode with its line table, MEMORY_ARRAYS
+// the elements of arrays, MEMORY_STACKS the value stacks of VMs and fibers. Memory is charged to the account current on the
+// thread when it is allocated or freed; the collector's own bookkeeping
+// and buffers shared between VMs, like channels, are not charged to anyone.
+typedef struct {
+    size_t live[MEMORY_CATEGORY_COUNT];
+    size_t peak[MEMORY_CATEGORY_COUNT];
+    size_t total;
+    size_t peakTotal;
+    size_t limit;
+} MemoryAccount;
+
+#define CENSUS_LENGTH_BUCKETS 16
+#define OBJ_TYPE_COUNT (OBJ_WORKER + 1)
+
+// Objects in a heap by type, and its strings by length: bucket 0 holds
+// empty strings and bucket n lengths from 2^(n-1) up to 2^n - 1, with the
+// last bucket taking everything longer.
+typedef struct {
+    size_t objects[OBJ_TYPE_COUNT];
+    size_t bytes[OBJ_TYPE_COUNT];
+    size_t stringLengths[CENSUS_LENGTH_BUCKETS];
+} Census;
+
+extern _Thread_local MemoryAccount* currentAccount;
+
+void initMemoryAccount(MemoryAccount* account);
+// Makes account the one this thread charges and returns the previous one,
+// to be restored when done.
+MemoryAccount* useMemoryAccount(MemoryAccount* account);
+bool overMemoryLimit(MemoryAccount* account);
+// Every allocation the accounting covers goes through here. A newSize of 0
+// frees pointer. Running out of memory for real exits the process; the
+// limit is enforced by the VM between instructions.
+void* reallocate(void* pointer, size_t oldSize, size_t newSize, MemoryCategory category);
+// For what a script asks for in one go, like array(n, value), so it ends
+// with a runtime error instead. NULL, with nothing charged and pointer
+// left as it was, when the memory isn't there or growing by that much
+// alone would go over the current account's limit. A smaller request is
+// allowed even past the limit, and the VM stops the script at its next
+// safepoint if it still holds too much once garbage is collected.
+void* tryReallocate(void* pointer, size_t oldSize, size_t newSize, MemoryCategory category);
+bool withinMemoryLimit(size_t bytes);
+// Charges memory allocated elsewhere, like strings built with malloc and
+// handed over to takeString().
+void trackMemory(MemoryCategory category, size_t oldSize, size_t newSize);
+
+void initHeap(Heap* heap);
+void freeHeap(Heap* heap);
+void collectGarbage(VM* vm);
+void takeCensus(Heap* heap, Census* census);
+// Account totals and a census of the VM's heap and programs, taken after a
+// full collection.
+void printMemoryStats(VM* vm, FILE* file);
+
+#endif
@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "memory.h"
+#include "module.h"
+
+// Entries are only ever added, so a module's number, its index plus one,
+// stays the same for the life of the process. A process imports a handful
+// of modules, so the cache is a list. file is what stat() said about the
+// path when the contents were last read and found to hash to hash.
+typedef struct {
+    char* path;
+    uint64_t hash;
+    struct stat file;
+    Program* program;
+} Module;
+
+static Module* modules = NULL;
+static int moduleCount = 0;
+static int moduleCapacity = 0;
+static pthread_mutex_t modulesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hashContents(const char* chars, size_t length) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static bool sameFile(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static Module* findUnchanged(const char* path, const struct stat* file) {
+    for (int i = 0; i < moduleCount; i++) {
+        if (sameFile(&modules[i].file, file) && strcmp(modules[i].path, path) == 0) return &modules[i];
+    }
+    return NULL;
+}
+
+static Module* findModule(const char* path, uint64_t hash) {
+    for (int i = 0; i < moduleCount; i++) {
+        if (modules[i].hash == hash && strcmp(modules[i].path, path) == 0) return &modules[i];
+    }
+    return NULL;
+}
+
+// A file whose device, inode, size and modification time are what they
+// were when it was last read is taken to be unchanged, and isn't read
+// again. Otherwise its contents are hashed to find out. The file is
+// stat()ed before it is read, so a write in between only costs another
+// read next time. Compiling under the lock keeps two threads from
+// compiling the same module at once. The program belongs to the process,
+// so it isn't charged to the VM that happened to import it first.
+ObjFunction* loadModule(const char* path, Output* errors) {
+    char* canonical = realpath(path, NULL);
+    if (canonical == NULL) return NULL;
+    struct stat file;
+    if (stat(canonical, &file) != 0) {
+        free(canonical);
+        return NULL;
+    }
+    pthread_mutex_lock(&modulesLock);
+    Module* cached = findUnchanged(canonical, &file);
+    ObjFunction* body = cached != NULL ? cached->program->body : NULL;
+    pthread_mutex_unlock(&modulesLock);
+    if (body != NULL) {
+        free(canonical);
+        return body;
+    }
+
+    FileView source;
+    if (!openFileView(canonical, &source)) {
+        free(canonical);
+        return NULL;
+    }
+    uint64_t hash = hashContents(source.chars, source.length);
+
+    pthread_mutex_lock(&modulesLock);
+    cached = findModule(canonical, hash);
+    if (cached != NULL) {
+        cached->file = file;
+        body = cached->program->body;
+    } else {
+        MemoryAccount* previous = useMemoryAccount(NULL);
+        Program* program = (Program*)malloc(sizeof(Program));
+        initProgram(program);
+        if (compileModule(source.chars, path, moduleCount + 1, program, errors)) {
+            if (moduleCapacity < moduleCount + 1) {
+                moduleCapacity = moduleCapacity < 8 ? 8 : moduleCapacity * 2;
+                modules = (Module*)realloc(modules, sizeof(Module) * moduleCapacity);
+            }
+            Module* module = &modules[moduleCount++];
+            module->path = canonical;
+            module->hash = hash;
+            module->file = file;
+            module->program = program;
+            canonical = NULL;
+            body = program->body;
+        } else {
+            freeProgram(program);
+            free(program);
+        }
+        useMemoryAccount(previous);
+    }
+    pthread_mutex_unlock(&modulesLock);
+    free(canonical);
+    closeFileView(&source);
+    return body;
+}
+
+// Paths are never freed or changed while the process uses modules, so
+// the pointer stays good after the lock is released.
+const char* modulePath(int module, uint64_t* hash) {
+    const char* path = NULL;
+    pthread_mutex_lock(&modulesLock);
+    if (module >= 1 && module <= moduleCount) {
+        path = modules[module - 1].path;
+        *hash = modules[module - 1].hash;
+    }
+    pthread_mutex_unlock(&modulesLock);
+    return path;
+}
+
+void freeModules() {
+    for (int i = 0; i < moduleCount; i++) {
+        freeProgram(modules[i].program);
+        free(modules[i].program);
+        free(modules[i].path);
+    }
+    free(modules);
+    modules = NULL;
+    moduleCount = 0;
+    moduleCapacity = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef APOLO_MODULE_H
+#define APOLO_MODULE_H
+
+#include "compiler.h"
+
+// Modules are compiled once per process and shared, read-only, by every
+// VM on every thread. They are cached under their canonical path and a
+// hash of their contents, so a file edited between imports compiles again
+// under a new number, and the old program stays for the VMs running it.
+// The contents are only read again when stat() shows the file changed.
+// Returns the module's top-level code, or NULL if the file can't be read
+// or doesn't compile, after writing the compile errors to errors.
+ObjFunction* loadModule(const char* path, Output* errors);
+// The canonical path module was compiled from and the hash of the
+// contents it had, or NULL if no module has that number.
+const char* modulePath(int module, uint64_t* hash);
+// Only once no VM will run module code again.
+void freeModules();
+
+#endif
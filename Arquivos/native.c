@@ -0,0 +1,605 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "array.h"
+#include "channel.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "number.h"
+#include "object.h"
+#include "text.h"
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// tonumber(value): numbers pass through, strings holding a decimal number
+// (surrounding whitespace allowed) are converted, anything else gives nil.
+static bool tonumberNative(VM* vm, int argCount, Value* args, Value* result) {
+    *result = NIL_VAL;
+    if (IS_NUMBER(args[0])) {
+        *result = args[0];
+    } else if (IS_STRING(args[0])) {
+        const char* start = AS_CSTRING(args[0]);
+        const char* end = start + AS_STRING(args[0])->length;
+        while (start < end && isSpace(*start)) start++;
+        while (end > start && isSpace(end[-1])) end--;
+        double number;
+        if (parseNumber(start, (int)(end - start), &number)) *result = numberValue(number);
+    }
+    return true;
+}
+
+// openfile(path) maps a file for reading and returns nil if it can't be
+// opened. The mapping lives as long as the VM, since the lines and fields
+// taken from it point straight into it.
+static bool openfileNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_STRING(args[0])) {
+        runtimeError(vm, "File path must be a string.");
+        return false;
+    }
+    ObjString* path = AS_STRING(args[0]);
+    char* cpath = (char*)malloc(path->length + 1);
+    memcpy(cpath, path->chars, path->length);
+    cpath[path->length] = '\0';
+    FileView view;
+    bool opened = openFileView(cpath, &view);
+    free(cpath);
+    *result = opened ? OBJ_VAL(newFile(&vm->heap, view)) : NIL_VAL;
+    return true;
+}
+
+// readline(file) returns the next line as a slice of the mapping, or nil at
+// the end of the file.
+static bool readlineNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_FILE(args[0])) {
+        runtimeError(vm, "Argument must be a file.");
+        return false;
+    }
+    ObjFile* file = AS_FILE(args[0]);
+    size_t remaining = file->view.length - file->position;
+    if (remaining == 0) {
+        *result = NIL_VAL;
+        return true;
+    }
+    const char* start = file->view.chars + file->position;
+    const char* newline = (const char*)memchr(start, '\n', remaining);
+    size_t length = newline != NULL ? (size_t)(newline - start) : remaining;
+    file->position += newline != NULL ? length + 1 : length;
+    *result = OBJ_VAL(newSlice(&vm->heap, (Obj*)file, start, (int)length));
+    return true;
+}
+
+// field(string, separator, index) returns the index-th field (from 0) as a
+// slice of the string, or nil when there are fewer fields.
+static bool fieldNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_STRING(args[0]) || !IS_STRING(args[1]) || AS_STRING(args[1])->length == 0) {
+        runtimeError(vm, "Expected a string and a non-empty separator.");
+        return false;
+    }
+    if (!IS_NUMBER(args[2]) || AS_NUMBER(args[2]) < 0) {
+        runtimeError(vm, "Field index must be a non-negative number.");
+        return false;
+    }
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* separator = AS_STRING(args[1]);
+    long index = (long)AS_NUMBER(args[2]);
+
+    const char* start = string->chars;
+    const char* end = string->chars + string->length;
+    for (;;) {
+        const char* match = findText(start, end - start, separator->chars, separator->length);
+        const char* fieldEnd = match != NULL ? match : end;
+        if (index == 0) {
+            *result = OBJ_VAL(newSlice(&vm->heap, (Obj*)string, start, (int)(fieldEnd - start)));
+            return true;
+        }
+        if (match == NULL) break;
+        start = match + separator->length;
+        index--;
+    }
+    *result = NIL_VAL;
+    return true;
+}
+
+static bool stringArguments(VM* vm, int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_STRING(args[i])) {
+            runtimeError(vm, argCount == 1 ? "Argument must be a string." : "Arguments must be strings.");
+            return false;
+        }
+    }
+    return true;
+}
+
+// substring(string, start, end) is the characters from start up to, not
+// including, end, as a slice of the string.
+static bool substringNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 1, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    double start = IS_NUMBER(args[1]) ? AS_NUMBER(args[1]) : -1;
+    double end = IS_NUMBER(args[2]) ? AS_NUMBER(args[2]) : -1;
+    if (!(start >= 0 && start <= end && end <= string->length) || start != (int)start || end != (int)end) {
+        runtimeError(vm, "Substring bounds must be whole numbers with 0 <= start <= end <= length.");
+        return false;
+    }
+    *result = OBJ_VAL(newSlice(&vm->heap, (Obj*)string, string->chars + (int)start, (int)(end - start)));
+    return true;
+}
+
+// find(string, text) is the index where text first occurs, or nil.
+static bool findNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 2, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* text = AS_STRING(args[1]);
+    const char* match = findText(string->chars, string->length, text->chars, text->length);
+    *result = match != NULL ? INT_VAL(match - string->chars) : NIL_VAL;
+    return true;
+}
+
+// split(string, separator) is an array of the fields between separators,
+// each a slice of the string.
+static bool splitNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 2, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* separator = AS_STRING(args[1]);
+    if (separator->length == 0) {
+        runtimeError(vm, "Separator can't be empty.");
+        return false;
+    }
+    ObjArray* fields = newArray(&vm->heap);
+    unpackArray(&vm->heap, fields);
+    const char* start = string->chars;
+    const char* end = string->chars + string->length;
+    for (;;) {
+        const char* match = findText(start, end - start, separator->chars, separator->length);
+        const char* fieldEnd = match != NULL ? match : end;
+        Value field = OBJ_VAL(newSlice(&vm->heap, (Obj*)string, start, (int)(fieldEnd - start)));
+        if (!arrayAppend(&vm->heap, fields, field)) {
+            allocationError(vm, arrayElementBytes(fields));
+            return false;
+        }
+        if (match == NULL) break;
+        start = match + separator->length;
+    }
+    *result = OBJ_VAL(fields);
+    return true;
+}
+
+// replace(string, text, replacement) swaps every occurrence of text,
+// scanning left to right. The string itself comes back if text isn't in it.
+static bool replaceNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 3, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* text = AS_STRING(args[1]);
+    ObjString* replacement = AS_STRING(args[2]);
+    if (text->length == 0) {
+        runtimeError(vm, "Text to replace can't be empty.");
+        return false;
+    }
+    size_t count = countText(string->chars, string->length, text->chars, text->length);
+    if (count == 0) {
+        *result = args[0];
+        return true;
+    }
+    size_t length = string->length - count * text->length + count * replacement->length;
+    if (length > INT_MAX - 1) {
+        runtimeError(vm, "Replacing would make the string too long.");
+        return false;
+    }
+    char* chars = (char*)tryReallocate(NULL, 0, length + 1, MEMORY_STRING_CHARS);
+    if (chars == NULL) {
+        allocationError(vm, length + 1);
+        return false;
+    }
+    char* out = chars;
+    const char* start = string->chars;
+    const char* end = string->chars + string->length;
+    for (size_t i = 0; i < count; i++) {
+        const char* match = findText(start, end - start, text->chars, text->length);
+        memcpy(out, start, match - start);
+        out += match - start;
+        memcpy(out, replacement->chars, replacement->length);
+        out += replacement->length;
+        start = match + text->length;
+    }
+    memcpy(out, start, end - start);
+    chars[length] = '\0';
+    *result = OBJ_VAL(takeStringUninterned(&vm->heap, chars, (int)length));
+    return true;
+}
+
+// trim(string) drops surrounding whitespace, giving a slice of the string.
+static bool trimNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 1, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    const char* start = string->chars;
+    const char* end = string->chars + string->length;
+    while (start < end && isSpace(*start)) start++;
+    while (end > start && isSpace(end[-1])) end--;
+    if (end - start == string->length) {
+        *result = args[0];
+        return true;
+    }
+    *result = OBJ_VAL(newSlice(&vm->heap, (Obj*)string, start, (int)(end - start)));
+    return true;
+}
+
+static ObjString* changeCase(VM* vm, ObjString* string, void (*mapText)(char*, const char*, size_t)) {
+    char* chars = (char*)reallocate(NULL, 0, string->length + 1, MEMORY_STRING_CHARS);
+    mapText(chars, string->chars, string->length);
+    chars[string->length] = '\0';
+    return takeStringUninterned(&vm->heap, chars, string->length);
+}
+
+// upper(string) and lower(string) change the case of ASCII letters.
+static bool upperNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 1, args)) return false;
+    *result = OBJ_VAL(changeCase(vm, AS_STRING(args[0]), upperText));
+    return true;
+}
+
+static bool lowerNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 1, args)) return false;
+    *result = OBJ_VAL(changeCase(vm, AS_STRING(args[0]), lowerText));
+    return true;
+}
+
+// startswith(string, prefix) and endswith(string, suffix).
+static bool startswithNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 2, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* prefix = AS_STRING(args[1]);
+    *result = BOOL_VAL(prefix->length <= string->length &&
+                       memcmp(string->chars, prefix->chars, prefix->length) == 0);
+    return true;
+}
+
+static bool endswithNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!stringArguments(vm, 2, args)) return false;
+    ObjString* string = AS_STRING(args[0]);
+    ObjString* suffix = AS_STRING(args[1]);
+    *result = BOOL_VAL(suffix->length <= string->length &&
+                       memcmp(string->chars + string->length - suffix->length, suffix->chars, suffix->length) == 0);
+    return true;
+}
+
+// channel(capacity) makes a channel holding up to capacity values, rounded
+// up to a power of two. Channels can be captured by spawn and sent over
+// other channels; every VM that receives one shares the same queue.
+static bool channelNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 1 || AS_NUMBER(args[0]) > (1 << 24)) {
+        runtimeError(vm, "Channel capacity must be a number from 1 to 16777216.");
+        return false;
+    }
+    *result = OBJ_VAL(newChannelObject(&vm->heap, newChannel((int)AS_NUMBER(args[0]))));
+    return true;
+}
+
+// send(channel, value) waits for room and enqueues a copy of the value.
+static bool sendNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_CHANNEL(args[0])) {
+        runtimeError(vm, "Argument must be a channel.");
+        return false;
+    }
+    Message message;
+    if (!packMessage(args[1], &message)) {
+        runtimeError(vm, "Only nil, booleans, numbers, strings and channels can be sent.");
+        return false;
+    }
+    if (!channelSend(AS_CHANNEL(args[0])->channel, &message)) {
+        freeMessage(&message);
+        runtimeError(vm, "Send on a closed channel.");
+        return false;
+    }
+    *result = NIL_VAL;
+    return true;
+}
+
+// receive(channel) waits for a value, or returns nil once the channel is
+// closed and empty.
+static bool receiveNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_CHANNEL(args[0])) {
+        runtimeError(vm, "Argument must be a channel.");
+        return false;
+    }
+    Message message;
+    *result = channelReceive(AS_CHANNEL(args[0])->channel, &message)
+        ? unpackMessage(&vm->heap, &message) : NIL_VAL;
+    return true;
+}
+
+// close(channel) makes further sends fail and lets receivers drain what is
+// left.
+static bool closeNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_CHANNEL(args[0])) {
+        runtimeError(vm, "Argument must be a channel.");
+        return false;
+    }
+    closeChannel(AS_CHANNEL(args[0])->channel);
+    *result = NIL_VAL;
+    return true;
+}
+
+// join(worker) waits for a spawned block and returns its return value. It
+// can be called again and returns the same value.
+static bool joinNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_WORKER(args[0])) {
+        runtimeError(vm, "Argument must be a worker.");
+        return false;
+    }
+    ObjWorker* handle = AS_WORKER(args[0]);
+    if (handle->worker != NULL && !joinWorker(vm, handle->worker)) {
+        runtimeError(vm, "Spawned block failed.");
+        return false;
+    }
+    *result = handle->result;
+    return true;
+}
+
+// done(fiber) tells whether a fiber has returned.
+static bool doneNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_FIBER(args[0])) {
+        runtimeError(vm, "Argument must be a fiber.");
+        return false;
+    }
+    *result = BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+    return true;
+}
+
+// array(length, value) makes an array holding length copies of value.
+static bool arrayNative(VM* vm, int argCount, Value* args, Value* result) {
+    double length = IS_NUMBER(args[0]) ? AS_NUMBER(args[0]) : -1;
+    if (!(length >= 0 && length <= ARRAY_MAX) || length != (int)length) {
+        runtimeError(vm, "Array length must be a whole number from 0 to %d.", ARRAY_MAX);
+        return false;
+    }
+    ObjArray* array = newArray(&vm->heap);
+    if (!IS_NUMBER(args[1])) unpackArray(&vm->heap, array);
+    if (!arrayReserve(&vm->heap, array, (int)length)) {
+        allocationError(vm, (size_t)length * (array->packed ? sizeof(double) : sizeof(Value)));
+        return false;
+    }
+    array->count = (int)length;
+    if (array->packed) {
+        fillNumbers(array->numbers, array->count, AS_NUMBER(args[1]));
+    } else {
+        for (int i = 0; i < array->count; i++) array->values[i] = args[1];
+    }
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+// len(value) is the number of elements of an array, keys of a map or
+// characters of a string.
+static bool lenNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (IS_ARRAY(args[0])) {
+        *result = INT_VAL(AS_ARRAY(args[0])->count);
+    } else if (IS_MAP(args[0])) {
+        *result = INT_VAL(AS_MAP(args[0])->count);
+    } else if (IS_STRING(args[0])) {
+        *result = INT_VAL(AS_STRING(args[0])->length);
+    } else {
+        runtimeError(vm, "Argument must be an array, a map or a string.");
+        return false;
+    }
+    return true;
+}
+
+// push(array, value) adds value at the end.
+static bool pushNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    if (AS_ARRAY(args[0])->count == ARRAY_MAX) {
+        runtimeError(vm, "Array can't hold more than %d elements.", ARRAY_MAX);
+        return false;
+    }
+    if (!arrayAppend(&vm->heap, AS_ARRAY(args[0]), args[1])) {
+        allocationError(vm, arrayElementBytes(AS_ARRAY(args[0])));
+        return false;
+    }
+    *result = NIL_VAL;
+    return true;
+}
+
+// pop(array) removes the last element and returns it, or nil when the
+// array is empty.
+static bool popNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    *result = array->count > 0 ? arrayGet(array, --array->count) : NIL_VAL;
+    return true;
+}
+
+// The bulk natives work on packed arrays. An unpacked array whose elements
+// are all numbers again is packed back first, and stays packed.
+static ObjArray* numberArray(VM* vm, Value value) {
+    if (!IS_ARRAY(value)) {
+        runtimeError(vm, "Argument must be an array.");
+        return NULL;
+    }
+    if (!packArray(&vm->heap, AS_ARRAY(value))) {
+        runtimeError(vm, "Array must hold only numbers.");
+        return NULL;
+    }
+    return AS_ARRAY(value);
+}
+
+// sum(array) adds up an array of numbers.
+static bool sumNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* array = numberArray(vm, args[0]);
+    if (array == NULL) return false;
+    *result = numberValue(sumNumbers(array->numbers, array->count));
+    return true;
+}
+
+// min(array) and max(array) are nil for an empty array.
+static bool minNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* array = numberArray(vm, args[0]);
+    if (array == NULL) return false;
+    *result = array->count > 0 ? numberValue(minNumbers(array->numbers, array->count)) : NIL_VAL;
+    return true;
+}
+
+static bool maxNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* array = numberArray(vm, args[0]);
+    if (array == NULL) return false;
+    *result = array->count > 0 ? numberValue(maxNumbers(array->numbers, array->count)) : NIL_VAL;
+    return true;
+}
+
+// dot(a, b) is the sum of the products of elements at the same index.
+static bool dotNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a = numberArray(vm, args[0]);
+    if (a == NULL) return false;
+    ObjArray* b = numberArray(vm, args[1]);
+    if (b == NULL) return false;
+    if (a->count != b->count) {
+        runtimeError(vm, "Arrays must have the same length.");
+        return false;
+    }
+    *result = numberValue(dotNumbers(a->numbers, b->numbers, a->count));
+    return true;
+}
+
+static int compareStrings(const void* a, const void* b) {
+    ObjString* left = AS_STRING(*(const Value*)a);
+    ObjString* right = AS_STRING(*(const Value*)b);
+    int length = left->length < right->length ? left->length : right->length;
+    int order = memcmp(left->chars, right->chars, length);
+    return order != 0 ? order : left->length - right->length;
+}
+
+// sort(array) sorts numbers ascending, or strings byte by byte, in place.
+static bool sortNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    *result = NIL_VAL;
+    if (packArray(&vm->heap, array)) {
+        sortNumbers(array->numbers, array->count);
+        return true;
+    }
+    for (int i = 0; i < array->count; i++) {
+        if (!IS_STRING(array->values[i])) {
+            runtimeError(vm, "Array must hold only numbers or only strings.");
+            return false;
+        }
+    }
+    qsort(array->values, array->count, sizeof(Value), compareStrings);
+    return true;
+}
+
+// fill(array, value) sets every element to value.
+static bool fillNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_ARRAY(args[0])) {
+        runtimeError(vm, "Argument must be an array.");
+        return false;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (IS_NUMBER(args[1]) && array->packed) {
+        fillNumbers(array->numbers, array->count, AS_NUMBER(args[1]));
+    } else if (IS_NUMBER(args[1])) {
+        // Every element is a number now, so the array can go back to packed.
+        for (int i = 0; i < array->count; i++) array->values[i] = args[1];
+        packArray(&vm->heap, array);
+    } else {
+        unpackArray(&vm->heap, array);
+        for (int i = 0; i < array->count; i++) array->values[i] = args[1];
+    }
+    *result = NIL_VAL;
+    return true;
+}
+
+// map(capacity) makes an empty map with room for capacity keys, so filling
+// it up to there never has to rehash.
+static bool mapNative(VM* vm, int argCount, Value* args, Value* result) {
+    double capacity = IS_NUMBER(args[0]) ? AS_NUMBER(args[0]) : -1;
+    if (!(capacity >= 0 && capacity <= MAP_MAX)) {
+        runtimeError(vm, "Map capacity must be a number from 0 to %d.", MAP_MAX);
+        return false;
+    }
+    ObjMap* map = newMap(&vm->heap);
+    if (!mapReserve(&vm->heap, map, (int)capacity)) {
+        allocationError(vm, (size_t)(capacity * 4 / 3) * sizeof(Entry));
+        return false;
+    }
+    *result = OBJ_VAL(map);
+    return true;
+}
+
+// has(map, key) tells a key holding nil from a missing one.
+static bool hasNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (!IS_MAP(args[0])) {
+        runtimeError(vm, "Argument must be a map.");
+        return false;
+    }
+    Value key;
+    Value value;
+    *result = BOOL_VAL(mapKey(args[1], &key) && mapGet(AS_MAP(args[0]), key, &value));
+    return true;
+}
+
+// clock() returns seconds since an arbitrary starting point, for timing.
+static bool clockNative(VM* vm, int argCount, Value* args, Value* result) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *result = DOUBLE_VAL(ts.tv_sec + ts.tv_nsec / 1e9);
+    return true;
+}
+
+static void defineNative(VM* vm, const char* name, NativeFn function, int arity) {
+    ObjString* key = copyString(&vm->heap, name, (int)strlen(name));
+    Value native = OBJ_VAL(newNative(&vm->heap, function, arity));
+    tableSet(&vm->globals, OBJ_VAL(key), native);
+    tableSet(&vm->natives, OBJ_VAL(key), native);
+}
+
+// Every call and global access probes the globals, so they start out
+// with room for several times the natives and stay sparse. natives keeps
+// them apart from the script's globals, for modules to start from.
+void defineNatives(VM* vm) {
+    tableReserve(&vm->globals, 128);
+    defineNative(vm, "tonumber", tonumberNative, 1);
+    defineNative(vm, "openfile", openfileNative, 1);
+    defineNative(vm, "readline", readlineNative, 1);
+    defineNative(vm, "field", fieldNative, 3);
+    defineNative(vm, "substring", substringNative, 3);
+    defineNative(vm, "find", findNative, 2);
+    defineNative(vm, "split", splitNative, 2);
+    defineNative(vm, "replace", replaceNative, 3);
+    defineNative(vm, "trim", trimNative, 1);
+    defineNative(vm, "upper", upperNative, 1);
+    defineNative(vm, "lower", lowerNative, 1);
+    defineNative(vm, "startswith", startswithNative, 2);
+    defineNative(vm, "endswith", endswithNative, 2);
+    defineNative(vm, "channel", channelNative, 1);
+    defineNative(vm, "send", sendNative, 2);
+    defineNative(vm, "receive", receiveNative, 1);
+    defineNative(vm, "close", closeNative, 1);
+    defineNative(vm, "join", joinNative, 1);
+    defineNative(vm, "done", doneNative, 1);
+    defineNative(vm, "clock", clockNative, 0);
+    defineNative(vm, "array", arrayNative, 2);
+    defineNative(vm, "len", lenNative, 1);
+    defineNative(vm, "push", pushNative, 2);
+    defineNative(vm, "pop", popNative, 1);
+    defineNative(vm, "sum", sumNative, 1);
+    defineNative(vm, "min", minNative, 1);
+    defineNative(vm, "max", maxNative, 1);
+    defineNative(vm, "dot", dotNative, 2);
+    defineNative(vm, "sort", sortNative, 1);
+    defineNative(vm, "fill", fillNative, 2);
+    defineNative(vm, "map", mapNative, 1);
+    defineNative(vm, "has", hasNative, 2);
+}
@@ -0,0 +1,8 @@
+#ifndef APOLO_NATIVE_H
+#define APOLO_NATIVE_H
+
+#include "vm.h"
+
+void defineNatives(VM* vm);
+
+#endif
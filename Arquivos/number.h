@@ -0,0 +1,14 @@
+#ifndef APOLO_NUMBER_H
+#define APOLO_NUMBER_H
+
+#include "common.h"
+
+// Longest output of formatNumber, including the sign and exponent.
+#define NUMBER_BUFFER_SIZE 32
+
+int formatNumber(double value, char* buffer);
+// Prints an int exactly as formatNumber prints the same number as a double.
+int formatInteger(int64_t value, char* buffer);
+bool parseNumber(const char* chars, int length, double* value);
+
+#endif
@@ -1,21 +1,95 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "memory.h"
 #include "object.h"
+#include "stats.h"
 #include "table.h"
-#include "vm.h"
 
-#define ALLOCATE_OBJ(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(heap, type, objectType) \
+    (type*)allocateObject(heap, sizeof(type), objectType)
 
-static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)malloc(size);
+static Obj* allocateObject(Heap* heap, size_t size, ObjType type) {
+    Obj* object = (Obj*)reallocate(NULL, 0, size,
+                                   type == OBJ_STRING ? MEMORY_STRINGS : MEMORY_OBJECTS);
+    heap->bytesAllocated += size;
     object->type = type;
-    object->next = vm.objects;
-    vm.objects = object;
+    object->isMarked = false;
+    object->next = heap->objects;
+    heap->objects = object;
     return object;
 }
 
+ObjArray* newArray(Heap* heap) {
+    ObjArray* array = ALLOCATE_OBJ(heap, ObjArray, OBJ_ARRAY);
+    array->packed = true;
+    array->count = 0;
+    array->capacity = 0;
+    array->numbers = NULL;
+    array->values = NULL;
+    return array;
+}
+
+ObjChannel* newChannelObject(Heap* heap, Channel* channel) {
+    ObjChannel* object = ALLOCATE_OBJ(heap, ObjChannel, OBJ_CHANNEL);
+    object->channel = channel;
+    return object;
+}
+
+ObjFiber* newFiber(Heap* heap, ObjFunction* function) {
+    ObjFiber* fiber = ALLOCATE_OBJ(heap, ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_SUSPENDED;
+    fiber->started = false;
+    fiber->function = function;
+    fiber->chunk = &function->chunk;
+    fiber->ip = function->chunk.code;
+    fiber->globals = NULL;
+    fiber->caller = NULL;
+    fiber->capacity = function->chunk.maxDepth;
+    fiber->stack = (Value*)reallocate(NULL, 0, sizeof(Value) * fiber->capacity, MEMORY_STACKS);
+    heap->bytesAllocated += sizeof(Value) * fiber->capacity;
+    fiber->slots = fiber->stack;
+    fiber->stackTop = fiber->stack;
+    return fiber;
+}
+
+ObjFile* newFile(Heap* heap, FileView view) {
+    ObjFile* file = ALLOCATE_OBJ(heap, ObjFile, OBJ_FILE);
+    file->view = view;
+    file->position = 0;
+    return file;
+}
+
+ObjFunction* newFunction(Heap* heap) {
+    ObjFunction* function = ALLOCATE_OBJ(heap, ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->module = 0;
+    function->name = NULL;
+    initChunk(&function->chunk);
+    return function;
+}
+
+ObjModule* newModule(Heap* heap, ObjString* name) {
+    ObjModule* module = ALLOCATE_OBJ(heap, ObjModule, OBJ_MODULE);
+    module->name = name;
+    initTable(&module->globals);
+    return module;
+}
+
+ObjMap* newMap(Heap* heap) {
+    ObjMap* map = ALLOCATE_OBJ(heap, ObjMap, OBJ_MAP);
+    map->count = 0;
+    initTable(&map->table);
+    return map;
+}
+
+ObjNative* newNative(Heap* heap, NativeFn function, int arity) {
+    ObjNative* native = ALLOCATE_OBJ(heap, ObjNative, OBJ_NATIVE);
+    native->function = function;
+    native->arity = arity;
+    return native;
+}
+
 static uint32_t hashString(const char* key, int length) {
     uint32_t hash = 2166136261u;
     for (int i = 0; i < length; i++) {
@@ -25,40 +99,183 @@ static uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+uint32_t hashUninterned(ObjString* string) {
+    string->hash = hashString(string->chars, string->length);
+    return string->hash;
+}
+
+static ObjString* allocateString(Heap* heap, char* chars, int length, uint32_t hash) {
+    COUNT(stringsAllocated);
+    ObjString* string = ALLOCATE_OBJ(heap, ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
-    tableSet(&vm.strings, string, NIL_VAL);
+    string->interned = true;
+    string->ownsChars = true;
+    string->owner = NULL;
+    heap->bytesAllocated += length + 1;
+    tableSet(&heap->strings, OBJ_VAL(string), NIL_VAL);
+    return string;
+}
+
+ObjString* newSlice(Heap* heap, Obj* owner, const char* chars, int length) {
+    if (owner->type == OBJ_STRING && ((ObjString*)owner)->owner != NULL) {
+        owner = ((ObjString*)owner)->owner;
+    }
+    COUNT(stringsAllocated);
+    ObjString* string = ALLOCATE_OBJ(heap, ObjString, OBJ_STRING);
+    string->length = length;
+    string->chars = (char*)chars;
+    string->hash = 0;
+    string->interned = false;
+    string->ownsChars = false;
+    string->owner = owner;
+    return string;
+}
+
+ObjString* takeStringUninterned(Heap* heap, char* chars, int length) {
+    COUNT(stringsAllocated);
+    ObjString* string = ALLOCATE_OBJ(heap, ObjString, OBJ_STRING);
+    heap->bytesAllocated += length + 1;
+    string->length = length;
+    string->chars = chars;
+    string->hash = 0;
+    string->interned = false;
+    string->ownsChars = true;
+    string->owner = NULL;
     return string;
 }
 
-ObjString* takeString(char* chars, int length) {
+ObjString* copyStringUninterned(Heap* heap, const char* chars, int length) {
+    char* heapChars = (char*)reallocate(NULL, 0, length + 1, MEMORY_STRING_CHARS);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    COUNT_BY(stringBytesCopied, length);
+    return takeStringUninterned(heap, heapChars, length);
+}
+
+ObjString* takeString(Heap* heap, char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(&heap->strings, chars, length, hash);
     if (interned != NULL) {
         free(chars);
         return interned;
     }
-    return allocateString(chars, length, hash);
+    trackMemory(MEMORY_STRING_CHARS, 0, length + 1);
+    return allocateString(heap, chars, length, hash);
 }
 
-ObjString* copyString(const char* chars, int length) {
+ObjString* copyString(Heap* heap, const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(&heap->strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char* heapChars = (char*)malloc(length + 1);
+    char* heapChars = (char*)reallocate(NULL, 0, length + 1, MEMORY_STRING_CHARS);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    COUNT_BY(stringBytesCopied, length);
+    return allocateString(heap, heapChars, length, hash);
 }
 
-void printObject(Value value) {
+ObjWorker* newWorker(Heap* heap, Worker* worker) {
+    ObjWorker* object = ALLOCATE_OBJ(heap, ObjWorker, OBJ_WORKER);
+    object->worker = worker;
+    object->result = NIL_VAL;
+    return object;
+}
+
+// Arrays and maps nested deeper than this, which includes any that
+// contains itself, print as [...] or {...}.
+#define PRINT_DEPTH_MAX 8
+
+static void printArray(Output* output, ObjArray* array, int depth);
+static void printMap(Output* output, ObjMap* map, int depth);
+
+static void printElement(Output* output, Value value, int depth) {
+    if (IS_ARRAY(value)) {
+        printArray(output, AS_ARRAY(value), depth + 1);
+    } else if (IS_MAP(value)) {
+        printMap(output, AS_MAP(value), depth + 1);
+    } else {
+        printValue(output, value);
+    }
+}
+
+static void printArray(Output* output, ObjArray* array, int depth) {
+    if (depth >= PRINT_DEPTH_MAX) {
+        writeOutput(output, "[...]", 5);
+        return;
+    }
+    writeOutput(output, "[", 1);
+    for (int i = 0; i < array->count; i++) {
+        if (i > 0) writeOutput(output, ", ", 2);
+        if (array->packed) {
+            printValue(output, DOUBLE_VAL(array->numbers[i]));
+        } else {
+            printElement(output, array->values[i], depth);
+        }
+    }
+    writeOutput(output, "]", 1);
+}
+
+static void printMap(Output* output, ObjMap* map, int depth) {
+    if (depth >= PRINT_DEPTH_MAX) {
+        writeOutput(output, "{...}", 5);
+        return;
+    }
+    writeOutput(output, "{", 1);
+    bool first = true;
+    for (int i = 0; i < map->table.capacity; i++) {
+        Entry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+        if (!first) writeOutput(output, ", ", 2);
+        first = false;
+        printValue(output, entry->key);
+        writeOutput(output, ": ", 2);
+        printElement(output, entry->value, depth);
+    }
+    writeOutput(output, "}", 1);
+}
+
+void printObject(Output* output, Value value) {
     switch (OBJ_TYPE(value)) {
+        case OBJ_ARRAY:
+            printArray(output, AS_ARRAY(value), 0);
+            break;
+        case OBJ_CHANNEL:
+            writeOutput(output, "<channel>", 9);
+            break;
+        case OBJ_FIBER:
+            writeOutput(output, "<fiber>", 7);
+            break;
+        case OBJ_FILE:
+            writeOutput(output, "<file>", 6);
+            break;
+        case OBJ_FUNCTION: {
+            ObjString* name = AS_FUNCTION(value)->name;
+            if (name == NULL) {
+                writeOutput(output, "<block>", 7);
+            } else {
+                writeOutputFormat(output, "<fn %.*s>", name->length, name->chars);
+            }
+            break;
+        }
+        case OBJ_MAP:
+            printMap(output, AS_MAP(value), 0);
+            break;
+        case OBJ_MODULE: {
+            ObjString* name = AS_MODULE(value)->name;
+            writeOutputFormat(output, "<module %.*s>", name->length, name->chars);
+            break;
+        }
+        case OBJ_NATIVE:
+            writeOutput(output, "<native fn>", 11);
+            break;
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            writeOutput(output, AS_CSTRING(value), AS_STRING(value)->length);
+            break;
+        case OBJ_WORKER:
+            writeOutput(output, "<worker>", 8);
             break;
     }
 }
\ No newline at end of file
@@ -1,37 +1,208 @@
 #ifndef APOLO_OBJECT_H
 #define APOLO_OBJECT_H
 
+#include "chunk.h"
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
+typedef struct VM VM;
+typedef struct Channel Channel;
+typedef struct Worker Worker;
+
 typedef enum {
+    OBJ_ARRAY,
+    OBJ_CHANNEL,
+    OBJ_FIBER,
+    OBJ_FILE,
+    OBJ_FUNCTION,
+    OBJ_MAP,
+    OBJ_MODULE,
+    OBJ_NATIVE,
     OBJ_STRING,
+    OBJ_WORKER,
 } ObjType;
 
 struct Obj {
     ObjType type;
+    bool isMarked;
     struct Obj* next;
 };
 
+// Interned strings with equal contents are the same object. Strings that
+// skip interning (input lines, slices) are compared by contents and get
+// their hash the first time a table needs it. Slices point into the characters of their
+// owner, a file or another string, and are not NUL-terminated.
 struct ObjString {
     Obj obj;
     int length;
     char* chars;
     uint32_t hash;
+    bool interned;
+    bool ownsChars;
+    Obj* owner;
 };
 
-ObjString* copyString(const char* chars, int length);
-ObjString* takeString(char* chars, int length);
-void printObject(Value value);
+// A growable list of values. While every element is a number the array is
+// packed: numbers holds them as plain doubles, half the size of Values and
+// laid out for the bulk natives to vectorize over. The first store of
+// anything else moves them into values for good. Only one of the two is
+// allocated at a time.
+typedef struct {
+    Obj obj;
+    bool packed;
+    int count;
+    int capacity;
+    double* numbers;
+    Value* values;
+} ObjArray;
+
+typedef struct {
+    Obj obj;
+    FileView view;
+    size_t position;
+} ObjFile;
+
+// A compiled block of code. The body of a spawn or fiber is one, taking
+// the captured variables as its parameters, and so is every function,
+// which also has a name. module is the number of the module it was
+// compiled in, or 0 for a script, so the VM knows whose globals it uses.
+typedef struct {
+    Obj obj;
+    int arity;
+    int module;
+    ObjString* name;
+    Chunk chunk;
+} ObjFunction;
+
+// A table from keys to values for scripts. count is the number of keys,
+// where the table's own count includes tombstones.
+typedef struct {
+    Obj obj;
+    int count;
+    Table table;
+} ObjMap;
+
+// An imported module as one VM sees it: the globals its code defines,
+// which start out as the natives. name is the path it was first imported
+// by.
+typedef struct {
+    Obj obj;
+    ObjString* name;
+    Table globals;
+} ObjModule;
+
+typedef enum {
+    FIBER_SUSPENDED,
+    FIBER_RUNNING,
+    FIBER_DONE,
+} FiberState;
+
+// A coroutine inside one VM, with its own value stack and instruction
+// pointer. The stack starts out just big enough for the fiber's body and
+// grows when it calls functions. While it runs, the VM works directly on
+// these, and the ip, slots, stackTop and globals saved here are stale;
+// caller is the fiber that resumed it, or NULL for the script itself.
+// slots is where the locals of the code it was running start: the fiber's
+// own, or a function's it called. function is the block it runs.
+typedef struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    bool started;
+    ObjFunction* function;
+    Chunk* chunk;
+    Byte* ip;
+    Value* slots;
+    Value* stackTop;
+    Table* globals;
+    struct ObjFiber* caller;
+    Value* stack;
+    int capacity;
+} ObjFiber;
+
+// This VM's handle on a channel, which may be shared with other VMs.
+typedef struct {
+    Obj obj;
+    Channel* channel;
+} ObjChannel;
+
+// Handle on a spawned block. Once joined, worker is NULL and result holds
+// the block's return value, copied into this VM's heap.
+typedef struct {
+    Obj obj;
+    Worker* worker;
+    Value result;
+} ObjWorker;
+
+// The objects allocated by one VM, or by the compiler for one program, and
+// the strings interned among them.
+typedef struct {
+    Obj* objects;
+    Table strings;
+    size_t bytesAllocated;
+} Heap;
+
+// Natives read their arguments from args and store their return value in
+// result. They return false after reporting a runtime error.
+typedef bool (*NativeFn)(VM* vm, int argCount, Value* args, Value* result);
+
+typedef struct {
+    Obj obj;
+    NativeFn function;
+    int arity;
+} ObjNative;
+
+ObjArray* newArray(Heap* heap);
+ObjChannel* newChannelObject(Heap* heap, Channel* channel);
+ObjFiber* newFiber(Heap* heap, ObjFunction* function);
+ObjFile* newFile(Heap* heap, FileView view);
+ObjFunction* newFunction(Heap* heap);
+ObjMap* newMap(Heap* heap);
+ObjModule* newModule(Heap* heap, ObjString* name);
+ObjNative* newNative(Heap* heap, NativeFn function, int arity);
+ObjString* newSlice(Heap* heap, Obj* owner, const char* chars, int length);
+ObjString* copyStringUninterned(Heap* heap, const char* chars, int length);
+// Takes length + 1 characters, terminator included, allocated with
+// reallocate() as MEMORY_STRING_CHARS.
+ObjString* takeStringUninterned(Heap* heap, char* chars, int length);
+ObjString* copyString(Heap* heap, const char* chars, int length);
+ObjString* takeString(Heap* heap, char* chars, int length);
+uint32_t hashUninterned(ObjString* string);
+ObjWorker* newWorker(Heap* heap, Worker* worker);
+void printObject(Output* output, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline uint32_t stringHash(ObjString* string) {
+    if (string->interned || string->hash != 0) return string->hash;
+    return hashUninterned(string);
+}
+
 #define OBJ_TYPE(value)        (AS_OBJ(value)->type)
 
+#define IS_ARRAY(value)        isObjType(value, OBJ_ARRAY)
+#define IS_CHANNEL(value)      isObjType(value, OBJ_CHANNEL)
+#define IS_FIBER(value)        isObjType(value, OBJ_FIBER)
+#define IS_FILE(value)         isObjType(value, OBJ_FILE)
+#define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
+#define IS_MAP(value)          isObjType(value, OBJ_MAP)
+#define IS_MODULE(value)       isObjType(value, OBJ_MODULE)
+#define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
+#define IS_WORKER(value)       isObjType(value, OBJ_WORKER)
+
+#define AS_ARRAY(value)        ((ObjArray*)AS_OBJ(value))
+#define AS_CHANNEL(value)      ((ObjChannel*)AS_OBJ(value))
+#define AS_FIBER(value)        ((ObjFiber*)AS_OBJ(value))
+#define AS_FILE(value)         ((ObjFile*)AS_OBJ(value))
+#define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
+#define AS_MAP(value)          ((ObjMap*)AS_OBJ(value))
+#define AS_MODULE(value)       ((ObjModule*)AS_OBJ(value))
+#define AS_NATIVE(value)       ((ObjNative*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+#define AS_WORKER(value)       ((ObjWorker*)AS_OBJ(value))
 
 #endif
\ No newline at end of file
@@ -0,0 +1,366 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "io.h"
+#include "profile.h"
+
+static Profiler* volatile runningProfiler = NULL;
+static _Thread_local VM* sampledVM = NULL;
+
+static uint32_t hashFrames(const ProfileFrame* frames, int depth) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        uintptr_t chunk = (uintptr_t)frames[i].chunk;
+        hash = (hash ^ (uint32_t)(chunk >> 4)) * 16777619u;
+        hash = (hash ^ (uint32_t)frames[i].offset) * 16777619u;
+    }
+    return hash;
+}
+
+static bool frameAt(ProfileFrame* frame, Chunk* chunk, Byte* ip, ObjFunction* function) {
+    if (chunk == NULL || ip == NULL) return false;
+    frame->chunk = chunk;
+    frame->function = function;
+    frame->offset = (int)(ip - chunk->code);
+    return frame->offset >= 0 && frame->offset <= chunk->count;
+}
+
+static bool sameFrames(const ProfileFrame* a, const ProfileFrame* b, int depth) {
+    for (int i = 0; i < depth; i++) {
+        if (a[i].chunk != b[i].chunk || a[i].offset != b[i].offset) return false;
+    }
+    return true;
+}
+
+// Runs on whichever thread the timer interrupted. A sample that catches
+// the VM halfway through switching fibers or making a call can have an ip
+// outside its chunk; those are dropped rather than guessed at.
+static void takeSample(int signal) {
+    (void)signal;
+    Profiler* profiler = runningProfiler;
+    VM* vm = sampledVM;
+    if (profiler == NULL) return;
+    if (vm == NULL || vm->chunk == NULL) {
+        __atomic_fetch_add(&profiler->outside, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Walk out from the running code, then put the script first. Calls
+    // made by every fiber share vm->frames, so code running the chunk of
+    // the topmost frame's function returns there, and anything else is a
+    // fiber body or the script, which goes back to its resumer.
+    ProfileFrame frames[PROFILE_MAX_DEPTH];
+    int depth = 0;
+    bool valid = true;
+    Chunk* chunk = vm->chunk;
+    Byte* ip = vm->ip;
+    int call = vm->frameCount - 1;
+    ObjFiber* fiber = vm->fiber;
+    while (depth < PROFILE_MAX_DEPTH) {
+        CallFrame* frame = call >= 0 ? &vm->frames[call] : NULL;
+        if (frame != NULL && chunk == &frame->function->chunk) {
+            valid &= frameAt(&frames[depth++], chunk, ip, frame->function);
+            chunk = frame->chunk;
+            ip = frame->ip;
+            call--;
+            continue;
+        }
+        valid &= frameAt(&frames[depth++], chunk, ip, fiber != NULL ? fiber->function : NULL);
+        if (fiber == NULL) break;
+        if (fiber->caller != NULL) {
+            chunk = fiber->caller->chunk;
+            ip = fiber->caller->ip;
+        } else {
+            chunk = vm->rootChunk;
+            ip = vm->rootIp;
+        }
+        fiber = fiber->caller;
+    }
+    if (!valid) {
+        profiler->dropped++;
+        return;
+    }
+    for (int i = 0; i < depth / 2; i++) {
+        ProfileFrame frame = frames[i];
+        frames[i] = frames[depth - 1 - i];
+        frames[depth - 1 - i] = frame;
+    }
+
+    uint32_t hash = hashFrames(frames, depth);
+    uint32_t index = hash & (PROFILE_SLOTS - 1);
+    for (int probes = 0; probes < PROFILE_SLOTS; probes++) {
+        ProfileStack* stack = &profiler->stacks[index];
+        if (stack->count == 0) {
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->frames, frames, sizeof(ProfileFrame) * depth);
+        }
+        if (stack->hash == hash && stack->depth == depth && sameFrames(stack->frames, frames, depth)) {
+            stack->count++;
+            profiler->samples++;
+            return;
+        }
+        index = (index + 1) & (PROFILE_SLOTS - 1);
+    }
+    profiler->dropped++;
+}
+
+void initProfiler(Profiler* profiler, int intervalMicros) {
+    profiler->vm = NULL;
+    profiler->intervalMicros = intervalMicros;
+    profiler->stacks = (ProfileStack*)calloc(PROFILE_SLOTS, sizeof(ProfileStack));
+    profiler->samples = 0;
+    profiler->outside = 0;
+    profiler->dropped = 0;
+}
+
+void freeProfiler(Profiler* profiler) {
+    free(profiler->stacks);
+    profiler->stacks = NULL;
+}
+
+bool startProfiler(Profiler* profiler, VM* vm) {
+    if (runningProfiler != NULL) return false;
+    profiler->vm = vm;
+    sampledVM = vm;
+    runningProfiler = profiler;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = profiler->intervalMicros / 1000000;
+    timer.it_interval.tv_usec = profiler->intervalMicros % 1000000;
+    timer.it_value = timer.it_interval;
+    if (sigaction(SIGPROF, &action, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        runningProfiler = NULL;
+        sampledVM = NULL;
+        return false;
+    }
+    return true;
+}
+
+void stopProfiler(Profiler* profiler) {
+    if (runningProfiler != profiler) return;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    runningProfiler = NULL;
+    sampledVM = NULL;
+}
+
+// Each frame is reported at the instruction it was in the middle of:
+// its ip has already moved past the opcode.
+static int frameInstruction(const ProfileFrame* frame) {
+    return instructionStart(frame->chunk, frame->offset > 0 ? frame->offset - 1 : 0);
+}
+
+static int frameLine(const ProfileFrame* frame) {
+    if (frame->chunk->count == 0) return 0;
+    return frame->chunk->lines[frameInstruction(frame)];
+}
+
+// The script is module 0.
+static int frameModule(const ProfileFrame* frame) {
+    return frame->function != NULL ? frame->function->module : 0;
+}
+
+// Modules are named after the path they were first imported by.
+static ObjString* moduleName(Profiler* profiler, int module) {
+    VM* vm = profiler->vm;
+    if (module <= 0 || module >= vm->importedCapacity || vm->imported[module] == NULL) return NULL;
+    return vm->imported[module]->name;
+}
+
+typedef struct {
+    char* text;
+    uint64_t count;
+} FoldedStack;
+
+static int compareFolded(const void* a, const void* b) {
+    return strcmp(((const FoldedStack*)a)->text, ((const FoldedStack*)b)->text);
+}
+
+// One line per stack, frames from the script inwards separated by ';' and
+// the sample count last, as flamegraph.pl and most flame graph viewers
+// read it. Functions are named as they were declared, and fibers after the
+// first line of their block's code. Code from a module starts with the
+// module's name, and its top-level code is module:name.
+void printFoldedStacks(Profiler* profiler, FILE* file) {
+    FoldedStack* folded = (FoldedStack*)malloc(sizeof(FoldedStack) * PROFILE_SLOTS);
+    int count = 0;
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileStack* stack = &profiler->stacks[i];
+        if (stack->count == 0) continue;
+        char text[PROFILE_MAX_DEPTH * 96];
+        size_t length = 0;
+        for (int j = 0; j < stack->depth && length < sizeof(text); j++) {
+            ProfileFrame* frame = &stack->frames[j];
+            ObjFunction* function = frame->function;
+            ObjString* module = moduleName(profiler, frameModule(frame));
+            if (j > 0) text[length++] = ';';
+            if (function == NULL) {
+                length += snprintf(text + length, sizeof(text) - length, "script");
+            } else if (module != NULL && function->chunk.id == 0) {
+                length += snprintf(text + length, sizeof(text) - length, "module:%.*s",
+                                   module->length, module->chars);
+            } else {
+                if (module != NULL) {
+                    length += snprintf(text + length, sizeof(text) - length, "%.*s:",
+                                       module->length, module->chars);
+                }
+                if (length >= sizeof(text)) break;
+                if (function->name != NULL) {
+                    length += snprintf(text + length, sizeof(text) - length, "%.*s()",
+                                       function->name->length, function->name->chars);
+                } else {
+                    length += snprintf(text + length, sizeof(text) - length, "fiber@%d",
+                                       frame->chunk->lines[0]);
+                }
+            }
+            if (length >= sizeof(text)) break;
+            length += snprintf(text + length, sizeof(text) - length, ":%d", frameLine(frame));
+        }
+        if (length >= sizeof(text)) length = sizeof(text) - 1;
+        text[length] = '\0';
+        folded[count].text = strdup(text);
+        folded[count].count = stack->count;
+        count++;
+    }
+    qsort(folded, count, sizeof(FoldedStack), compareFolded);
+
+    for (int i = 0; i < count;) {
+        uint64_t samples = 0;
+        int j = i;
+        for (; j < count && strcmp(folded[j].text, folded[i].text) == 0; j++) samples += folded[j].count;
+        fprintf(file, "%s %llu\n", folded[i].text, (unsigned long long)samples);
+        for (; i < j; i++) free(folded[i].text);
+    }
+    free(folded);
+}
+
+static uint64_t* sortCounts;
+
+static int compareCounts(const void* a, const void* b) {
+    uint64_t countA = sortCounts[*(const int*)a];
+    uint64_t countB = sortCounts[*(const int*)b];
+    if (countA != countB) return countA < countB ? 1 : -1;
+    return *(const int*)a - *(const int*)b;
+}
+
+static void printCount(FILE* file, uint64_t count, uint64_t total) {
+    if (count == 0) {
+        fprintf(file, "%16s", "");
+    } else {
+        fprintf(file, "%8llu %6.2f%%", (unsigned long long)count, 100.0 * count / total);
+    }
+}
+
+static int countLines(const char* source) {
+    int lineCount = 0;
+    for (const char* c = source; *c != '\0'; c++) {
+        if (*c == '\n' || c[1] == '\0') lineCount++;
+    }
+    return lineCount;
+}
+
+// Self samples are those taken while a line's instruction was running;
+// total also counts the samples where the line was waiting on a function
+// it called or a fiber it resumed. Only frames running code from module,
+// 0 for the script, count towards the lines of source.
+static void printListing(Profiler* profiler, int module, const char* source, const char* name,
+                         uint64_t samples, FILE* file) {
+    int lineCount = countLines(source);
+    uint64_t* self = (uint64_t*)calloc(lineCount + 1, sizeof(uint64_t));
+    uint64_t* total = (uint64_t*)calloc(lineCount + 1, sizeof(uint64_t));
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileStack* stack = &profiler->stacks[i];
+        if (stack->count == 0) continue;
+        int lines[PROFILE_MAX_DEPTH];
+        for (int j = 0; j < stack->depth; j++) {
+            ProfileFrame* frame = &stack->frames[j];
+            lines[j] = frameModule(frame) == module ? frameLine(frame) : 0;
+            bool seen = false;
+            for (int k = 0; k < j; k++) seen |= lines[k] == lines[j];
+            if (!seen && lines[j] >= 1 && lines[j] <= lineCount) total[lines[j]] += stack->count;
+        }
+        int line = lines[stack->depth - 1];
+        if (line >= 1 && line <= lineCount) self[line] += stack->count;
+    }
+
+    if (name == NULL) {
+        fprintf(file, "\n%16s %16s\n", "self", "total");
+    } else {
+        fprintf(file, "\n%16s %16s   %s\n", "self", "total", name);
+    }
+    const char* start = source;
+    for (int line = 1; line <= lineCount; line++) {
+        const char* end = strchr(start, '\n');
+        if (end == NULL) end = start + strlen(start);
+        int length = (int)(end - start);
+        if (length > 0 && start[length - 1] == '\r') length--;
+        printCount(file, self[line], samples);
+        fprintf(file, " ");
+        printCount(file, total[line], samples);
+        fprintf(file, " %5d | %.*s\n", line, length, start);
+        start = *end == '\0' ? end : end + 1;
+    }
+    free(self);
+    free(total);
+}
+
+static bool sampledModule(Profiler* profiler, int module) {
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileStack* stack = &profiler->stacks[i];
+        if (stack->count == 0) continue;
+        for (int j = 0; j < stack->depth; j++) {
+            if (frameModule(&stack->frames[j]) == module) return true;
+        }
+    }
+    return false;
+}
+
+void printProfile(Profiler* profiler, const char* source, FILE* file) {
+    uint64_t opcodes[OP_COUNT] = {0};
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileStack* stack = &profiler->stacks[i];
+        if (stack->count == 0) continue;
+        ProfileFrame* leaf = &stack->frames[stack->depth - 1];
+        if (leaf->chunk->count > 0) opcodes[leaf->chunk->code[frameInstruction(leaf)]] += stack->count;
+    }
+
+    uint64_t samples = profiler->samples;
+    fprintf(file, "%llu samples every %dus, %llu outside the VM, %llu dropped\n",
+            (unsigned long long)samples, profiler->intervalMicros,
+            (unsigned long long)profiler->outside, (unsigned long long)profiler->dropped);
+    if (samples == 0) samples = 1;
+
+    int order[OP_COUNT];
+    for (int i = 0; i < OP_COUNT; i++) order[i] = i;
+    sortCounts = opcodes;
+    qsort(order, OP_COUNT, sizeof(int), compareCounts);
+    int width = opcodeNameWidth();
+    for (int i = 0; i < OP_COUNT && opcodes[order[i]] > 0; i++) {
+        fprintf(file, "  %-*s ", width, opcodeNames[order[i]]);
+        printCount(file, opcodes[order[i]], samples);
+        fprintf(file, "\n");
+    }
+
+    printListing(profiler, 0, source, NULL, samples, file);
+    for (int module = 1; module < profiler->vm->importedCapacity; module++) {
+        ObjString* name = moduleName(profiler, module);
+        if (name == NULL || !sampledModule(profiler, module)) continue;
+        FileView view;
+        if (!openFileView(name->chars, &view)) {
+            fprintf(file, "\nCould not open module \"%s\".\n", name->chars);
+            continue;
+        }
+        printListing(profiler, module, view.chars, name->chars, samples, file);
+        closeFileView(&view);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef APOLO_PROFILE_H
+#define APOLO_PROFILE_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_SLOTS 4096
+
+// Where a sampled context was: the chunk it ran and how far its ip had
+// got into the code. function is the function or fiber block the chunk
+// belongs to, or NULL for the script.
+typedef struct {
+    Chunk* chunk;
+    ObjFunction* function;
+    int offset;
+} ProfileFrame;
+
+// One distinct stack and how many samples landed on it. frames[0] is the
+// script and the last frame is the code that was running, with a frame
+// for every function call and fiber resume in between; stacks deeper
+// than PROFILE_MAX_DEPTH lose their outermost frames.
+typedef struct {
+    uint64_t count;
+    uint32_t hash;
+    int depth;
+    ProfileFrame frames[PROFILE_MAX_DEPTH];
+} ProfileStack;
+
+// Statistical profiler for one VM. While it runs, SIGPROF fires every
+// interval of CPU time and the handler records the VM's stack in a fixed
+// table, without allocating; stacks are only turned into source lines and
+// opcodes when the report is printed. Samples taken while the VM is not
+// executing bytecode, or on other threads such as spawned workers, are
+// counted as outside.
+typedef struct {
+    VM* vm;
+    int intervalMicros;
+    ProfileStack* stacks;
+    uint64_t samples;
+    uint64_t outside;
+    uint64_t dropped;
+} Profiler;
+
+void initProfiler(Profiler* profiler, int intervalMicros);
+void freeProfiler(Profiler* profiler);
+// Only one profiler can run at a time, on the thread that runs vm.
+// Returns false if another one is running or the timer can't be set.
+bool startProfiler(Profiler* profiler, VM* vm);
+void stopProfiler(Profiler* profiler);
+// Both reports read the chunks the samples point into, so they must be
+// printed before the VM frees its programs. printProfile() lists source,
+// the script's, and then every module samples landed in, read again from
+// the path it was imported by.
+void printFoldedStacks(Profiler* profiler, FILE* file);
+void printProfile(Profiler* profiler, const char* source, FILE* file);
+
+#endif
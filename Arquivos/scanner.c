@@ -3,149 +3,298 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
+#if defined(__AVX2__) && !defined(APOLO_NO_SIMD)
+#include <immintrin.h>
+#define SIMD_WIDTH 32
+#define SIMD_FULL 0xffffffffu
+typedef __m256i Block;
+#define loadBlock(p)       _mm256_load_si256((const __m256i*)(p))
+#define splat(c)           _mm256_set1_epi8((char)(c))
+#define maskOf(v)          ((uint32_t)_mm256_movemask_epi8(v))
+#define eqBytes(b, c)      _mm256_cmpeq_epi8(b, splat(c))
+#define ltBytes(a, b)      _mm256_cmpgt_epi8(b, a)
+#define orBytes(a, b)      _mm256_or_si256(a, b)
+#define addBytes(a, b)     _mm256_add_epi8(a, b)
+#elif defined(__SSE2__) && !defined(APOLO_NO_SIMD)
+#include <emmintrin.h>
+#define SIMD_WIDTH 16
+#define SIMD_FULL 0xffffu
+typedef __m128i Block;
+#define loadBlock(p)       _mm_load_si128((const __m128i*)(p))
+#define splat(c)           _mm_set1_epi8((char)(c))
+#define maskOf(v)          ((uint32_t)_mm_movemask_epi8(v))
+#define eqBytes(b, c)      _mm_cmpeq_epi8(b, splat(c))
+#define ltBytes(a, b)      _mm_cmplt_epi8(a, b)
+#define orBytes(a, b)      _mm_or_si128(a, b)
+#define addBytes(a, b)     _mm_add_epi8(a, b)
+#endif
 
-Scanner scanner;
-
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+void initScanner(Scanner* scanner, const char* source) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;
 }
 
 static bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
 static bool isDigit(char c) { return c >= '0' && c <= '9'; }
-static bool isAtEnd() { return *scanner.current == '\0'; }
+static bool isAtEnd(Scanner* scanner) { return *scanner->current == '\0'; }
+
+#ifdef SIMD_WIDTH
+// The source is NUL-terminated, so the kernels below only ever load aligned
+// blocks: an aligned load never crosses a page boundary, which makes reading
+// a few bytes past the terminator safe. Bits for bytes before the starting
+// pointer are masked off in the first block.
+#define BLOCK_START(p, block, live) \
+    const char* block = (const char*)((uintptr_t)(p) & ~(uintptr_t)(SIMD_WIDTH - 1)); \
+    uint32_t live = SIMD_FULL & (SIMD_FULL << ((uintptr_t)(p) & (SIMD_WIDTH - 1)))
+
+// Bytes in [lo, hi], using a biased signed compare since SSE2 has no unsigned one.
+static inline Block inRange(Block b, char lo, char hi) {
+    return ltBytes(addBytes(b, splat(128 - lo)), splat(-128 + (hi - lo + 1)));
+}
+
+// Returns the first byte that is not ' ', '\t', '\r' or '\n' and counts the
+// newlines skipped on the way.
+static const char* skipBlanks(const char* p, int* lines) {
+    // Most tokens are separated by a single space; don't pay for a block load.
+    if (*p == ' ') p++;
+    if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return p;
+    BLOCK_START(p, block, live);
+    for (;;) {
+        Block b = loadBlock(block);
+        uint32_t newlines = maskOf(eqBytes(b, '\n'));
+        uint32_t blanks = newlines | maskOf(orBytes(orBytes(eqBytes(b, ' '), eqBytes(b, '\t')), eqBytes(b, '\r')));
+        uint32_t stop = ~blanks & live;
+        if (stop != 0) {
+            int index = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & live & ((1u << index) - 1));
+            return block + index;
+        }
+        *lines += __builtin_popcount(newlines & live);
+        block += SIMD_WIDTH;
+        live = SIMD_FULL;
+    }
+}
+
+// Returns the first '\n' (or the terminator) after a '#' comment.
+static const char* skipComment(const char* p) {
+    BLOCK_START(p, block, live);
+    for (;;) {
+        Block b = loadBlock(block);
+        uint32_t stop = maskOf(orBytes(eqBytes(b, '\n'), eqBytes(b, '\0'))) & live;
+        if (stop != 0) return block + __builtin_ctz(stop);
+        block += SIMD_WIDTH;
+        live = SIMD_FULL;
+    }
+}
+
+// Returns the first byte that cannot continue an identifier.
+static const char* skipIdentifier(const char* p) {
+    // Keywords and short names end within a few bytes.
+    for (int i = 0; i < 4; i++, p++) {
+        if (!isAlpha(*p) && !isDigit(*p)) return p;
+    }
+    BLOCK_START(p, block, live);
+    for (;;) {
+        Block b = loadBlock(block);
+        Block word = orBytes(orBytes(inRange(orBytes(b, splat(0x20)), 'a', 'z'),
+                                     inRange(b, '0', '9')),
+                             eqBytes(b, '_'));
+        uint32_t stop = ~maskOf(word) & live;
+        if (stop != 0) return block + __builtin_ctz(stop);
+        block += SIMD_WIDTH;
+        live = SIMD_FULL;
+    }
+}
+
+// Returns the closing '"' (or the terminator) and counts embedded newlines.
+static const char* findStringEnd(const char* p, int* lines) {
+    BLOCK_START(p, block, live);
+    for (;;) {
+        Block b = loadBlock(block);
+        uint32_t newlines = maskOf(eqBytes(b, '\n'));
+        uint32_t stop = maskOf(orBytes(eqBytes(b, '"'), eqBytes(b, '\0'))) & live;
+        if (stop != 0) {
+            int index = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & live & ((1u << index) - 1));
+            return block + index;
+        }
+        *lines += __builtin_popcount(newlines & live);
+        block += SIMD_WIDTH;
+        live = SIMD_FULL;
+    }
+}
+#else
+static const char* skipBlanks(const char* p, int* lines) {
+    for (;;) {
+        switch (*p) {
+            case '\n': (*lines)++; // Fallthrough.
+            case ' ': case '\r': case '\t': p++; break;
+            default: return p;
+        }
+    }
+}
 
-static char advance() { scanner.current++; return scanner.current[-1]; }
-static char peek() { return *scanner.current; }
-static char peekNext() { if (isAtEnd()) return '\0'; return scanner.current[1]; }
+static const char* skipComment(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* skipIdentifier(const char* p) {
+    while (isAlpha(*p) || isDigit(*p)) p++;
+    return p;
+}
 
-static bool match(char expected) {
-    if (isAtEnd()) return false;
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static const char* findStringEnd(const char* p, int* lines) {
+    while (*p != '"' && *p != '\0') {
+        if (*p == '\n') (*lines)++;
+        p++;
+    }
+    return p;
+}
+#endif
+
+static char advance(Scanner* scanner) { scanner->current++; return scanner->current[-1]; }
+static char peek(Scanner* scanner) { return *scanner->current; }
+static char peekNext(Scanner* scanner) { if (isAtEnd(scanner)) return '\0'; return scanner->current[1]; }
+
+static bool match(Scanner* scanner, char expected) {
+    if (isAtEnd(scanner)) return false;
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
-        switch (c) {
-            case ' ': case '\r': case '\t': advance(); break;
-            case '\n': scanner.line++; advance(); break;
-            case '#': while (peek() != '\n' && !isAtEnd()) advance(); break;
-            default: return;
-        }
+        scanner->current = skipBlanks(scanner->current, &scanner->line);
+        if (peek(scanner) != '#') return;
+        scanner->current = skipComment(scanner->current);
     }
 }
 
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
+static TokenType checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+static TokenType identifierType(Scanner* scanner) {
+    switch (scanner->start[0]) {
+        case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+        case 'd': return checkKeyword(scanner, 1, 5, "elete", TOKEN_DELETE);
+        case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+                    case 'i': return checkKeyword(scanner, 2, 3, "ber", TOKEN_FIBER);
+                    case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+                    case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
+                }
+            }
+            break;
+        case 'i':
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'f': return checkKeyword(scanner, 2, 0, "", TOKEN_IF);
+                    case 'm': return checkKeyword(scanner, 2, 4, "port", TOKEN_IMPORT);
+                    case 'n':
+                        if (scanner->current - scanner->start == 2) return TOKEN_IN;
+                        return checkKeyword(scanner, 2, 3, "put", TOKEN_INPUT);
                 }
             }
             break;
-        case 'i': 
-            if (scanner.current - scanner.start > 1 && scanner.start[1] == 'f') return TOKEN_IF;
-            return checkKeyword(1, 4, "nput", TOKEN_INPUT);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 't': return checkKeyword(1, 3, "rue", TOKEN_TRUE);
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+        case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+        case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+        case 'r':
+            if (scanner->current - scanner->start > 2 && scanner->start[1] == 'e') {
+                switch (scanner->start[2]) {
+                    case 's': return checkKeyword(scanner, 3, 3, "ume", TOKEN_RESUME);
+                    case 't': return checkKeyword(scanner, 3, 3, "urn", TOKEN_RETURN);
+                }
+            }
+            break;
+        case 's': return checkKeyword(scanner, 1, 4, "pawn", TOKEN_SPAWN);
+        case 't': return checkKeyword(scanner, 1, 3, "rue", TOKEN_TRUE);
+        case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+        case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+        case 'y': return checkKeyword(scanner, 1, 4, "ield", TOKEN_YIELD);
     }
     return TOKEN_IDENTIFIER;
 }
 
-static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identifierType());
+static Token identifier(Scanner* scanner) {
+    scanner->current = skipIdentifier(scanner->current);
+    return makeToken(scanner, identifierType(scanner));
 }
 
-static Token number() {
-    while (isDigit(peek())) advance();
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();
-        while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+    while (isDigit(peek(scanner))) advance(scanner);
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
+        advance(scanner);
+        while (isDigit(peek(scanner))) advance(scanner);
     }
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
-    if (isAtEnd()) return errorToken("Unterminated string.");
-    advance();
-    return makeToken(TOKEN_STRING);
+static Token string(Scanner* scanner) {
+    scanner->current = findStringEnd(scanner->current, &scanner->line);
+    if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
-Token scanToken() {
-    skipWhitespace();
-    scanner.start = scanner.current;
-    if (isAtEnd()) return makeToken(TOKEN_EOF);
+Token scanToken(Scanner* scanner) {
+    skipWhitespace(scanner);
+    scanner->start = scanner->current;
+    if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
-    if (isAlpha(c)) return identifier();
-    if (isDigit(c)) return number();
+    char c = advance(scanner);
+    if (isAlpha(c)) return identifier(scanner);
+    if (isDigit(c)) return number(scanner);
 
     switch (c) {
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '*': return makeToken(TOKEN_STAR);
-        case '!': return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
-        case '=': return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
-        case '<': return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
-        case '>': return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-        case '"': return string();
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case '[': return makeToken(scanner, TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(scanner, TOKEN_RIGHT_BRACKET);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case ':': return makeToken(scanner, TOKEN_COLON);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '*': return makeToken(scanner, TOKEN_STAR);
+        case '!': return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        case '=': return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        case '<': return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        case '>': return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        case '"': return string(scanner);
     }
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
@@ -4,7 +4,8 @@
 typedef enum {
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
-    TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
+    TOKEN_COLON, TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
     
     TOKEN_BANG, TOKEN_BANG_EQUAL,
@@ -14,9 +15,10 @@ typedef enum {
 
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
 
-    TOKEN_AND, TOKEN_ELSE, TOKEN_FALSE,
-    TOKEN_FOR, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-    TOKEN_PRINT, TOKEN_INPUT, TOKEN_RETURN,
+    TOKEN_AND, TOKEN_DELETE, TOKEN_ELSE, TOKEN_FALSE,
+    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_IMPORT, TOKEN_IN, TOKEN_NIL, TOKEN_OR,
+    TOKEN_PRINT, TOKEN_INPUT, TOKEN_RETURN, TOKEN_SPAWN,
+    TOKEN_FIBER, TOKEN_RESUME, TOKEN_YIELD,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
     TOKEN_ERROR, TOKEN_EOF
@@ -29,7 +31,13 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+typedef struct {
+    const char* start;
+    const char* current;
+    int line;
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source);
+Token scanToken(Scanner* scanner);
 
 #endif
\ No newline at end of file
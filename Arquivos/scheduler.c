@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#include "scheduler.h"
+
+void initScheduler(Scheduler* scheduler, int64_t slice) {
+    scheduler->slice = slice;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+    scheduler->tasks = NULL;
+    scheduler->running = 0;
+}
+
+void freeScheduler(Scheduler* scheduler) {
+    free(scheduler->tasks);
+    initScheduler(scheduler, scheduler->slice);
+}
+
+int scheduleTask(Scheduler* scheduler, VM* vm, Program* program, int64_t maxFuel) {
+    if (scheduler->capacity < scheduler->count + 1) {
+        scheduler->capacity = scheduler->capacity < 8 ? 8 : scheduler->capacity * 2;
+        scheduler->tasks = (Task*)realloc(scheduler->tasks, sizeof(Task) * scheduler->capacity);
+    }
+    Task* task = &scheduler->tasks[scheduler->count];
+    task->vm = vm;
+    task->program = program;
+    task->fuelUsed = 0;
+    task->maxFuel = maxFuel;
+    task->started = false;
+    task->finished = false;
+    task->result = INTERPRET_OK;
+    scheduler->running++;
+    return scheduler->count++;
+}
+
+static void runSlice(Scheduler* scheduler, Task* task) {
+    VM* vm = task->vm;
+    vm->fuel = scheduler->slice;
+    InterpretResult result;
+    if (task->started) {
+        result = resumeVM(vm);
+    } else {
+        task->started = true;
+        result = execute(vm, task->program);
+    }
+    task->fuelUsed += scheduler->slice - vm->fuel;
+    vm->fuel = FUEL_UNLIMITED;
+
+    if (result == INTERPRET_YIELD) {
+        if (task->maxFuel == 0 || task->fuelUsed <= task->maxFuel) return;
+        result = abortVM(vm, "Script ran out of fuel.");
+    }
+    task->finished = true;
+    task->result = result;
+    scheduler->running--;
+}
+
+int stepScheduler(Scheduler* scheduler) {
+    for (int i = 0; i < scheduler->count; i++) {
+        Task* task = &scheduler->tasks[i];
+        if (!task->finished) runSlice(scheduler, task);
+    }
+    return scheduler->running;
+}
+
+void runScheduler(Scheduler* scheduler) {
+    while (stepScheduler(scheduler) > 0) {}
+}
@@ -0,0 +1,41 @@
+#ifndef APOLO_SCHEDULER_H
+#define APOLO_SCHEDULER_H
+
+#include "vm.h"
+
+// One script running on a VM under a scheduler. fuelUsed counts the fuel
+// it has burnt so far; when maxFuel is not 0 and the task goes past it,
+// it is stopped with a runtime error.
+typedef struct {
+    VM* vm;
+    Program* program;
+    int64_t fuelUsed;
+    int64_t maxFuel;
+    bool started;
+    bool finished;
+    InterpretResult result;
+} Task;
+
+// Round-robin multiplexing of many VMs on the calling thread. Each turn a
+// task gets the same slice of fuel and runs until it spends it or ends, so
+// a task stuck in a loop delays the others by at most one slice per round.
+// Natives that wait (input, receive, send, join) still block the thread.
+typedef struct {
+    int64_t slice;
+    int count;
+    int capacity;
+    Task* tasks;
+    int running;
+} Scheduler;
+
+void initScheduler(Scheduler* scheduler, int64_t slice);
+void freeScheduler(Scheduler* scheduler);
+// Adds a task and returns its index. The VM and program belong to the
+// caller and must stay alive until the task has finished.
+int scheduleTask(Scheduler* scheduler, VM* vm, Program* program, int64_t maxFuel);
+// Gives one slice to each unfinished task, in order. Returns how many are
+// still unfinished afterwards.
+int stepScheduler(Scheduler* scheduler);
+void runScheduler(Scheduler* scheduler);
+
+#endif
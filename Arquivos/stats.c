@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+#ifndef APOLO_NO_STATS
+_Thread_local Stats* activeStats = NULL;
+#endif
+
+void initStats(Stats* stats) {
+    memset(stats, 0, sizeof(Stats));
+}
+
+bool setActiveStats(Stats* stats) {
+#ifndef APOLO_NO_STATS
+    activeStats = stats;
+    return true;
+#else
+    (void)stats;
+    return false;
+#endif
+}
+
+static const Stats* sortStats;
+
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t countA = sortStats->opcodes[*(const int*)a];
+    uint64_t countB = sortStats->opcodes[*(const int*)b];
+    if (countA != countB) return countA < countB ? 1 : -1;
+    return *(const int*)a - *(const int*)b;
+}
+
+static void printJson(Stats* stats, FILE* file) {
+    fprintf(file, "{\"opcodes\":{");
+    bool first = true;
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (stats->opcodes[i] == 0) continue;
+        fprintf(file, "%s\"%s\":%llu", first ? "" : ",", opcodeNames[i],
+                (unsigned long long)stats->opcodes[i]);
+        first = false;
+    }
+    fprintf(file, "},\"typeErrors\":%llu,\"tableLookups\":%llu,\"tableProbes\":%llu,"
+            "\"stringsAllocated\":%llu,\"stringBytesCopied\":%llu,"
+            "\"concatenations\":%llu,\"concatenatedBytes\":%llu}\n",
+            (unsigned long long)stats->typeErrors, (unsigned long long)stats->tableLookups,
+            (unsigned long long)stats->tableProbes, (unsigned long long)stats->stringsAllocated,
+            (unsigned long long)stats->stringBytesCopied, (unsigned long long)stats->concatenations,
+            (unsigned long long)stats->concatenatedBytes);
+}
+
+// The text report lists the opcodes that ran, most frequent first.
+void printStats(Stats* stats, FILE* file, bool json) {
+    if (json) {
+        printJson(stats, file);
+        return;
+    }
+    uint64_t total = 0;
+    int order[OP_COUNT];
+    for (int i = 0; i < OP_COUNT; i++) {
+        total += stats->opcodes[i];
+        order[i] = i;
+    }
+    sortStats = stats;
+    qsort(order, OP_COUNT, sizeof(int), compareOpcodes);
+
+    // Opcode names are indented under the totals, which line up with them.
+    int width = opcodeNameWidth();
+    fprintf(file, "%-*s %14llu\n", width + 2, "instructions", (unsigned long long)total);
+    for (int i = 0; i < OP_COUNT && stats->opcodes[order[i]] > 0; i++) {
+        uint64_t count = stats->opcodes[order[i]];
+        fprintf(file, "  %-*s %14llu %6.2f%%\n", width, opcodeNames[order[i]],
+                (unsigned long long)count, 100.0 * count / total);
+    }
+    fprintf(file, "%-*s %14llu\n", width + 2, "type errors", (unsigned long long)stats->typeErrors);
+    fprintf(file, "%-*s %14llu\n", width + 2, "table lookups", (unsigned long long)stats->tableLookups);
+    fprintf(file, "%-*s %14llu", width + 2, "table probes", (unsigned long long)stats->tableProbes);
+    if (stats->tableLookups > 0) {
+        fprintf(file, " (%.2f per lookup)", (double)stats->tableProbes / stats->tableLookups);
+    }
+    fprintf(file, "\n%-*s %14llu\n", width + 2, "strings allocated",
+            (unsigned long long)stats->stringsAllocated);
+    fprintf(file, "%-*s %14llu\n", width + 2, "string bytes copied",
+            (unsigned long long)stats->stringBytesCopied);
+    fprintf(file, "%-*s %14llu\n", width + 2, "concatenations", (unsigned long long)stats->concatenations);
+    fprintf(file, "%-*s %14llu\n", width + 2, "concatenated bytes",
+            (unsigned long long)stats->concatenatedBytes);
+}
@@ -0,0 +1,41 @@
+#ifndef APOLO_STATS_H
+#define APOLO_STATS_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+
+// Execution counters for one thread. Counting is compiled in unless
+// APOLO_NO_STATS is defined, and only happens while activeStats points at
+// a Stats; compiled out, the COUNT macros expand to nothing.
+typedef struct {
+    uint64_t opcodes[OP_COUNT];
+    uint64_t typeErrors;
+    uint64_t tableLookups;
+    uint64_t tableProbes;
+    uint64_t stringsAllocated;
+    uint64_t stringBytesCopied;
+    uint64_t concatenations;
+    uint64_t concatenatedBytes;
+} Stats;
+
+#ifndef APOLO_NO_STATS
+extern _Thread_local Stats* activeStats;
+
+#define COUNT(field) \
+    do { if (activeStats != NULL) activeStats->field++; } while (false)
+#define COUNT_BY(field, amount) \
+    do { if (activeStats != NULL) activeStats->field += (amount); } while (false)
+#else
+#define COUNT(field) do {} while (false)
+#define COUNT_BY(field, amount) do {} while (false)
+#endif
+
+void initStats(Stats* stats);
+// Sets the counters that this thread updates, or stops counting with NULL.
+// Returns false when counting is compiled out.
+bool setActiveStats(Stats* stats);
+void printStats(Stats* stats, FILE* file, bool json);
+
+#endif
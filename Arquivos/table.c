@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <string.h>
+#include "memory.h"
 #include "object.h"
+#include "stats.h"
 #include "table.h"
 
 #define TABLE_MAX_LOAD 0.75
@@ -12,74 +14,144 @@ void initTable(Table* table) {
 }
 
 void freeTable(Table* table) {
-    free(table->entries);
+    reallocate(table->entries, sizeof(Entry) * table->capacity, 0, MEMORY_TABLES);
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
-    for (;;) {
+// Mixes the bits of a number key so that keys which differ only in their
+// high bits, like multiples of 1024, still spread over the whole table.
+static uint32_t hashBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= UINT64_C(0xff51afd7ed558ccd);
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static inline uint32_t hashKey(Value key) {
+    if (IS_OBJ(key)) return stringHash(AS_STRING(key));
+    switch (key.type) {
+        case VAL_BOOL: return AS_BOOL(key) ? 1 : 2;
+        case VAL_INT: return hashBits((uint64_t)AS_INT(key));
+        default: {
+            uint64_t bits;
+            double number = AS_DOUBLE(key);
+            memcpy(&bits, &number, sizeof(bits));
+            return hashBits(bits);
+        }
+    }
+}
+
+// Strings with the same contents are the same key even when they are
+// different objects: names compiled into different programs, or strings
+// that skipped interning.
+static inline bool keysEqual(Value a, Value b, uint32_t hash) {
+    if (a.type != b.type) return false;
+    if (a.type == VAL_OBJ) {
+        ObjString* x = AS_STRING(a);
+        ObjString* y = AS_STRING(b);
+        return x == y || (x->hash == hash && x->length == y->length &&
+                          memcmp(x->chars, y->chars, x->length) == 0);
+    }
+    switch (a.type) {
+        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_INT: return AS_INT(a) == AS_INT(b);
+        default: return AS_DOUBLE(a) == AS_DOUBLE(b);
+    }
+}
+
+// Deleted entries become tombstones (nil key, true value) so probe
+// sequences running through them stay intact.
+static Entry* findEntry(Entry* entries, int capacity, Value key, uint32_t hash) {
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = hash & mask;
+    Entry* tombstone = NULL;
+    COUNT(tableLookups);
+    for (int probes = 1;; probes++) {
         Entry* entry = &entries[index];
-        if (entry->key == NULL || entry->key == key) return entry;
-        index = (index + 1) % capacity;
+        if (IS_NIL(entry->key)) {
+            if (IS_NIL(entry->value)) {
+                COUNT_BY(tableProbes, probes);
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL) tombstone = entry;
+        } else if (keysEqual(entry->key, key, hash)) {
+            COUNT_BY(tableProbes, probes);
+            return entry;
+        }
+        index = (index + 1) & mask;
     }
 }
 
-static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = (Entry*)malloc(sizeof(Entry) * capacity);
+// Moves the table's keys into entries, which have room for capacity.
+static void rehash(Table* table, Entry* entries, int capacity) {
     for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
+        entries[i].key = NIL_VAL;
         entries[i].value = NIL_VAL;
     }
     
     table->count = 0;
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
-        Entry* dest = findEntry(entries, capacity, entry->key);
+        if (IS_NIL(entry->key)) continue;
+        Entry* dest = findEntry(entries, capacity, entry->key, hashKey(entry->key));
         dest->key = entry->key;
         dest->value = entry->value;
         table->count++;
     }
-    free(table->entries);
+    reallocate(table->entries, sizeof(Entry) * table->capacity, 0, MEMORY_TABLES);
     table->entries = entries;
     table->capacity = capacity;
 }
 
-bool tableGet(Table* table, ObjString* key, Value* value) {
+static void adjustCapacity(Table* table, int capacity) {
+    rehash(table, (Entry*)reallocate(NULL, 0, sizeof(Entry) * capacity, MEMORY_TABLES), capacity);
+}
+
+bool tableReserve(Table* table, int count) {
+    if (count <= table->capacity * TABLE_MAX_LOAD) return true;
+    int capacity = table->capacity < 8 ? 8 : table->capacity;
+    while (count > capacity * TABLE_MAX_LOAD) capacity *= 2;
+    if (capacity == table->capacity) return true;
+    Entry* entries = (Entry*)tryReallocate(NULL, 0, sizeof(Entry) * capacity, MEMORY_TABLES);
+    if (entries == NULL) return false;
+    rehash(table, entries, capacity);
+    return true;
+}
+
+bool tableGet(Table* table, Value key, Value* value) {
     if (table->count == 0) return false;
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    Entry* entry = findEntry(table->entries, table->capacity, key, hashKey(key));
+    if (IS_NIL(entry->key)) return false;
     *value = entry->value;
     return true;
 }
 
-bool tableSet(Table* table, ObjString* key, Value value) {
+bool tableSet(Table* table, Value key, Value value) {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
         int capacity = table->capacity < 8 ? 8 : table->capacity * 2;
         adjustCapacity(table, capacity);
     }
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey) table->count++;
+    Entry* entry = findEntry(table->entries, table->capacity, key, hashKey(key));
+    bool isNewKey = IS_NIL(entry->key);
+    if (isNewKey && IS_NIL(entry->value)) table->count++;
     entry->key = key;
     entry->value = value;
     return isNewKey;
 }
 
-bool tableDelete(Table* table, ObjString* key) {
+bool tableDelete(Table* table, Value key) {
     if (table->count == 0) return false;
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-    entry->key = NULL; 
-    entry->value = NIL_VAL;
+    Entry* entry = findEntry(table->entries, table->capacity, key, hashKey(key));
+    if (IS_NIL(entry->key)) return false;
+    entry->key = NIL_VAL;
+    entry->value = BOOL_VAL(true);
     return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
     for (int i = 0; i < from->capacity; i++) {
         Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
+        if (!IS_NIL(entry->key)) {
             tableSet(to, entry->key, entry->value);
         }
     }
@@ -87,15 +159,34 @@ void tableAddAll(Table* from, Table* to) {
 
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
-    uint32_t index = hash % table->capacity;
-    for (;;) {
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t index = hash & mask;
+    COUNT(tableLookups);
+    for (int probes = 1;; probes++) {
         Entry* entry = &table->entries[index];
-        if (entry->key == NULL) return NULL;
-        if (entry->key->length == length &&
-            entry->key->hash == hash &&
-            memcmp(entry->key->chars, chars, length) == 0) {
-            return entry->key;
+        if (IS_NIL(entry->key)) {
+            if (IS_NIL(entry->value)) {
+                COUNT_BY(tableProbes, probes);
+                return NULL;
+            }
+        } else {
+            ObjString* key = AS_STRING(entry->key);
+            if (key->length == length && key->hash == hash &&
+                memcmp(key->chars, chars, length) == 0) {
+                COUNT_BY(tableProbes, probes);
+                return key;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void tableRemoveWhite(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (!IS_NIL(entry->key) && !AS_OBJ(entry->key)->isMarked) {
+            entry->key = NIL_VAL;
+            entry->value = BOOL_VAL(true);
         }
-        index = (index + 1) % table->capacity;
     }
 }
\ No newline at end of file
@@ -4,11 +4,15 @@
 #include "common.h"
 #include "value.h"
 
+// Keys are strings, booleans or numbers. A number key must be a
+// normalized one from numberKey(), so that numbers that are equal, like 3
+// and 3.0, are the same key. An empty entry has a nil key.
 typedef struct {
-    ObjString* key;
+    Value key;
     Value value;
 } Entry;
 
+// count includes tombstones. capacity is 0 or a power of two.
 typedef struct {
     int count;
     int capacity;
@@ -17,10 +21,20 @@ typedef struct {
 
 void initTable(Table* table);
 void freeTable(Table* table);
-bool tableGet(Table* table, ObjString* key, Value* value);
-bool tableSet(Table* table, ObjString* key, Value value);
-bool tableDelete(Table* table, ObjString* key);
+// Makes room for count keys, so adding that many doesn't resize again.
+// False, with the table unchanged, when there is no memory for them.
+bool tableReserve(Table* table, int count);
+bool tableGet(Table* table, Value key, Value* value);
+bool tableSet(Table* table, Value key, Value value);
+bool tableDelete(Table* table, Value key);
 void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+void tableRemoveWhite(Table* table);
+
+// The key a number is stored under: ints for whole numbers in range, and 0
+// for -0. nan is not a valid key.
+static inline Value numberKey(double number) {
+    return numberValue(number == 0 ? 0 : number);
+}
 
 #endif
\ No newline at end of file
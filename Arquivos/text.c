@@ -0,0 +1,141 @@
+#include <string.h>
+
+#include "text.h"
+
+#ifdef X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Candidates come from memchr on the first byte, which the C library
+// already runs with vector instructions.
+static const char* findPlain(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    if (length < needleLength) return NULL;
+    const char* at = haystack;
+    const char* end = haystack + length - needleLength + 1;
+    while (at < end) {
+        at = (const char*)memchr(at, needle[0], end - at);
+        if (at == NULL) return NULL;
+        if (memcmp(at + 1, needle + 1, needleLength - 1) == 0) return at;
+        at++;
+    }
+    return NULL;
+}
+
+#ifdef X86_SIMD
+// Each block compares the needle's first and last bytes against 32
+// candidate starts at once, and only positions where both match go on to
+// a full comparison. Needles are at least two bytes long.
+__attribute__((target("avx2")))
+static const char* findAVX2(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+    size_t i = 0;
+    for (; i + needleLength - 1 + 32 <= length; i += 32) {
+        __m256i starts = _mm256_loadu_si256((const __m256i*)(haystack + i));
+        __m256i ends = _mm256_loadu_si256((const __m256i*)(haystack + i + needleLength - 1));
+        uint32_t candidates = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(starts, first), _mm256_cmpeq_epi8(ends, last)));
+        while (candidates != 0) {
+            int bit = __builtin_ctz(candidates);
+            const char* at = haystack + i + bit;
+            if (memcmp(at + 1, needle + 1, needleLength - 2) == 0) return at;
+            candidates &= candidates - 1;
+        }
+    }
+    return findPlain(haystack + i, length - i, needle, needleLength);
+}
+
+static const char* findSSE2(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    size_t i = 0;
+    for (; i + needleLength - 1 + 16 <= length; i += 16) {
+        __m128i starts = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i ends = _mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1));
+        uint32_t candidates = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last)));
+        while (candidates != 0) {
+            int bit = __builtin_ctz(candidates);
+            const char* at = haystack + i + bit;
+            if (memcmp(at + 1, needle + 1, needleLength - 2) == 0) return at;
+            candidates &= candidates - 1;
+        }
+    }
+    return findPlain(haystack + i, length - i, needle, needleLength);
+}
+#endif
+
+const char* findText(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    if (needleLength == 0) return haystack;
+    if (needleLength == 1) return (const char*)memchr(haystack, needle[0], length);
+#ifdef X86_SIMD
+    if (hasAVX2()) return findAVX2(haystack, length, needle, needleLength);
+    return findSSE2(haystack, length, needle, needleLength);
+#else
+    return findPlain(haystack, length, needle, needleLength);
+#endif
+}
+
+size_t countText(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    size_t count = 0;
+    const char* end = haystack + length;
+    const char* at = haystack;
+    while ((at = findText(at, end - at, needle, needleLength)) != NULL) {
+        count++;
+        at += needleLength;
+    }
+    return count;
+}
+
+// Flipping bit 5 switches the case of an ASCII letter. Bytes from 0x80 up
+// are negative to the signed comparisons, so they are never in range.
+#ifdef X86_SIMD
+__attribute__((target("avx2")))
+static size_t mapCaseAVX2(char* dest, const char* source, size_t length, char low, char high) {
+    const __m256i below = _mm256_set1_epi8(low - 1);
+    const __m256i above = _mm256_set1_epi8(high + 1);
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(source + i));
+        __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, below), _mm256_cmpgt_epi8(above, bytes));
+        bytes = _mm256_xor_si256(bytes, _mm256_and_si256(letters, flip));
+        _mm256_storeu_si256((__m256i*)(dest + i), bytes);
+    }
+    return i;
+}
+
+static size_t mapCaseSSE2(char* dest, const char* source, size_t length, char low, char high) {
+    const __m128i below = _mm_set1_epi8(low - 1);
+    const __m128i above = _mm_set1_epi8(high + 1);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(source + i));
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(bytes, below), _mm_cmpgt_epi8(above, bytes));
+        bytes = _mm_xor_si128(bytes, _mm_and_si128(letters, flip));
+        _mm_storeu_si128((__m128i*)(dest + i), bytes);
+    }
+    return i;
+}
+#endif
+
+static void mapCase(char* dest, const char* source, size_t length, char low, char high) {
+    size_t i = 0;
+#ifdef X86_SIMD
+    if (hasAVX2()) i = mapCaseAVX2(dest, source, length, low, high);
+    else i = mapCaseSSE2(dest, source, length, low, high);
+#endif
+    for (; i < length; i++) {
+        char c = source[i];
+        dest[i] = c >= low && c <= high ? c ^ 0x20 : c;
+    }
+}
+
+void upperText(char* dest, const char* source, size_t length) {
+    mapCase(dest, source, length, 'a', 'z');
+}
+
+void lowerText(char* dest, const char* source, size_t length) {
+    mapCase(dest, source, length, 'A', 'Z');
+}
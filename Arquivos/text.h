@@ -0,0 +1,20 @@
+#ifndef APOLO_TEXT_H
+#define APOLO_TEXT_H
+
+#include "common.h"
+
+// Byte kernels behind the string natives. Searches compare 32 bytes at a
+// time with AVX2 when the processor has it and 16 with SSE2 otherwise;
+// other machines get plain loops. Strings are arrays of bytes here: case
+// mapping only touches ASCII letters.
+
+// The first place needle occurs in haystack, or NULL. An empty needle is
+// found at the start.
+const char* findText(const char* haystack, size_t length, const char* needle, size_t needleLength);
+// How many times needle occurs without overlapping; needleLength > 0.
+size_t countText(const char* haystack, size_t length, const char* needle, size_t needleLength);
+// dest and source may be the same.
+void upperText(char* dest, const char* source, size_t length);
+void lowerText(char* dest, const char* source, size_t length);
+
+#endif
@@ -0,0 +1,394 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "debug.h"
+#include "module.h"
+#include "trace.h"
+
+#define TRACE_VERSION 4
+
+// modulesSize bytes of TraceModule records come between the header and
+// the entries.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint64_t count;
+    uint32_t sourceHash;
+    uint32_t modulesSize;
+} TraceHeader;
+
+// Each is followed by the module's path, padded with NULs to a multiple of
+// 8 bytes so that whatever comes next stays aligned.
+typedef struct {
+    uint32_t module;
+    uint32_t length;
+    uint64_t hash;
+} TraceModule;
+
+#define PADDED_PATH(length) (((length) + 8) & ~7u)
+
+static Trace* signalTrace = NULL;
+
+static uint32_t hashSource(const char* source, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)source[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+void initTrace(Trace* trace, int capacity, const char* path, const char* source) {
+    uint32_t size = 1;
+    while (size < (uint32_t)capacity) size <<= 1;
+    trace->entries = (TraceEntry*)calloc(size, sizeof(TraceEntry));
+    trace->mask = size - 1;
+    trace->count = 0;
+    trace->sourceHash = hashSource(source, strlen(source));
+    trace->modulesSize = 0;
+    trace->modules = NULL;
+    trace->path = path;
+}
+
+void freeTrace(Trace* trace) {
+    if (signalTrace == trace) ignoreTraceSignals();
+    free(trace->entries);
+    trace->entries = NULL;
+    free(trace->modules);
+    trace->modules = NULL;
+    trace->modulesSize = 0;
+}
+
+// The table is rebuilt and swapped in rather than grown in place, so a
+// signal that dumps the trace meanwhile writes the old one or the new one.
+void traceModule(Trace* trace, int module) {
+    uint64_t hash;
+    const char* path = modulePath(module, &hash);
+    if (path == NULL) return;
+    TraceModule record = {(uint32_t)module, (uint32_t)strlen(path), hash};
+    uint32_t size = trace->modulesSize + sizeof(TraceModule) + PADDED_PATH(record.length);
+    char* modules = (char*)calloc(size, 1);
+    if (modules == NULL) return;
+    if (trace->modulesSize > 0) memcpy(modules, trace->modules, trace->modulesSize);
+    memcpy(modules + trace->modulesSize, &record, sizeof(record));
+    memcpy(modules + trace->modulesSize + sizeof(record), path, record.length);
+
+    char* old = trace->modules;
+    trace->modules = modules;
+    trace->modulesSize = size;
+    free(old);
+}
+
+static bool writeAll(int fd, const void* data, size_t length) {
+    const char* bytes = (const char*)data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0) return false;
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool dumpTrace(Trace* trace) {
+    int fd = open(trace->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    uint64_t count = trace->count;
+    uint64_t capacity = (uint64_t)trace->mask + 1;
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "APOTRACE", 8);
+    header.version = TRACE_VERSION;
+    header.capacity = (uint32_t)capacity;
+    header.count = count;
+    header.sourceHash = trace->sourceHash;
+    header.modulesSize = trace->modulesSize;
+    const char* modules = trace->modules;
+
+    // Oldest first: once the ring has wrapped, that is the entry the next
+    // instruction would overwrite.
+    size_t next = (size_t)(count & trace->mask);
+    bool written = writeAll(fd, &header, sizeof(header));
+    written = written && writeAll(fd, modules, header.modulesSize);
+    if (count > capacity) {
+        written = written && writeAll(fd, trace->entries + next, sizeof(TraceEntry) * (capacity - next));
+    }
+    written = written && writeAll(fd, trace->entries, sizeof(TraceEntry) * next);
+    close(fd);
+    return written;
+}
+
+static void dumpOnSignal(int signal) {
+    if (signalTrace != NULL) dumpTrace(signalTrace);
+    if (signal != SIGUSR1) raise(signal);
+}
+
+static const int fatalSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGABRT};
+
+void handleTraceSignals(Trace* trace) {
+    signalTrace = trace;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dumpOnSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+    // Fatal signals go back to their default action before the handler
+    // runs, so raising them again ends the process as it would have.
+    action.sa_flags = SA_RESETHAND;
+    for (size_t i = 0; i < sizeof(fatalSignals) / sizeof(fatalSignals[0]); i++) {
+        sigaction(fatalSignals[i], &action, NULL);
+    }
+}
+
+void ignoreTraceSignals() {
+    signal(SIGUSR1, SIG_DFL);
+    for (size_t i = 0; i < sizeof(fatalSignals) / sizeof(fatalSignals[0]); i++) {
+        signal(fatalSignals[i], SIG_DFL);
+    }
+    signalTrace = NULL;
+}
+
+static const char* const valueTags[] = {
+    [VAL_BOOL] = "bool",
+    [VAL_NIL] = "nil",
+    [VAL_DOUBLE] = "double",
+    [VAL_INT] = "int",
+    [TRACE_OBJECT_TAGS + OBJ_ARRAY] = "array",
+    [TRACE_OBJECT_TAGS + OBJ_CHANNEL] = "channel",
+    [TRACE_OBJECT_TAGS + OBJ_FIBER] = "fiber",
+    [TRACE_OBJECT_TAGS + OBJ_FILE] = "file",
+    [TRACE_OBJECT_TAGS + OBJ_FUNCTION] = "block",
+    [TRACE_OBJECT_TAGS + OBJ_MAP] = "map",
+    [TRACE_OBJECT_TAGS + OBJ_MODULE] = "module",
+    [TRACE_OBJECT_TAGS + OBJ_NATIVE] = "native",
+    [TRACE_OBJECT_TAGS + OBJ_STRING] = "string",
+    [TRACE_OBJECT_TAGS + OBJ_WORKER] = "worker",
+};
+
+static const char* tagName(uint8_t tag) {
+    if (tag == TRACE_EMPTY_STACK) return "-";
+    if (tag < sizeof(valueTags) / sizeof(valueTags[0]) && valueTags[tag] != NULL) return valueTags[tag];
+    return "?";
+}
+
+// names holds the function each chunk belongs to, or NULL for the script
+// and for blocks, which have no name.
+typedef struct {
+    int count;
+    Chunk** chunks;
+    ObjString** names;
+} ChunkIndex;
+
+// Finds every block by walking constants, and files it under its id.
+static void indexChunk(ChunkIndex* index, Chunk* chunk, ObjString* name) {
+    if (chunk->id >= index->count) {
+        int count = chunk->id + 1;
+        index->chunks = (Chunk**)realloc(index->chunks, sizeof(Chunk*) * count);
+        index->names = (ObjString**)realloc(index->names, sizeof(ObjString*) * count);
+        for (int i = index->count; i < count; i++) {
+            index->chunks[i] = NULL;
+            index->names[i] = NULL;
+        }
+        index->count = count;
+    }
+    index->chunks[chunk->id] = chunk;
+    index->names[chunk->id] = name;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_OBJ(constant) && OBJ_TYPE(constant) == OBJ_FUNCTION) {
+            ObjFunction* function = AS_FUNCTION(constant);
+            indexChunk(index, &function->chunk, function->name);
+        }
+    }
+}
+
+// Source lines are looked up by scanning from the start once into a table
+// of where each line begins.
+static const char** indexLines(const char* source, int* lineCount) {
+    int capacity = 64;
+    const char** lines = (const char**)malloc(sizeof(const char*) * capacity);
+    int count = 0;
+    lines[count++] = source;
+    for (const char* c = source; *c != '\0'; c++) {
+        if (*c != '\n') continue;
+        if (count == capacity) {
+            capacity *= 2;
+            lines = (const char**)realloc(lines, sizeof(const char*) * capacity);
+        }
+        lines[count++] = c + 1;
+    }
+    *lineCount = count;
+    return lines;
+}
+
+// The script, numbered 0, or one of the modules it imported, numbered as
+// in the trace, with what is needed to decode its instructions.
+typedef struct {
+    int module;
+    const char* path;
+    FileView source;
+    const char** lines;
+    int lineCount;
+    ChunkIndex index;
+} TracedSource;
+
+static void indexSource(TracedSource* traced, int module, const char* path, FileView source,
+                        Chunk* chunk) {
+    traced->module = module;
+    traced->path = path;
+    traced->source = source;
+    traced->lines = indexLines(source.chars, &traced->lineCount);
+    traced->index = (ChunkIndex){0, NULL, NULL};
+    indexChunk(&traced->index, chunk, NULL);
+}
+
+// Loads each module the trace names, in the order they were imported, and
+// indexes it under the number it had when the trace was recorded.
+static int loadTracedModules(const char* records, uint32_t size, TracedSource* sources,
+                             Output* errors) {
+    int count = 0;
+    uint32_t position = 0;
+    while (position + sizeof(TraceModule) <= size) {
+        TraceModule record;
+        memcpy(&record, records + position, sizeof(record));
+        const char* path = records + position + sizeof(record);
+        position += sizeof(record) + PADDED_PATH(record.length);
+        if (position > size || path[record.length] != '\0') break;
+
+        ObjFunction* body = loadModule(path, errors);
+        FileView source;
+        if (body == NULL || !openFileView(path, &source)) {
+            writeOutputFormat(errors, "Could not load module \"%s\"; its instructions can't be decoded.\n",
+                              path);
+            continue;
+        }
+        uint64_t hash = 0;
+        modulePath(body->module, &hash);
+        if (hash != record.hash) {
+            writeOutputFormat(errors, "Warning: \"%s\" is not the module the trace was recorded from.\n",
+                              path);
+        }
+        indexSource(&sources[count++], (int)record.module, path, source, &body->chunk);
+    }
+    flushOutput(errors);
+    return count;
+}
+
+static void printSourceLine(Output* output, const TracedSource* traced, int line) {
+    if (line < 1 || line > traced->lineCount) return;
+    const char* start = traced->lines[line - 1];
+    const char* end = start;
+    while (*end != '\0' && *end != '\n' && *end != '\r') end++;
+    if (traced->path == NULL) {
+        writeOutputFormat(output, "      -- line %d: %.*s\n", line, (int)(end - start), start);
+    } else {
+        writeOutputFormat(output, "      -- %s line %d: %.*s\n", traced->path, line,
+                          (int)(end - start), start);
+    }
+}
+
+int decodeTrace(const char* tracePath, const char* scriptPath) {
+    FileView traceView;
+    if (!openFileView(tracePath, &traceView)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", tracePath);
+        return 74;
+    }
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    if (traceView.length >= sizeof(header)) memcpy(&header, traceView.chars, sizeof(header));
+    if (memcmp(header.magic, "APOTRACE", 8) != 0 || header.version != TRACE_VERSION ||
+        traceView.length - sizeof(header) < header.modulesSize) {
+        fprintf(stderr, "\"%s\" is not an Apolo trace.\n", tracePath);
+        closeFileView(&traceView);
+        return 65;
+    }
+    const char* records = traceView.chars + sizeof(header);
+    size_t entryCount = (traceView.length - sizeof(header) - header.modulesSize) / sizeof(TraceEntry);
+    const TraceEntry* entries = (const TraceEntry*)(records + header.modulesSize);
+
+    FileView source;
+    if (!openFileView(scriptPath, &source)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", scriptPath);
+        closeFileView(&traceView);
+        return 74;
+    }
+    if (hashSource(source.chars, source.length) != header.sourceHash) {
+        fprintf(stderr, "Warning: \"%s\" is not the source the trace was recorded from.\n", scriptPath);
+    }
+    Output errors;
+    initOutput(&errors, stderr);
+    Program program;
+    initProgram(&program);
+    if (!compile(source.chars, &program, &errors)) {
+        freeOutput(&errors);
+        freeProgram(&program);
+        closeFileView(&source);
+        closeFileView(&traceView);
+        return 65;
+    }
+
+    int sourceCount = 1;
+    TracedSource* sources = (TracedSource*)malloc(
+        sizeof(TracedSource) * (1 + header.modulesSize / sizeof(TraceModule)));
+    indexSource(&sources[0], 0, NULL, source, &program.chunk);
+    sourceCount += loadTracedModules(records, header.modulesSize, sources + 1, &errors);
+    freeOutput(&errors);
+
+    Output output;
+    initOutput(&output, stdout);
+    writeOutputFormat(&output, "%llu instructions executed, last %zu recorded\n",
+                      (unsigned long long)header.count, entryCount);
+    writeOutputFormat(&output, "%10s %-8s %-10s %s\n", "#", "top", "chunk", "instruction");
+    uint64_t sequence = header.count - entryCount;
+    Chunk* lastChunk = NULL;
+    int lastLine = -1;
+    for (size_t i = 0; i < entryCount; i++, sequence++) {
+        const TraceEntry* entry = &entries[i];
+        TracedSource* traced = NULL;
+        for (int j = 0; j < sourceCount && traced == NULL; j++) {
+            if (sources[j].module == entry->module) traced = &sources[j];
+        }
+        Chunk* chunk = traced != NULL && entry->chunk < traced->index.count
+            ? traced->index.chunks[entry->chunk] : NULL;
+        if (chunk == NULL || entry->offset >= (uint32_t)chunk->count) {
+            writeOutputFormat(&output, "%10llu %-8s module %d chunk %d offset %u is not in this program\n",
+                              (unsigned long long)sequence, tagName(entry->top),
+                              entry->module, entry->chunk, entry->offset);
+            continue;
+        }
+        int line = chunk->lines[entry->offset];
+        if (line != lastLine || chunk != lastChunk) {
+            printSourceLine(&output, traced, line);
+            lastLine = line;
+            lastChunk = chunk;
+        }
+        ObjString* name = traced->index.names[entry->chunk];
+        char chunkName[64];
+        if (entry->chunk == 0) snprintf(chunkName, sizeof(chunkName), traced->path == NULL ? "script" : "module");
+        else if (name != NULL) snprintf(chunkName, sizeof(chunkName), "%.*s()", name->length, name->chars);
+        else snprintf(chunkName, sizeof(chunkName), "block@%d", chunk->lines[0]);
+        writeOutputFormat(&output, "%10llu %-8s %-10s ", (unsigned long long)sequence,
+                          tagName(entry->top), chunkName);
+        disassembleInstruction(&output, chunk, entry->offset);
+        writeOutputFormat(&output, "\n");
+    }
+    freeOutput(&output);
+
+    for (int i = 0; i < sourceCount; i++) {
+        free(sources[i].lines);
+        free(sources[i].index.chunks);
+        free(sources[i].index.names);
+        closeFileView(&sources[i].source);
+    }
+    free(sources);
+    freeProgram(&program);
+    closeFileView(&traceView);
+    return 0;
+}
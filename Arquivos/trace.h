@@ -0,0 +1,62 @@
+#ifndef APOLO_TRACE_H
+#define APOLO_TRACE_H
+
+#include "common.h"
+#include "object.h"
+
+#define TRACE_DEFAULT_CAPACITY (64 * 1024)
+#define TRACE_EMPTY_STACK 0xff
+
+// What was on top of the stack: a ValueType, or for objects
+// TRACE_OBJECT_TAGS plus the ObjType.
+#define TRACE_OBJECT_TAGS (VAL_OBJ + 1)
+#define TRACE_TAG(value) \
+    ((value).type == VAL_OBJ ? (uint8_t)(TRACE_OBJECT_TAGS + OBJ_TYPE(value)) : (uint8_t)(value).type)
+
+// One executed instruction: where it was, what it was, and the type of the
+// value on top of the stack just before it ran. Chunks are numbered within
+// their program, so module says which program: the number of the module
+// the chunk came from, or 0 for the script.
+typedef struct {
+    uint32_t offset;
+    uint16_t chunk;
+    uint16_t module;
+    uint8_t opcode;
+    uint8_t top;
+} TraceEntry;
+
+// The last instructions a VM executed, in a ring that is overwritten as it
+// goes. count is how many were ever recorded, so the newest entry is at
+// (count - 1) & mask. The dump holds only ids and offsets; the decoder
+// recompiles the source to turn them back into bytecode and lines, and
+// sourceHash tells it whether it has the right source. modules holds the
+// path and contents hash of every module the VM imported, laid out as they
+// are dumped, so the decoder can compile those too.
+typedef struct {
+    TraceEntry* entries;
+    uint32_t mask;
+    uint64_t count;
+    uint32_t sourceHash;
+    uint32_t modulesSize;
+    char* modules;
+    const char* path;
+} Trace;
+
+// capacity is rounded up to a power of two.
+void initTrace(Trace* trace, int capacity, const char* path, const char* source);
+void freeTrace(Trace* trace);
+// Called when the VM imports module, numbered as loadModule() numbers them.
+void traceModule(Trace* trace, int module);
+// Writes the trace to its path with nothing but open(), write() and
+// close(), so it can be called from a signal handler.
+bool dumpTrace(Trace* trace);
+// SIGUSR1 dumps the trace and carries on; SIGSEGV, SIGBUS, SIGFPE and
+// SIGABRT dump it and then let the signal take the process down.
+void handleTraceSignals(Trace* trace);
+void ignoreTraceSignals();
+// Prints a dumped trace, oldest instruction first, with each instruction
+// disassembled and the source line it came from. Modules are compiled
+// again from the paths the trace names. Returns an exit status.
+int decodeTrace(const char* tracePath, const char* scriptPath);
+
+#endif
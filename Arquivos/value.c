@@ -1,5 +1,8 @@
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include "memory.h"
+#include "number.h"
 #include "object.h"
 #include "value.h"
 #include "stdlib.h"
@@ -14,35 +17,67 @@ void writeValueArray(ValueArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
-        array->values = (Value*)realloc(array->values, sizeof(Value) * array->capacity);
+        array->values = (Value*)reallocate(array->values, sizeof(Value) * oldCapacity,
+                                           sizeof(Value) * array->capacity, MEMORY_CONSTANTS);
     }
     array->values[array->count] = value;
     array->count++;
 }
 
 void freeValueArray(ValueArray* array) {
-    free(array->values);
+    reallocate(array->values, sizeof(Value) * array->capacity, 0, MEMORY_CONSTANTS);
     initValueArray(array);
 }
 
-void printValue(Value value) {
+void printValue(Output* output, Value value) {
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            if (AS_BOOL(value)) writeOutput(output, "true", 4);
+            else writeOutput(output, "false", 5);
             break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%.4g", AS_NUMBER(value)); break;
-        case VAL_OBJ: printObject(value); break;
+        case VAL_NIL: writeOutput(output, "nil", 3); break;
+        case VAL_DOUBLE: {
+            char buffer[NUMBER_BUFFER_SIZE];
+            writeOutput(output, buffer, formatNumber(AS_DOUBLE(value), buffer));
+            break;
+        }
+        case VAL_INT: {
+            char buffer[NUMBER_BUFFER_SIZE];
+            writeOutput(output, buffer, formatInteger(AS_INT(value), buffer));
+            break;
+        }
+        case VAL_OBJ: printObject(output, value); break;
+    }
+}
+
+Value numberValue(double value) {
+    if (value >= -(double)INT_LIMIT && value <= (double)INT_LIMIT && value == (double)(int64_t)value &&
+        (value != 0 || !signbit(value))) {
+        return INT_VAL((int64_t)value);
     }
+    return DOUBLE_VAL(value);
 }
 
 bool valuesEqual(Value a, Value b) {
-    if (a.type != b.type) return false;
+    if (a.type != b.type) {
+        return IS_NUMBER(a) && IS_NUMBER(b) && AS_NUMBER(a) == AS_NUMBER(b);
+    }
     switch (a.type) {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
-        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_DOUBLE: return AS_DOUBLE(a) == AS_DOUBLE(b);
+        case VAL_INT:    return AS_INT(a) == AS_INT(b);
+        case VAL_OBJ: {
+            if (AS_OBJ(a) == AS_OBJ(b)) return true;
+            if (!IS_STRING(a) || !IS_STRING(b)) return false;
+            // Strings interned in different heaps (a VM's and a program's)
+            // can still be equal, but their hashes tell most apart.
+            ObjString* x = AS_STRING(a);
+            ObjString* y = AS_STRING(b);
+            if (x->length != y->length) return false;
+            if (x->interned && y->interned && x->hash != y->hash) return false;
+            return memcmp(x->chars, y->chars, x->length) == 0;
+        }
         default:         return false;
     }
 }
\ No newline at end of file
@@ -2,14 +2,21 @@
 #define APOLO_VALUE_H
 
 #include "common.h"
+#include "io.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+// A number is either a double or an int. Ints stay within INT_LIMIT of
+// zero, where every one of them is also exactly a double, and arithmetic
+// whose result would leave that range gives the double instead. So ints
+// are a faster way to hold some numbers, never a different kind of number:
+// any sum, product or comparison comes out as it would in floating point.
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
-    VAL_NUMBER,
+    VAL_DOUBLE,
+    VAL_INT,
     VAL_OBJ
 } ValueType;
 
@@ -18,34 +25,56 @@ typedef struct {
     union {
         bool boolean;
         double number;
+        int64_t integer;
         Obj* obj;
     } as;
 } Value;
 
+#define INT_LIMIT (INT64_C(1) << 53)
+
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
-#define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_DOUBLE(value)  ((value).type == VAL_DOUBLE)
+#define IS_INT(value)     ((value).type == VAL_INT)
+#define IS_NUMBER(value)  ((value).type == VAL_DOUBLE || (value).type == VAL_INT)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
 
 #define AS_BOOL(value)    ((value).as.boolean)
-#define AS_NUMBER(value)  ((value).as.number)
+#define AS_DOUBLE(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
+#define AS_NUMBER(value)  asNumber(value)
 #define AS_OBJ(value)     ((value).as.obj)
 
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
-#define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define DOUBLE_VAL(value) ((Value){VAL_DOUBLE, {.number = value}})
+#define INT_VAL(value)    ((Value){VAL_INT, {.integer = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+static inline double asNumber(Value value) {
+    return IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value);
+}
+
+// The result of integer arithmetic: an int while it is in range, and past
+// that the double nearest to it, which is what floating point would give.
+static inline Value intValue(int64_t n) {
+    if ((uint64_t)(n + INT_LIMIT) <= (uint64_t)(2 * INT_LIMIT)) return INT_VAL(n);
+    return DOUBLE_VAL((double)n);
+}
+
 typedef struct {
     int capacity;
     int count;
     Value* values;
 } ValueArray;
 
+// An int when value is a whole number in range (but not -0), otherwise a
+// double.
+Value numberValue(double value);
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
-void printValue(Value value);
+void printValue(Output* output, Value value);
 
 #endif
\ No newline at end of file
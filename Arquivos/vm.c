@@ -1,53 +1,187 @@
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "common.h"
+#include "aot.h"
+#include "array.h"
 #include "compiler.h"
+#include "map.h"
+#include "memory.h"
+#include "module.h"
+#include "native.h"
 #include "object.h"
+#include "stats.h"
 #include "vm.h"
 
-VM vm;
+#ifdef DEBUG_TRACE_EXECUTION
+#include "debug.h"
+#endif
 
+// Fibers that were running when the stack is reset can't be resumed.
 static void resetStack(VM* vmptr) {
+    for (ObjFiber* fiber = vmptr->fiber; fiber != NULL; fiber = fiber->caller) {
+        fiber->state = FIBER_DONE;
+        fiber->stackTop = fiber->stack;
+    }
+    vmptr->fiber = NULL;
+    vmptr->frameCount = 0;
+    vmptr->stack = vmptr->rootStack;
     vmptr->stackTop = vmptr->stack;
+    vmptr->stackLimit = vmptr->rootStack + vmptr->rootCapacity;
+    vmptr->currentGlobals = &vmptr->globals;
+}
+
+// Frames don't say which code made each call, but a caller that is itself
+// a function is running that function's chunk.
+static ObjFunction* functionRunning(VM* vmptr, int frame, Chunk* chunk) {
+    if (frame < 0 || chunk != &vmptr->frames[frame].function->chunk) return NULL;
+    return vmptr->frames[frame].function;
 }
 
-static void runtimeError(VM* vmptr, const char* format, ...) {
+static void printLocation(Output* err, Chunk* chunk, Byte* ip, ObjFunction* function) {
+    size_t instruction = ip - chunk->code;
+    if (instruction > 0) instruction--;
+    int line = chunk->lines[instruction];
+    if (function == NULL) {
+        writeOutputFormat(err, "[Line %d] in script\n", line);
+    } else if (function->chunk.id == 0) {
+        // A module's top-level code, named after its path.
+        writeOutputFormat(err, "[Line %d] in %.*s\n", line, function->name->length, function->name->chars);
+    } else {
+        writeOutputFormat(err, "[Line %d] in %.*s()\n", line, function->name->length, function->name->chars);
+    }
+}
+
+void runtimeError(VM* vmptr, const char* format, ...) {
+    flushOutput(&vmptr->out);
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    char message[256];
+    vsnprintf(message, sizeof(message), format, args);
     va_end(args);
-    fputs("\n", stderr);
 
-    size_t instruction = vmptr->ip - vmptr->chunk->code - 1;
-    int line = vmptr->chunk->lines[instruction];
-    fprintf(stderr, "[Line %d] in script\n", line);
+    writeOutputFormat(&vmptr->err, "%s\n", message);
+    printLocation(&vmptr->err, vmptr->chunk, vmptr->ip,
+                  functionRunning(vmptr, vmptr->frameCount - 1, vmptr->chunk));
+    // Leaving out a single frame would save nothing.
+    int hidden = vmptr->frameCount + 1 - 2 * ERROR_FRAMES_SHOWN;
+    for (int i = vmptr->frameCount - 1; i >= 0; i--) {
+        if (hidden > 1 && i == vmptr->frameCount - ERROR_FRAMES_SHOWN) {
+            writeOutputFormat(&vmptr->err, "... %d more frames\n", hidden);
+            i -= hidden - 1;
+            continue;
+        }
+        CallFrame* frame = &vmptr->frames[i];
+        printLocation(&vmptr->err, frame->chunk, frame->ip, functionRunning(vmptr, i - 1, frame->chunk));
+    }
+    if (vmptr->trace != NULL && dumpTrace(vmptr->trace)) {
+        writeOutputFormat(&vmptr->err, "Execution trace written to %s.\n", vmptr->trace->path);
+    }
+    flushOutput(&vmptr->err);
     resetStack(vmptr);
 }
 
 void initVM(VM* vmptr) {
+    initMemoryAccount(&vmptr->memory);
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    vmptr->fiber = NULL;
+    vmptr->fuel = FUEL_UNLIMITED;
+    vmptr->rootCapacity = STACK_INITIAL;
+    vmptr->rootStack = (Value*)reallocate(NULL, 0, sizeof(Value) * STACK_INITIAL, MEMORY_STACKS);
     resetStack(vmptr);
-    vmptr->objects = NULL;
+    vmptr->chunk = NULL;
+    vmptr->nextGC = GC_INITIAL_HEAP;
+    vmptr->grayCount = 0;
+    vmptr->grayCapacity = 0;
+    vmptr->grayStack = NULL;
+    vmptr->programCount = 0;
+    vmptr->programCapacity = 0;
+    vmptr->programs = NULL;
+    vmptr->workers = NULL;
+    vmptr->trace = NULL;
+    vmptr->importedCapacity = 0;
+    vmptr->imported = NULL;
     initTable(&vmptr->globals);
-    initTable(&vmptr->strings);
+    initTable(&vmptr->natives);
+    initTable(&vmptr->modules);
+    initHeap(&vmptr->heap);
+    initOutput(&vmptr->out, stdout);
+    initOutput(&vmptr->err, stderr);
+    initInput(&vmptr->in, stdin);
+    defineNatives(vmptr);
+    useMemoryAccount(previous);
 }
 
+static void freePrograms(VM* vmptr) {
+    for (int i = 0; i < vmptr->programCount; i++) {
+        freeProgram(vmptr->programs[i]);
+        free(vmptr->programs[i]);
+    }
+    vmptr->programCount = 0;
+}
+
+static bool joinWorkers(VM* vmptr);
+
 void freeVM(VM* vmptr) {
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    joinWorkers(vmptr);
+    freeOutput(&vmptr->out);
+    freeOutput(&vmptr->err);
+    freeInput(&vmptr->in);
     freeTable(&vmptr->globals);
-    freeTable(&vmptr->strings);
-    
-    Obj* object = vmptr->objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        if (object->type == OBJ_STRING) {
-            ObjString* string = (ObjString*)object;
-            free(string->chars);
-        }
-        free(object);
-        object = next;
-    }
+    freeTable(&vmptr->natives);
+    freeTable(&vmptr->modules);
+    free(vmptr->imported);
+    vmptr->imported = NULL;
+    vmptr->importedCapacity = 0;
+    freeHeap(&vmptr->heap);
+    free(vmptr->grayStack);
+    vmptr->grayStack = NULL;
+    reallocate(vmptr->rootStack, sizeof(Value) * vmptr->rootCapacity, 0, MEMORY_STACKS);
+    vmptr->rootStack = NULL;
+
+    freePrograms(vmptr);
+    free(vmptr->programs);
+    vmptr->programs = NULL;
+    vmptr->programCapacity = 0;
+    useMemoryAccount(previous);
+}
+
+// Returns the VM to its freshly initialized state for the next script, but
+// keeps the buffers, gray stack, program list and module list it has
+// already grown. Modules are imported again, and run again, by the next
+// script that needs them.
+// Captured output that has not been read is discarded, and peak memory
+// starts again from what the VM still holds.
+void resetVM(VM* vmptr) {
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    joinWorkers(vmptr);
+    resetStack(vmptr);
+    vmptr->chunk = NULL;
+    freePrograms(vmptr);
+    freeTable(&vmptr->globals);
+    freeTable(&vmptr->natives);
+    freeTable(&vmptr->modules);
+    if (vmptr->imported != NULL) memset(vmptr->imported, 0, sizeof(ObjModule*) * vmptr->importedCapacity);
+    freeHeap(&vmptr->heap);
+    initHeap(&vmptr->heap);
+    vmptr->nextGC = GC_INITIAL_HEAP;
+    flushOutput(&vmptr->out);
+    flushOutput(&vmptr->err);
+    vmptr->out.count = 0;
+    vmptr->err.count = 0;
+    defineNatives(vmptr);
+    memcpy(vmptr->memory.peak, vmptr->memory.live, sizeof(vmptr->memory.peak));
+    vmptr->memory.peakTotal = vmptr->memory.total;
+    useMemoryAccount(previous);
+}
+
+void setMemoryLimit(VM* vmptr, size_t bytes) {
+    vmptr->memory.limit = bytes;
 }
 
 void push(VM* vmptr, Value value) {
@@ -64,32 +198,469 @@ static Value peek(VM* vmptr, int distance) {
     return vmptr->stackTop[-1 - distance];
 }
 
+// The number of lines input(n) asks for, which the caller has checked is
+// at least 1. Counts no int can hold read every line left anyway.
+static int lineCount(Value count) {
+    double lines = AS_NUMBER(count);
+    return lines >= INT_MAX ? INT_MAX : (int)lines;
+}
+
+// input(n): the lines as one string, or nil at the end of input. False,
+// after reporting it, when there is no memory for them.
+static bool inputLines(VM* vmptr, int count, Value* result) {
+    const char* lines;
+    int length;
+    flushOutput(&vmptr->out);
+    int found = readLines(&vmptr->in, count, &lines, &length);
+    if (found < 0) {
+        runtimeError(vmptr, "Out of memory.");
+        return false;
+    }
+    if (found == 0) {
+        *result = NIL_VAL;
+        return true;
+    }
+    char* chars = (char*)tryReallocate(NULL, 0, length + 1, MEMORY_STRING_CHARS);
+    if (chars == NULL) {
+        allocationError(vmptr, length + 1);
+        return false;
+    }
+    memcpy(chars, lines, length);
+    chars[length] = '\0';
+    COUNT_BY(stringBytesCopied, length);
+    *result = OBJ_VAL(takeStringUninterned(&vmptr->heap, chars, length));
+    return true;
+}
+
 static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate(VM* vmptr) {
-    ObjString* b = AS_STRING(pop(vmptr));
-    ObjString* a = AS_STRING(pop(vmptr));
+static bool callValue(VM* vmptr, Value callee, int argCount) {
+    if (IS_NATIVE(callee)) {
+        ObjNative* native = AS_NATIVE(callee);
+        if (native->arity != -1 && argCount != native->arity) {
+            runtimeError(vmptr, "Expected %d arguments but got %d.", native->arity, argCount);
+            return false;
+        }
+        Value* args = vmptr->stackTop - argCount;
+        Value result;
+        if (!native->function(vmptr, argCount, args, &result)) return false;
+        vmptr->stackTop = args - 1;
+        push(vmptr, result);
+        return true;
+    }
+    COUNT(typeErrors);
+    runtimeError(vmptr, "Can only call functions.");
+    return false;
+}
+
+// Makes room for needed values from base on the stack the running code is
+// on. Growing moves the stack, and every pointer into it moves along: the
+// running code's and those saved by the calls made on it. Other stacks,
+// and the code on them, are untouched.
+static NOINLINE bool growStack(VM* vmptr, Value* base, int needed) {
+    ObjFiber* fiber = vmptr->fiber;
+    Value* oldStack = fiber != NULL ? fiber->stack : vmptr->rootStack;
+    size_t oldCapacity = (size_t)(vmptr->stackLimit - oldStack);
+    size_t required = (size_t)(base - oldStack) + needed;
+    if (required <= oldCapacity) return true;
+    if (required > STACK_MAX) {
+        runtimeError(vmptr, "Stack overflow.");
+        return false;
+    }
+    size_t capacity = oldCapacity < STACK_INITIAL ? STACK_INITIAL : oldCapacity;
+    while (capacity < required) capacity *= 2;
+    if (capacity > STACK_MAX) capacity = STACK_MAX;
+
+    uintptr_t oldStart = (uintptr_t)oldStack;
+    uintptr_t oldEnd = (uintptr_t)vmptr->stackLimit;
+    ptrdiff_t slots = vmptr->stack - oldStack;
+    ptrdiff_t top = vmptr->stackTop - oldStack;
+    Value* stack = (Value*)reallocate(oldStack, sizeof(Value) * oldCapacity,
+                                      sizeof(Value) * capacity, MEMORY_STACKS);
+    vmptr->stack = stack + slots;
+    vmptr->stackTop = stack + top;
+    vmptr->stackLimit = stack + capacity;
+    for (int i = 0; i < vmptr->frameCount; i++) {
+        uintptr_t frameSlots = (uintptr_t)vmptr->frames[i].slots;
+        if (frameSlots >= oldStart && frameSlots < oldEnd) {
+            vmptr->frames[i].slots = stack + (frameSlots - oldStart) / sizeof(Value);
+        }
+    }
+    if (fiber != NULL) {
+        vmptr->heap.bytesAllocated += sizeof(Value) * (capacity - oldCapacity);
+        fiber->stack = stack;
+        fiber->capacity = (int)capacity;
+    } else {
+        vmptr->rootStack = stack;
+        vmptr->rootCapacity = (int)capacity;
+    }
+    return true;
+}
+
+// Code compiled in a module uses the module's globals, unless this VM never
+// imported it: a function made inside a spawned block runs in the worker's
+// VM, and sees that VM's globals like the block itself does.
+static inline Table* globalsOf(VM* vmptr, ObjFunction* function) {
+    int module = function->module;
+    if (module == 0 || module >= vmptr->importedCapacity || vmptr->imported[module] == NULL) {
+        return &vmptr->globals;
+    }
+    return &vmptr->imported[module]->globals;
+}
+
+// Gives the module a namespace the first time this VM imports it and calls
+// its top-level code with that in slot 0; the code returns it as the value
+// of the import. A module imported again under another path is the same
+// module.
+static NOINLINE bool importModule(VM* vmptr, ObjString* path) {
+    ObjFunction* body = loadModule(path->chars, &vmptr->err);
+    if (body == NULL) {
+        runtimeError(vmptr, "Could not import \"%s\".", path->chars);
+        return false;
+    }
+    if (globalsOf(vmptr, body) != &vmptr->globals) {
+        ObjModule* module = vmptr->imported[body->module];
+        tableSet(&vmptr->modules, OBJ_VAL(path), OBJ_VAL(module));
+        push(vmptr, OBJ_VAL(module));
+        return true;
+    }
+    if (vmptr->frameCount == FRAMES_MAX) {
+        runtimeError(vmptr, "Stack overflow.");
+        return false;
+    }
+
+    ObjModule* module = newModule(&vmptr->heap, path);
+    tableReserve(&module->globals, 128);
+    tableAddAll(&vmptr->natives, &module->globals);
+    tableSet(&vmptr->modules, OBJ_VAL(path), OBJ_VAL(module));
+    if (vmptr->importedCapacity <= body->module) {
+        int capacity = vmptr->importedCapacity < 8 ? 8 : vmptr->importedCapacity;
+        while (capacity <= body->module) capacity *= 2;
+        vmptr->imported = (ObjModule**)realloc(vmptr->imported, sizeof(ObjModule*) * capacity);
+        if (vmptr->imported == NULL) exit(1);
+        memset(vmptr->imported + vmptr->importedCapacity, 0,
+               sizeof(ObjModule*) * (capacity - vmptr->importedCapacity));
+        vmptr->importedCapacity = capacity;
+    }
+    vmptr->imported[body->module] = module;
+    if (vmptr->trace != NULL) traceModule(vmptr->trace, body->module);
+
+    push(vmptr, OBJ_VAL(module));
+    if (!growStack(vmptr, vmptr->stackTop, body->chunk.maxDepth)) return false;
+    Value* slots = vmptr->stackTop;
+    push(vmptr, OBJ_VAL(module));
+    CallFrame* frame = &vmptr->frames[vmptr->frameCount++];
+    frame->function = body;
+    frame->chunk = vmptr->chunk;
+    frame->ip = vmptr->ip;
+    frame->slots = vmptr->stack;
+    frame->globals = vmptr->currentGlobals;
+    vmptr->chunk = &body->chunk;
+    vmptr->ip = body->chunk.code;
+    vmptr->stack = slots;
+    vmptr->currentGlobals = &module->globals;
+    return true;
+}
+
+// OP_CALL checks a function's arity, the frame count and the room left on
+// the stack with a single branch; this tells them apart once one failed,
+// and grows the stack when that is all the call needs.
+static NOINLINE bool prepareCall(VM* vmptr, ObjFunction* function, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError(vmptr, "Expected %d arguments but got %d.", function->arity, argCount);
+        return false;
+    }
+    if (vmptr->frameCount == FRAMES_MAX) {
+        runtimeError(vmptr, "Stack overflow.");
+        return false;
+    }
+    return growStack(vmptr, vmptr->stackTop - argCount, function->chunk.maxDepth);
+}
+
+static void* runWorker(void* arg);
+
+// Pops the captured values, copies them for the new VM and starts it.
+static bool spawnWorker(VM* vmptr, ObjFunction* function) {
+    Worker* worker = (Worker*)malloc(sizeof(Worker));
+    if (worker == NULL) {
+        allocationError(vmptr, sizeof(Worker));
+        return false;
+    }
+    worker->function = function;
+    worker->args = (Message*)malloc(sizeof(Message) * (function->arity + 1));
+    if (worker->args == NULL) {
+        free(worker);
+        allocationError(vmptr, sizeof(Message) * (function->arity + 1));
+        return false;
+    }
+    worker->result.type = MESSAGE_NIL;
+    initOutput(&worker->out, vmptr->out.file);
+    initOutput(&worker->err, vmptr->err.file);
+    worker->memoryLimit = vmptr->memory.limit;
+    worker->failed = false;
+
+    Value* args = vmptr->stackTop - function->arity;
+    for (int i = 0; i < function->arity; i++) {
+        if (!packMessage(args[i], &worker->args[i])) {
+            while (i > 0) freeMessage(&worker->args[--i]);
+            free(worker->args);
+            free(worker);
+            runtimeError(vmptr, "Only nil, booleans, numbers, strings and channels can be captured by spawn.");
+            return false;
+        }
+    }
+    if (pthread_create(&worker->thread, NULL, runWorker, worker) != 0) {
+        for (int i = 0; i < function->arity; i++) freeMessage(&worker->args[i]);
+        free(worker->args);
+        free(worker);
+        runtimeError(vmptr, "Could not start a thread.");
+        return false;
+    }
+
+    vmptr->stackTop = args;
+    worker->handle = newWorker(&vmptr->heap, worker);
+    worker->next = vmptr->workers;
+    vmptr->workers = worker;
+    push(vmptr, OBJ_VAL(worker->handle));
+    return true;
+}
+
+// Waits for the worker and hands its return value to its handle, if the
+// handle is still alive. Returns false if the spawned block failed.
+bool joinWorker(VM* vmptr, Worker* worker) {
+    pthread_join(worker->thread, NULL);
+    Worker** link = &vmptr->workers;
+    while (*link != worker) link = &(*link)->next;
+    *link = worker->next;
+
+    if (worker->out.count > 0) writeOutput(&vmptr->out, worker->out.chars, worker->out.count);
+    if (worker->err.count > 0) writeOutput(&vmptr->err, worker->err.chars, worker->err.count);
+    freeOutput(&worker->out);
+    freeOutput(&worker->err);
+
+    bool succeeded = !worker->failed;
+    if (worker->handle != NULL) {
+        worker->handle->result = unpackMessage(&vmptr->heap, &worker->result);
+        worker->handle->worker = NULL;
+    } else {
+        freeMessage(&worker->result);
+    }
+    free(worker);
+    return succeeded;
+}
+
+static bool joinWorkers(VM* vmptr) {
+    bool succeeded = true;
+    while (vmptr->workers != NULL) {
+        if (!joinWorker(vmptr, vmptr->workers)) succeeded = false;
+    }
+    return succeeded;
+}
 
+// Leaves the running context and continues in fiber, or in the script
+// when fiber is NULL. Only pointers move, so switching never allocates.
+static void switchTo(VM* vmptr, ObjFiber* fiber) {
+    if (vmptr->fiber != NULL) {
+        vmptr->fiber->chunk = vmptr->chunk;
+        vmptr->fiber->ip = vmptr->ip;
+        vmptr->fiber->slots = vmptr->stack;
+        vmptr->fiber->stackTop = vmptr->stackTop;
+        vmptr->fiber->globals = vmptr->currentGlobals;
+    } else {
+        vmptr->rootChunk = vmptr->chunk;
+        vmptr->rootIp = vmptr->ip;
+        vmptr->rootSlots = vmptr->stack;
+        vmptr->rootStackTop = vmptr->stackTop;
+        vmptr->rootGlobals = vmptr->currentGlobals;
+    }
+    if (fiber != NULL) {
+        vmptr->chunk = fiber->chunk;
+        vmptr->ip = fiber->ip;
+        vmptr->stack = fiber->slots;
+        vmptr->stackTop = fiber->stackTop;
+        vmptr->stackLimit = fiber->stack + fiber->capacity;
+        vmptr->currentGlobals = fiber->globals;
+    } else {
+        vmptr->chunk = vmptr->rootChunk;
+        vmptr->ip = vmptr->rootIp;
+        vmptr->stack = vmptr->rootSlots;
+        vmptr->stackTop = vmptr->rootStackTop;
+        vmptr->stackLimit = vmptr->rootStack + vmptr->rootCapacity;
+        vmptr->currentGlobals = vmptr->rootGlobals;
+    }
+    vmptr->fiber = fiber;
+}
+
+// NULL, after reporting it, when the result is too long or there is no
+// memory for it.
+static ObjString* concatenate(VM* vmptr, ObjString* a, ObjString* b) {
+    if ((size_t)a->length + b->length > INT_MAX - 1) {
+        runtimeError(vmptr, "Concatenation would make the string too long.");
+        return NULL;
+    }
     int length = a->length + b->length;
-    char* chars = (char*)malloc(length + 1);
+    char* chars = withinMemoryLimit(length + 1) ? (char*)malloc(length + 1) : NULL;
+    if (chars == NULL) {
+        allocationError(vmptr, length + 1);
+        return NULL;
+    }
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = takeString(chars, length);
-    push(vmptr, OBJ_VAL(result));
+    COUNT(concatenations);
+    COUNT_BY(concatenatedBytes, length);
+    return takeString(&vmptr->heap, chars, length);
 }
 
-static InterpretResult run(VM* vmptr) {
+void allocationError(VM* vmptr, size_t bytes) {
+    if (withinMemoryLimit(bytes)) {
+        runtimeError(vmptr, "Out of memory.");
+    } else {
+        runtimeError(vmptr, "Memory limit of %zu bytes exceeded.", vmptr->memory.limit);
+    }
+}
+
+static ObjArray* arrayLiteral(VM* vmptr, Value* elements, int count) {
+    ObjArray* array = newArray(&vmptr->heap);
+    for (int i = 0; i < count; i++) {
+        if (!arrayAppend(&vmptr->heap, array, elements[i])) {
+            allocationError(vmptr, sizeof(Value) * count);
+            return NULL;
+        }
+    }
+    return array;
+}
+
+// Collects garbage, then fails the script if it still holds more memory
+// than its limit allows.
+static bool reclaimMemory(VM* vmptr) {
+    collectGarbage(vmptr);
+    if (vmptr->memory.total > vmptr->memory.limit) {
+        runtimeError(vmptr, "Memory limit of %zu bytes exceeded.", vmptr->memory.limit);
+        return false;
+    }
+    return true;
+}
+
+// slots hold a for loop's counter, limit and step, with the loop variable
+// above them. Only here are their types checked: nothing but OP_FOR_LOOP
+// can write to the hidden three. They are left all ints or all doubles, so
+// OP_FOR_LOOP need only look at the counter. Kept out of the interpreter loop, which
+// gets slower for every loop when this is inlined into it.
+static NOINLINE ForPrep prepareFor(VM* vmptr, Value* slots, Stats* stats) {
+    if (!IS_NUMBER(slots[0]) || !IS_NUMBER(slots[1]) || !IS_NUMBER(slots[2])) {
+        if (stats != NULL) stats->typeErrors++;
+        runtimeError(vmptr, "For loop bounds and step must be numbers.");
+        return FOR_ERROR;
+    }
+    if (!IS_INT(slots[0]) || !IS_INT(slots[1]) || !IS_INT(slots[2])) {
+        for (int i = 0; i < 3; i++) slots[i] = DOUBLE_VAL(AS_NUMBER(slots[i]));
+    }
+    double counter = AS_NUMBER(slots[0]);
+    double step = AS_NUMBER(slots[2]);
+    if (step == 0) {
+        runtimeError(vmptr, "For loop step can't be zero.");
+        return FOR_ERROR;
+    }
+    if (step > 0 ? counter < AS_NUMBER(slots[1]) : counter > AS_NUMBER(slots[1])) {
+        slots[3] = slots[0];
+        return FOR_ENTER;
+    }
+    return FOR_SKIP;
+}
+
+// Checks the index of OP_GET_INDEX and OP_SET_INDEX on an array, or
+// reports that the target is neither an array nor a map. Doubles index too
+// when they are whole, since arithmetic can leave one behind.
+static NOINLINE bool arrayIndex(VM* vmptr, Value target, Value indexValue, int* index, Stats* stats) {
+    if (!IS_ARRAY(target)) {
+        if (stats != NULL) stats->typeErrors++;
+        runtimeError(vmptr, "Only arrays and maps can be indexed.");
+        return false;
+    }
+    double number = IS_NUMBER(indexValue) ? AS_NUMBER(indexValue) : NAN;
+    if (floor(number) != number) {
+        if (stats != NULL) stats->typeErrors++;
+        runtimeError(vmptr, "Array index must be a whole number.");
+        return false;
+    }
+    if (number < 0 || number >= AS_ARRAY(target)->count) {
+        runtimeError(vmptr, "Array index out of bounds.");
+        return false;
+    }
+    *index = (int)number;
+    return true;
+}
+
+static bool checkMapKey(VM* vmptr, Value value, Value* key, Stats* stats) {
+    if (mapKey(value, key)) return true;
+    if (stats != NULL) stats->typeErrors++;
+    if (IS_NUMBER(value)) {
+        runtimeError(vmptr, "Map key can't be nan.");
+    } else {
+        runtimeError(vmptr, "Map key must be a string, a boolean or a number.");
+    }
+    return false;
+}
+
+// Missing keys read as nil.
+static NOINLINE bool getMapElement(VM* vmptr, ObjMap* map, Value keyValue, Value* element, Stats* stats) {
+    Value key;
+    if (!checkMapKey(vmptr, keyValue, &key, stats)) return false;
+    if (!mapGet(map, key, element)) *element = NIL_VAL;
+    return true;
+}
+
+static NOINLINE bool setMapElement(VM* vmptr, ObjMap* map, Value keyValue, Value value, Stats* stats) {
+    Value key;
+    if (!checkMapKey(vmptr, keyValue, &key, stats)) return false;
+    mapSet(&vmptr->heap, map, key, value);
+    return true;
+}
+
+// The next key of a map or element of an array for OP_FOR_IN, whose slots
+// hold the collection, a cursor and the loop variable.
+static NOINLINE ForPrep nextForIn(VM* vmptr, Value* slots, Stats* stats) {
+    int cursor = (int)AS_INT(slots[1]);
+    if (IS_MAP(slots[0])) {
+        if (!mapNext(AS_MAP(slots[0]), &cursor, &slots[2])) return FOR_SKIP;
+    } else if (IS_ARRAY(slots[0])) {
+        ObjArray* array = AS_ARRAY(slots[0]);
+        if (cursor >= array->count) return FOR_SKIP;
+        slots[2] = arrayGet(array, cursor++);
+    } else {
+        if (stats != NULL) stats->typeErrors++;
+        runtimeError(vmptr, "Can only loop over arrays and maps.");
+        return FOR_ERROR;
+    }
+    slots[1] = INT_VAL(cursor);
+    return FOR_ENTER;
+}
+
+#define COUNT_TYPE_ERROR() do { if (stats != NULL) stats->typeErrors++; } while (false)
+
+// The interpreter loop is instantiated twice: with stats and trace as
+// constant NULLs the counting and recording fold away, so the copy used
+// while both are off runs exactly as if they were compiled out.
+static ALWAYS_INLINE InterpretResult dispatch(VM* vmptr, Stats* stats, Trace* trace) {
     #define READ_BYTE() (*vmptr->ip++)
     #define READ_SHORT() (vmptr->ip += 2, (uint16_t)((vmptr->ip[-2] << 8) | vmptr->ip[-1]))
     #define READ_CONSTANT() (vmptr->chunk->constants.values[READ_BYTE()])
     #define READ_STRING() AS_STRING(READ_CONSTANT())
-    #define BINARY_OP(valueType, op) \
+    // Two ints take intOp, any other pair of numbers is done in doubles.
+    #define BINARY_OP(valueType, intOp, op) \
         do { \
+            if (LIKELY(IS_INT(peek(vmptr, 0)) && IS_INT(peek(vmptr, 1)))) { \
+                int64_t b = AS_INT(pop(vmptr)); \
+                int64_t a = AS_INT(pop(vmptr)); \
+                push(vmptr, intOp); \
+                break; \
+            } \
             if (!IS_NUMBER(peek(vmptr, 0)) || !IS_NUMBER(peek(vmptr, 1))) { \
+                COUNT_TYPE_ERROR(); \
                 runtimeError(vmptr, "Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
@@ -99,8 +670,32 @@ static InterpretResult run(VM* vmptr) {
         } while (false)
 
     for (;;) {
-        Byte instruction;
-        switch (instruction = READ_BYTE()) {
+        uint16_t offset;
+#ifdef DEBUG_TRACE_EXECUTION
+        {
+            Output* out = &vmptr->out;
+            writeOutputFormat(out, "          ");
+            for (Value* slot = vmptr->stack; slot < vmptr->stackTop; slot++) {
+                writeOutputFormat(out, "[ ");
+                printValue(out, *slot);
+                writeOutputFormat(out, " ]");
+            }
+            writeOutputFormat(out, "\n");
+            disassembleInstruction(out, vmptr->chunk, (int)(vmptr->ip - vmptr->chunk->code));
+            writeOutputFormat(out, "\n");
+        }
+#endif
+        if (trace != NULL) {
+            TraceEntry* entry = &trace->entries[trace->count++ & trace->mask];
+            entry->offset = (uint32_t)(vmptr->ip - vmptr->chunk->code);
+            entry->chunk = (uint16_t)vmptr->chunk->id;
+            entry->module = (uint16_t)vmptr->chunk->module;
+            entry->opcode = *vmptr->ip;
+            entry->top = vmptr->stackTop > vmptr->stack ? TRACE_TAG(vmptr->stackTop[-1]) : TRACE_EMPTY_STACK;
+        }
+        Byte instruction = READ_BYTE();
+        if (stats != NULL) stats->opcodes[instruction]++;
+        switch (instruction) {
             case OP_CONSTANT: push(vmptr, READ_CONSTANT()); break;
             case OP_NIL:   push(vmptr, NIL_VAL); break;
             case OP_TRUE:  push(vmptr, BOOL_VAL(true)); break;
@@ -120,7 +715,7 @@ static InterpretResult run(VM* vmptr) {
             case OP_GET_GLOBAL: {
                 ObjString* name = READ_STRING();
                 Value value;
-                if (!tableGet(&vmptr->globals, name, &value)) {
+                if (!tableGet(vmptr->currentGlobals, OBJ_VAL(name), &value)) {
                     runtimeError(vmptr, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -129,14 +724,14 @@ static InterpretResult run(VM* vmptr) {
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
-                tableSet(&vmptr->globals, name, peek(vmptr, 0));
+                tableSet(vmptr->currentGlobals, OBJ_VAL(name), peek(vmptr, 0));
                 pop(vmptr);
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
-                if (tableSet(&vmptr->globals, name, peek(vmptr, 0))) {
-                    tableDelete(&vmptr->globals, name);
+                if (tableSet(vmptr->currentGlobals, OBJ_VAL(name), peek(vmptr, 0))) {
+                    tableDelete(vmptr->currentGlobals, OBJ_VAL(name));
                     runtimeError(vmptr, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -149,48 +744,153 @@ static InterpretResult run(VM* vmptr) {
                 push(vmptr, BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
+            case OP_GREATER:  BINARY_OP(BOOL_VAL, BOOL_VAL(a > b), >); break;
+            case OP_LESS:     BINARY_OP(BOOL_VAL, BOOL_VAL(a < b), <); break;
             case OP_ADD: {
-                if (IS_STRING(peek(vmptr, 0)) && IS_STRING(peek(vmptr, 1))) {
-                    concatenate(vmptr);
+                if (LIKELY(IS_INT(peek(vmptr, 0)) && IS_INT(peek(vmptr, 1)))) {
+                    int64_t b = AS_INT(pop(vmptr));
+                    int64_t a = AS_INT(pop(vmptr));
+                    push(vmptr, intValue(a + b));
                 } else if (IS_NUMBER(peek(vmptr, 0)) && IS_NUMBER(peek(vmptr, 1))) {
                     double b = AS_NUMBER(pop(vmptr));
                     double a = AS_NUMBER(pop(vmptr));
-                    push(vmptr, NUMBER_VAL(a + b));
+                    push(vmptr, DOUBLE_VAL(a + b));
+                } else if (IS_STRING(peek(vmptr, 0)) && IS_STRING(peek(vmptr, 1))) {
+                    ObjString* b = AS_STRING(pop(vmptr));
+                    ObjString* a = AS_STRING(pop(vmptr));
+                    ObjString* string = concatenate(vmptr, a, b);
+                    if (string == NULL) return INTERPRET_RUNTIME_ERROR;
+                    push(vmptr, OBJ_VAL(string));
                 } else {
+                    COUNT_TYPE_ERROR();
                     runtimeError(vmptr, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
-            case OP_SUB:      BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MUL:      BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIV:      BINARY_OP(NUMBER_VAL, /); break;
+            case OP_SUB:      BINARY_OP(DOUBLE_VAL, intValue(a - b), -); break;
+            case OP_MUL:      BINARY_OP(DOUBLE_VAL, multiplyInts(a, b), *); break;
+            case OP_DIV:      BINARY_OP(DOUBLE_VAL, divideInts(a, b), /); break;
             case OP_NOT:      push(vmptr, BOOL_VAL(isFalsey(pop(vmptr)))); break;
             case OP_NEGATE:   
                 if (!IS_NUMBER(peek(vmptr, 0))) {
+                     COUNT_TYPE_ERROR();
                      runtimeError(vmptr, "Operand must be a number.");
                      return INTERPRET_RUNTIME_ERROR;
                 }
-                push(vmptr, NUMBER_VAL(-AS_NUMBER(pop(vmptr)))); 
+                if (IS_INT(peek(vmptr, 0)) && AS_INT(peek(vmptr, 0)) != 0) {
+                    push(vmptr, INT_VAL(-AS_INT(pop(vmptr))));
+                } else {
+                    push(vmptr, DOUBLE_VAL(-AS_NUMBER(pop(vmptr))));
+                }
+                break;
+            case OP_ARRAY: {
+                int count = READ_BYTE();
+                ObjArray* array = arrayLiteral(vmptr, vmptr->stackTop - count, count);
+                if (array == NULL) return INTERPRET_RUNTIME_ERROR;
+                vmptr->stackTop -= count;
+                push(vmptr, OBJ_VAL(array));
+                break;
+            }
+            case OP_MAP: {
+                int count = READ_BYTE();
+                ObjMap* map = newMap(&vmptr->heap);
+                mapReserve(&vmptr->heap, map, count);
+                for (Value* entry = vmptr->stackTop - 2 * count; entry < vmptr->stackTop; entry += 2) {
+                    if (!setMapElement(vmptr, map, entry[0], entry[1], stats)) return INTERPRET_RUNTIME_ERROR;
+                }
+                vmptr->stackTop -= 2 * count;
+                push(vmptr, OBJ_VAL(map));
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value element;
+                if (IS_MAP(peek(vmptr, 1))) {
+                    if (!getMapElement(vmptr, AS_MAP(peek(vmptr, 1)), peek(vmptr, 0), &element, stats)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                } else {
+                    int index;
+                    if (!arrayIndex(vmptr, peek(vmptr, 1), peek(vmptr, 0), &index, stats)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    element = arrayGet(AS_ARRAY(peek(vmptr, 1)), index);
+                }
+                vmptr->stackTop -= 2;
+                push(vmptr, element);
+                break;
+            }
+            case OP_SET_INDEX: {
+                Value value = peek(vmptr, 0);
+                if (IS_MAP(peek(vmptr, 2))) {
+                    if (!setMapElement(vmptr, AS_MAP(peek(vmptr, 2)), peek(vmptr, 1), value, stats)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                } else {
+                    int index;
+                    if (!arrayIndex(vmptr, peek(vmptr, 2), peek(vmptr, 1), &index, stats)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    arraySet(&vmptr->heap, AS_ARRAY(peek(vmptr, 2)), index, value);
+                }
+                vmptr->stackTop -= 3;
+                push(vmptr, value);
+                break;
+            }
+            case OP_DELETE_INDEX: {
+                Value key;
+                if (!IS_MAP(peek(vmptr, 1))) {
+                    COUNT_TYPE_ERROR();
+                    runtimeError(vmptr, "Can only delete from maps.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!checkMapKey(vmptr, peek(vmptr, 0), &key, stats)) return INTERPRET_RUNTIME_ERROR;
+                mapDelete(AS_MAP(peek(vmptr, 1)), key);
+                vmptr->stackTop -= 2;
+                break;
+            }
+            case OP_GET_FIELD: {
+                ObjString* name = READ_STRING();
+                if (!IS_MODULE(peek(vmptr, 0))) {
+                    COUNT_TYPE_ERROR();
+                    runtimeError(vmptr, "Only modules have fields.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ObjModule* module = AS_MODULE(peek(vmptr, 0));
+                if (!tableGet(&module->globals, OBJ_VAL(name), &vmptr->stackTop[-1])) {
+                    runtimeError(vmptr, "Undefined variable '%s' in module %s.", name->chars, module->name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 break;
+            }
             
             case OP_PRINT: {
-                printValue(pop(vmptr));
-                printf("\n");
+                printValue(&vmptr->out, pop(vmptr));
+                endOutputLine(&vmptr->out);
                 break;
             }
             case OP_INPUT: {
-                char buffer[1024];
-                if (fgets(buffer, sizeof(buffer), stdin)) {
-                    buffer[strcspn(buffer, "\n")] = 0;
-                    push(vmptr, OBJ_VAL(copyString(buffer, strlen(buffer))));
+                const char* line;
+                int length;
+                flushOutput(&vmptr->out);
+                if (readLine(&vmptr->in, &line, &length)) {
+                    push(vmptr, OBJ_VAL(copyStringUninterned(&vmptr->heap, line, length)));
                 } else {
                     push(vmptr, NIL_VAL);
                 }
                 break;
             }
+            case OP_INPUT_LINES: {
+                if (!IS_NUMBER(peek(vmptr, 0)) || !(AS_NUMBER(peek(vmptr, 0)) >= 1)) {
+                    COUNT_TYPE_ERROR();
+                    runtimeError(vmptr, "Line count must be a positive number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value lines;
+                if (!inputLines(vmptr, lineCount(pop(vmptr)), &lines)) return INTERPRET_RUNTIME_ERROR;
+                push(vmptr, lines);
+                break;
+            }
             case OP_JUMP: {
                 uint16_t offset = READ_SHORT();
                 vmptr->ip += offset;
@@ -201,30 +901,536 @@ static InterpretResult run(VM* vmptr) {
                 if (isFalsey(peek(vmptr, 0))) vmptr->ip += offset;
                 break;
             }
-            case OP_LOOP: {
+            case OP_JUMP_IF_TRUE: {
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(peek(vmptr, 0))) vmptr->ip += offset;
+                break;
+            }
+            case OP_POP_JUMP_IF_FALSE: {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(pop(vmptr))) vmptr->ip += offset;
+                break;
+            }
+            case OP_POP_JUMP_IF_TRUE: {
                 uint16_t offset = READ_SHORT();
+                if (!isFalsey(pop(vmptr))) vmptr->ip += offset;
+                break;
+            }
+            case OP_LOOP: {
+                offset = READ_SHORT();
+            jumpBack:
+                // Every live value is on the stack, in a global or a constant
+                // between instructions, so loops are where garbage is reclaimed
+                // and where a VM can stop and be resumed later. Every other
+                // path through the code is bounded by its length.
+                if (vmptr->heap.bytesAllocated > vmptr->nextGC ||
+                    vmptr->memory.total > vmptr->memory.limit) {
+                    if (!reclaimMemory(vmptr)) return INTERPRET_RUNTIME_ERROR;
+                }
                 vmptr->ip -= offset;
+                vmptr->fuel -= offset;
+                if (vmptr->fuel <= 0) return INTERPRET_YIELD;
+                break;
+            }
+            case OP_FOR_PREP: {
+                Value* slots = vmptr->stack + READ_BYTE();
+                offset = READ_SHORT();
+                switch (prepareFor(vmptr, slots, stats)) {
+                    case FOR_ERROR: return INTERPRET_RUNTIME_ERROR;
+                    case FOR_SKIP: vmptr->ip += offset; break;
+                    default: break;
+                }
+                break;
+            }
+            case OP_FOR_IN: {
+                Value* slots = vmptr->stack + READ_BYTE();
+                offset = READ_SHORT();
+                switch (nextForIn(vmptr, slots, stats)) {
+                    case FOR_ERROR: return INTERPRET_RUNTIME_ERROR;
+                    case FOR_SKIP: vmptr->ip += offset; break;
+                    default: break;
+                }
+                break;
+            }
+            case OP_FOR_LOOP: {
+                Value* slots = vmptr->stack + READ_BYTE();
+                offset = READ_SHORT();
+                bool more;
+                // Int counters can't overflow: they stop at the limit first.
+                if (IS_INT(slots[0])) {
+                    int64_t step = AS_INT(slots[2]);
+                    int64_t counter = AS_INT(slots[0]) + step;
+                    more = step > 0 ? counter < AS_INT(slots[1]) : counter > AS_INT(slots[1]);
+                    slots[0] = INT_VAL(counter);
+                } else {
+                    double step = AS_DOUBLE(slots[2]);
+                    double counter = AS_DOUBLE(slots[0]) + step;
+                    more = step > 0 ? counter < AS_DOUBLE(slots[1]) : counter > AS_DOUBLE(slots[1]);
+                    slots[0] = DOUBLE_VAL(counter);
+                }
+                if (more) {
+                    slots[3] = slots[0];
+                    // Shares the safepoint with OP_LOOP.
+                    goto jumpBack;
+                }
+                break;
+            }
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                Value callee = peek(vmptr, argCount);
+                if (IS_FUNCTION(callee)) {
+                    ObjFunction* function = AS_FUNCTION(callee);
+                    Value* args = vmptr->stackTop - argCount;
+                    if ((argCount != function->arity) | (vmptr->frameCount == FRAMES_MAX) |
+                        (vmptr->stackLimit - args < function->chunk.maxDepth)) {
+                        if (!prepareCall(vmptr, function, argCount)) return INTERPRET_RUNTIME_ERROR;
+                        args = vmptr->stackTop - argCount;
+                    }
+                    CallFrame* frame = &vmptr->frames[vmptr->frameCount++];
+                    frame->function = function;
+                    frame->chunk = vmptr->chunk;
+                    frame->ip = vmptr->ip;
+                    frame->slots = vmptr->stack;
+                    frame->globals = vmptr->currentGlobals;
+                    vmptr->chunk = &function->chunk;
+                    vmptr->ip = function->chunk.code;
+                    vmptr->stack = args;
+                    vmptr->currentGlobals = globalsOf(vmptr, function);
+                    // Recursion runs without jumping back, so calls are
+                    // safepoints as well, spending fuel by the callee's size.
+                    if (vmptr->heap.bytesAllocated > vmptr->nextGC ||
+                        vmptr->memory.total > vmptr->memory.limit) {
+                        if (!reclaimMemory(vmptr)) return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vmptr->fuel -= function->chunk.count;
+                    if (vmptr->fuel <= 0) return INTERPRET_YIELD;
+                    break;
+                }
+                if (!callValue(vmptr, callee, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (vmptr->memory.total > vmptr->memory.limit && !reclaimMemory(vmptr)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SPAWN: {
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                if (!spawnWorker(vmptr, function)) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
+            case OP_FIBER: {
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                ObjFiber* fiber = newFiber(&vmptr->heap, function);
+                Value* args = vmptr->stackTop - function->arity;
+                memcpy(fiber->stack, args, sizeof(Value) * function->arity);
+                fiber->stackTop = fiber->stack + function->arity;
+                fiber->globals = globalsOf(vmptr, function);
+                vmptr->stackTop = args;
+                push(vmptr, OBJ_VAL(fiber));
+                break;
+            }
+            case OP_RESUME: {
+                Value value = READ_BYTE() == 2 ? pop(vmptr) : NIL_VAL;
+                Value target = pop(vmptr);
+                if (!IS_FIBER(target)) {
+                    COUNT_TYPE_ERROR();
+                    runtimeError(vmptr, "Can only resume fibers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ObjFiber* fiber = AS_FIBER(target);
+                if (fiber->state != FIBER_SUSPENDED) {
+                    runtimeError(vmptr, fiber->state == FIBER_DONE
+                        ? "Can't resume a finished fiber." : "Can't resume a running fiber.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                fiber->caller = vmptr->fiber;
+                fiber->state = FIBER_RUNNING;
+                switchTo(vmptr, fiber);
+                // The value becomes the result of the yield the fiber is
+                // waiting in; the first resume has no yield to answer.
+                if (fiber->started) push(vmptr, value);
+                fiber->started = true;
+                break;
+            }
+            case OP_YIELD: {
+                Value value = pop(vmptr);
+                ObjFiber* fiber = vmptr->fiber;
+                fiber->state = FIBER_SUSPENDED;
+                switchTo(vmptr, fiber->caller);
+                fiber->caller = NULL;
+                push(vmptr, value);
+                break;
+            }
+            case OP_IMPORT: {
+                ObjString* path = READ_STRING();
+                Value module;
+                if (tableGet(&vmptr->modules, OBJ_VAL(path), &module)) {
+                    push(vmptr, module);
+                    break;
+                }
+                if (!importModule(vmptr, path)) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
+            case OP_RETURN_CALL: {
+                Value result = pop(vmptr);
+                CallFrame* frame = &vmptr->frames[--vmptr->frameCount];
+                vmptr->stackTop = vmptr->stack - 1;
+                vmptr->stack = frame->slots;
+                vmptr->chunk = frame->chunk;
+                vmptr->ip = frame->ip;
+                vmptr->currentGlobals = frame->globals;
+                push(vmptr, result);
+                break;
+            }
+            case OP_RETURN: {
+                ObjFiber* fiber = vmptr->fiber;
+                if (fiber == NULL) return INTERPRET_OK;
+                // A finished fiber hands its return value to its resumer.
+                Value value = pop(vmptr);
+                fiber->state = FIBER_DONE;
+                vmptr->stackTop = vmptr->stack;
+                switchTo(vmptr, fiber->caller);
+                fiber->caller = NULL;
+                push(vmptr, value);
                 break;
             }
-            case OP_RETURN: return INTERPRET_OK;
         }
     }
 }
 
-InterpretResult interpret(VM* vmptr, const char* source) {
-    Chunk chunk;
-    initChunk(&chunk);
+// Kept out of line so the plain copy of the loop in run() is compiled on
+// its own, as if the instrumented one did not exist.
+static NOINLINE InterpretResult runInstrumented(VM* vmptr) {
+#ifndef APOLO_NO_STATS
+    return dispatch(vmptr, activeStats, vmptr->trace);
+#else
+    return dispatch(vmptr, NULL, vmptr->trace);
+#endif
+}
+
+static InterpretResult run(VM* vmptr) {
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+#ifndef APOLO_NO_STATS
+    bool instrumented = activeStats != NULL || vmptr->trace != NULL;
+#else
+    bool instrumented = vmptr->trace != NULL;
+#endif
+    InterpretResult result = instrumented ? runInstrumented(vmptr) : dispatch(vmptr, NULL, NULL);
+    useMemoryAccount(previous);
+    return result;
+}
+
+// Spawned blocks run with no standard input and leave their return value
+// on top of the stack.
+static void* runWorker(void* arg) {
+    Worker* worker = (Worker*)arg;
+    VM vm;
+    initVM(&vm);
+    setMemoryLimit(&vm, worker->memoryLimit);
+    useMemoryAccount(&vm.memory);
+    freeOutput(&vm.out);
+    freeOutput(&vm.err);
+    vm.out = worker->out;
+    vm.err = worker->err;
+    freeInput(&vm.in);
+    initInput(&vm.in, NULL);
+    vm.chunk = &worker->function->chunk;
+    vm.ip = vm.chunk->code;
+    growStack(&vm, vm.stack, vm.chunk->maxDepth);
+    for (int i = 0; i < worker->function->arity; i++) {
+        push(&vm, unpackMessage(&vm.heap, &worker->args[i]));
+    }
+    free(worker->args);
+
+    InterpretResult result = run(&vm);
+    if (result == INTERPRET_OK && !packMessage(pop(&vm), &worker->result)) {
+        runtimeError(&vm, "Only nil, booleans, numbers, strings and channels can be returned from spawn.");
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    if (!joinWorkers(&vm)) result = INTERPRET_RUNTIME_ERROR;
+    worker->failed = result != INTERPRET_OK;
+    // What is still buffered goes to the worker for joinWorker() to pass on.
+    flushOutput(&vm.out);
+    flushOutput(&vm.err);
+    worker->out = vm.out;
+    worker->err = vm.err;
+    initOutput(&vm.out, NULL);
+    initOutput(&vm.err, NULL);
+    freeVM(&vm);
+    return NULL;
+}
+
+// A script isn't finished until the blocks it spawned are, so programs and
+// output outlive every thread that uses them.
+static InterpretResult finish(VM* vmptr, InterpretResult result) {
+    if (result == INTERPRET_YIELD) return result;
+    flushOutput(&vmptr->out);
+    if (!joinWorkers(vmptr) && result == INTERPRET_OK) result = INTERPRET_RUNTIME_ERROR;
+    return result;
+}
+
+InterpretResult execute(VM* vmptr, Program* program) {
+    vmptr->chunk = &program->chunk;
+    vmptr->ip = vmptr->chunk->code;
+    resetStack(vmptr);
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    bool room = growStack(vmptr, vmptr->stack, program->chunk.maxDepth);
+    useMemoryAccount(previous);
+    if (!room) return finish(vmptr, INTERPRET_RUNTIME_ERROR);
+    return finish(vmptr, run(vmptr));
+}
+
+// Only valid after execute() or resumeVM() returned INTERPRET_YIELD, and
+// after giving the VM more fuel.
+InterpretResult resumeVM(VM* vmptr) {
+    return finish(vmptr, run(vmptr));
+}
+
+// Ends a yielded script with a runtime error instead of resuming it.
+InterpretResult abortVM(VM* vmptr, const char* message) {
+    runtimeError(vmptr, "%s", message);
+    return finish(vmptr, INTERPRET_RUNTIME_ERROR);
+}
 
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
+// The VM frees the programs it keeps along with itself.
+static void keepProgram(VM* vmptr, Program* program) {
+    if (vmptr->programCapacity < vmptr->programCount + 1) {
+        vmptr->programCapacity = vmptr->programCapacity < 8 ? 8 : vmptr->programCapacity * 2;
+        vmptr->programs = (Program**)realloc(vmptr->programs, sizeof(Program*) * vmptr->programCapacity);
+    }
+    vmptr->programs[vmptr->programCount++] = program;
+}
+
+InterpretResult interpret(VM* vmptr, const char* source) {
+    Program* program = (Program*)malloc(sizeof(Program));
+    initProgram(program);
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    if (!compile(source, program, &vmptr->err)) {
+        freeProgram(program);
+        free(program);
+        useMemoryAccount(previous);
         return INTERPRET_COMPILE_ERROR;
     }
+    useMemoryAccount(previous);
 
-    vmptr->chunk = &chunk;
+    keepProgram(vmptr, program);
+    return execute(vmptr, program);
+}
+// Programs compiled to C run on the same VM: their code keeps the frames,
+// the chunk and the ip the interpreter would, so calls into natives,
+// fibers and runtime errors work on them unchanged.
+InterpretResult executeCompiled(VM* vmptr, Program* program) {
+    keepProgram(vmptr, program);
+    vmptr->chunk = &program->chunk;
     vmptr->ip = vmptr->chunk->code;
+    resetStack(vmptr);
+    MemoryAccount* previous = useMemoryAccount(&vmptr->memory);
+    Value result;
+    bool succeeded = growStack(vmptr, vmptr->stack, program->chunk.maxDepth) &&
+                     aotChunks[0].run(vmptr, &result);
+    useMemoryAccount(previous);
+    return finish(vmptr, succeeded ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR);
+}
 
-    InterpretResult result = run(vmptr);
+void aotUndefined(VM* vmptr, Value name) {
+    runtimeError(vmptr, "Undefined variable '%s'.", AS_CSTRING(name));
+}
 
-    freeChunk(&chunk);
-    return result;
-}
\ No newline at end of file
+void aotNotNumbers(VM* vmptr) {
+    runtimeError(vmptr, "Operands must be numbers.");
+}
+
+void aotNotNumber(VM* vmptr) {
+    runtimeError(vmptr, "Operand must be a number.");
+}
+
+bool aotAdd(VM* vmptr, Value a, Value b, Value* result) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        *result = IS_INT(a) && IS_INT(b) ? intValue(AS_INT(a) + AS_INT(b))
+                                         : DOUBLE_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+    } else if (IS_STRING(a) && IS_STRING(b)) {
+        ObjString* string = concatenate(vmptr, AS_STRING(a), AS_STRING(b));
+        if (string == NULL) return false;
+        *result = OBJ_VAL(string);
+    } else {
+        runtimeError(vmptr, "Operands must be two numbers or two strings.");
+        return false;
+    }
+    return true;
+}
+
+bool aotCollect(VM* vmptr) {
+    return reclaimMemory(vmptr);
+}
+
+bool aotArray(VM* vmptr, Value* elements, int count, Value* result) {
+    ObjArray* array = arrayLiteral(vmptr, elements, count);
+    if (array == NULL) return false;
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+bool aotMap(VM* vmptr, Value* entries, int count, Value* result) {
+    ObjMap* map = newMap(&vmptr->heap);
+    mapReserve(&vmptr->heap, map, count);
+    for (int i = 0; i < count; i++) {
+        if (!setMapElement(vmptr, map, entries[2 * i], entries[2 * i + 1], NULL)) return false;
+    }
+    *result = OBJ_VAL(map);
+    return true;
+}
+
+bool aotGetIndex(VM* vmptr, Value target, Value index, Value* result) {
+    if (IS_MAP(target)) return getMapElement(vmptr, AS_MAP(target), index, result, NULL);
+    int element;
+    if (!arrayIndex(vmptr, target, index, &element, NULL)) return false;
+    *result = arrayGet(AS_ARRAY(target), element);
+    return true;
+}
+
+bool aotSetIndex(VM* vmptr, Value target, Value index, Value value) {
+    if (IS_MAP(target)) return setMapElement(vmptr, AS_MAP(target), index, value, NULL);
+    int element;
+    if (!arrayIndex(vmptr, target, index, &element, NULL)) return false;
+    arraySet(&vmptr->heap, AS_ARRAY(target), element, value);
+    return true;
+}
+
+bool aotDeleteIndex(VM* vmptr, Value target, Value index) {
+    Value key;
+    if (!IS_MAP(target)) {
+        runtimeError(vmptr, "Can only delete from maps.");
+        return false;
+    }
+    if (!checkMapKey(vmptr, index, &key, NULL)) return false;
+    mapDelete(AS_MAP(target), key);
+    return true;
+}
+
+bool aotGetField(VM* vmptr, Value target, Value name, Value* result) {
+    if (!IS_MODULE(target)) {
+        runtimeError(vmptr, "Only modules have fields.");
+        return false;
+    }
+    ObjModule* module = AS_MODULE(target);
+    if (!tableGet(&module->globals, name, result)) {
+        runtimeError(vmptr, "Undefined variable '%s' in module %s.", AS_CSTRING(name), module->name->chars);
+        return false;
+    }
+    return true;
+}
+
+Value aotInput(VM* vmptr) {
+    const char* line;
+    int length;
+    flushOutput(&vmptr->out);
+    if (!readLine(&vmptr->in, &line, &length)) return NIL_VAL;
+    return OBJ_VAL(copyStringUninterned(&vmptr->heap, line, length));
+}
+
+bool aotInputLines(VM* vmptr, Value count, Value* result) {
+    if (!IS_NUMBER(count) || !(AS_NUMBER(count) >= 1)) {
+        runtimeError(vmptr, "Line count must be a positive number.");
+        return false;
+    }
+    return inputLines(vmptr, lineCount(count), result);
+}
+
+ForPrep aotForPrep(VM* vmptr, Value* slots) {
+    return prepareFor(vmptr, slots, NULL);
+}
+
+ForPrep aotForIn(VM* vmptr, Value* slots) {
+    return nextForIn(vmptr, slots, NULL);
+}
+
+// Pushes a frame as OP_CALL does, so the callee finds its arguments at
+// vm->stack and errors inside it report the call it was made from.
+bool aotCall(VM* vmptr, int argCount) {
+    Value callee = vmptr->stackTop[-1 - argCount];
+    if (!IS_FUNCTION(callee)) {
+        if (!callValue(vmptr, callee, argCount)) return false;
+        return vmptr->memory.total <= vmptr->memory.limit || reclaimMemory(vmptr);
+    }
+    ObjFunction* function = AS_FUNCTION(callee);
+    if (!prepareCall(vmptr, function, argCount)) return false;
+    CallFrame* frame = &vmptr->frames[vmptr->frameCount++];
+    frame->function = function;
+    frame->chunk = vmptr->chunk;
+    frame->ip = vmptr->ip;
+    frame->slots = vmptr->stack;
+    frame->globals = vmptr->currentGlobals;
+    vmptr->chunk = &function->chunk;
+    vmptr->ip = function->chunk.code;
+    vmptr->stack = vmptr->stackTop - argCount;
+    vmptr->currentGlobals = globalsOf(vmptr, function);
+    if (vmptr->heap.bytesAllocated > vmptr->nextGC || vmptr->memory.total > vmptr->memory.limit) {
+        if (!reclaimMemory(vmptr)) return false;
+    }
+
+    Value result;
+    if (!aotChunks[function->chunk.id].run(vmptr, &result)) return false;
+    frame = &vmptr->frames[--vmptr->frameCount];
+    vmptr->stackTop = vmptr->stack - 1;
+    vmptr->stack = frame->slots;
+    vmptr->chunk = frame->chunk;
+    vmptr->ip = frame->ip;
+    vmptr->currentGlobals = frame->globals;
+    push(vmptr, result);
+    return true;
+}
+
+bool aotSpawn(VM* vmptr, ObjFunction* function) {
+    return spawnWorker(vmptr, function);
+}
+
+Value aotFiber(VM* vmptr, ObjFunction* function, Value* args) {
+    ObjFiber* fiber = newFiber(&vmptr->heap, function);
+    for (int i = 0; i < function->arity; i++) fiber->stack[i] = args[i];
+    fiber->stackTop = fiber->stack + function->arity;
+    fiber->globals = globalsOf(vmptr, function);
+    return OBJ_VAL(fiber);
+}
+
+// The fiber's body runs until it yields or returns, and switches back here
+// before it does.
+bool aotResume(VM* vmptr, int argCount) {
+    Value value = argCount == 2 ? pop(vmptr) : NIL_VAL;
+    Value target = pop(vmptr);
+    if (!IS_FIBER(target)) {
+        runtimeError(vmptr, "Can only resume fibers.");
+        return false;
+    }
+    ObjFiber* fiber = AS_FIBER(target);
+    if (fiber->state != FIBER_SUSPENDED) {
+        runtimeError(vmptr, fiber->state == FIBER_DONE
+            ? "Can't resume a finished fiber." : "Can't resume a running fiber.");
+        return false;
+    }
+    fiber->caller = vmptr->fiber;
+    fiber->state = FIBER_RUNNING;
+    switchTo(vmptr, fiber);
+    if (fiber->started) push(vmptr, value);
+    fiber->started = true;
+
+    Value result;
+    if (!aotChunks[vmptr->chunk->id].run(vmptr, &result)) return false;
+    push(vmptr, result);
+    return true;
+}
+
+void aotYield(VM* vmptr) {
+    ObjFiber* fiber = vmptr->fiber;
+    fiber->state = FIBER_SUSPENDED;
+    switchTo(vmptr, fiber->caller);
+    fiber->caller = NULL;
+}
+
+void aotFinishFiber(VM* vmptr) {
+    ObjFiber* fiber = vmptr->fiber;
+    fiber->state = FIBER_DONE;
+    vmptr->stackTop = vmptr->stack;
+    switchTo(vmptr, fiber->caller);
+    fiber->caller = NULL;
+}
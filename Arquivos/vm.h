@@ -1,33 +1,148 @@
 #ifndef APOLO_VM_H
 #define APOLO_VM_H
 
+#include <pthread.h>
+
+#include "channel.h"
 #include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
 #include "table.h"
+#include "trace.h"
 #include "value.h"
 
-#define STACK_MAX 256
+#define FRAMES_MAX 1024
+// A runtime error lists only this many of the innermost and of the
+// outermost calls, so a runaway recursion doesn't print all FRAMES_MAX.
+#define ERROR_FRAMES_SHOWN 10
+// Stacks start small and double as code needs more, up to STACK_MAX values.
+#define STACK_INITIAL 256
+#define STACK_MAX (1 << 20)
+#define FUEL_UNLIMITED INT64_MAX
 
+// INTERPRET_YIELD means the VM ran out of fuel and stopped at a safe point;
+// resumeVM() carries on from there.
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD
 } InterpretResult;
 
+// A spawned block running on its own thread, in its own VM. The arguments
+// are moved into that VM when it starts and the return value is moved out
+// when it is joined. Workers not joined by the script are joined when it
+// ends. Each one gets the memory limit of the VM that spawned it, and
+// writes where that VM does: to the same files, or, when the spawner keeps
+// its output in memory as --batch does, to out and err, which joining
+// appends to the spawner's.
+struct Worker {
+    pthread_t thread;
+    ObjFunction* function;
+    Message* args;
+    Message result;
+    Output out;
+    Output err;
+    size_t memoryLimit;
+    bool failed;
+    ObjWorker* handle;
+    struct Worker* next;
+};
+
+// A function call in progress: the chunk, instruction, locals and globals
+// of the code that made it, to go back to when it returns, and the
+// function called. The arguments stay where the caller pushed them and
+// become the callee's first locals, so calls allocate nothing. Importing a
+// module calls its top-level code the same way.
 typedef struct {
+    ObjFunction* function;
+    Chunk* chunk;
+    Byte* ip;
+    Value* slots;
+    Table* globals;
+} CallFrame;
+
+// One interpreter instance. fuel is spent at every backward jump, by the
+// size of the loop body in bytes; when it drops to zero or below the VM
+// yields. It starts out unlimited. chunk, ip, stack and stackTop belong to the
+// code running now: the script itself, on rootStack, or the fiber it (or
+// another fiber) resumed. stack is where that code's locals start, which
+// is further up when it is a function; stackLimit is the end of the array
+// it is on. push() never checks for room: entering a chunk makes room for
+// its maxDepth first, moving the array if it has to grow. While a fiber
+// runs, the root fields hold where the script stopped. Switching fibers
+// only swaps these pointers. Function calls in the script and in every
+// fiber share frames: a fiber can only yield from its own body, so the
+// calls it made have all returned by then. currentGlobals is where the
+// running code's globals live: globals for the script and the functions
+// it compiled, or the namespace of the module the code came from. modules
+// finds each module this VM imported by the path it was imported under,
+// and imported by its number; natives is what a module's globals start
+// out as. VMs share nothing with each other, so each can run on its own
+// thread; the programs they execute are read-only.
+typedef struct VM {
     Chunk* chunk;
     Byte* ip;
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stackTop;
+    Value* stackLimit;
+    Table* currentGlobals;
+    int frameCount;
+    CallFrame frames[FRAMES_MAX];
+    ObjFiber* fiber;
+    Chunk* rootChunk;
+    Byte* rootIp;
+    Value* rootSlots;
+    Value* rootStackTop;
+    Table* rootGlobals;
+    Value* rootStack;
+    int rootCapacity;
+    int64_t fuel;
     Table globals;
-    Table strings;
-    Obj* objects;
+    Table natives;
+    Table modules;
+    int importedCapacity;
+    ObjModule** imported;
+    Heap heap;
+    size_t nextGC;
+    MemoryAccount memory;
+    Trace* trace;
+    int grayCount;
+    int grayCapacity;
+    Obj** grayStack;
+    Output out;
+    Output err;
+    Input in;
+    int programCount;
+    int programCapacity;
+    Program** programs;
+    Worker* workers;
 } VM;
 
-extern VM vm;
-
+// Embedding: compile() a script once into a Program, then execute() it on
+// as many VMs as needed. Globals set by a run may point into the program,
+// so it must outlive the VMs that executed it. interpret() compiles and
+// runs in one step, keeping the program alive until freeVM() or resetVM(),
+// which clears a VM for the next script without giving back its buffers.
+// The VM's memory account is charged for what it and the programs it
+// compiles allocate; a script that goes over its limit ends with a runtime
+// error at the next loop iteration or call, or at once when a single
+// request is bigger than the limit. With trace set, the VM records
+// every instruction it runs there and dumps it on a runtime error.
 void initVM(VM* vm);
 void freeVM(VM* vm);
+void resetVM(VM* vm);
+InterpretResult execute(VM* vm, Program* program);
+InterpretResult resumeVM(VM* vm);
+InterpretResult abortVM(VM* vm, const char* message);
 InterpretResult interpret(VM* vm, const char* source);
+bool joinWorker(VM* vm, Worker* worker);
+// MEMORY_UNLIMITED, the default, removes the limit.
+void setMemoryLimit(VM* vm, size_t bytes);
+void runtimeError(VM* vm, const char* format, ...);
+// Reports that bytes more couldn't be had from tryReallocate().
+void allocationError(VM* vm, size_t bytes);
 void push(VM* vm, Value value);
 Value pop(VM* vm);
 
@@ -0,0 +1,213 @@
+// Runs the benchmark suite: each case several times as a separate process,
+// reporting the median wall time, instructions per second and peak RSS, and
+// comparing the median against a saved baseline. Normally driven by the
+// Makefile in this directory; by hand:
+//   ./harness [-n runs] [-b baseline] [-s save] apolo name:script[:stdin] ...
+//
+// Instructions are counted in one extra run with --stats=json, so the
+// interpreter must not be built with APOLO_NO_STATS for that column.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CASES 64
+#define MAX_RUNS 100
+
+typedef struct {
+    char name[64];
+    double median;
+    double instructions;
+    long peakKilobytes;
+    bool failed;
+} Result;
+
+typedef struct {
+    char name[64];
+    double median;
+} BaselineEntry;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs apolo on script with stdin from input (or /dev/null) and stdout
+// discarded. stderr goes to errors when given, and is discarded otherwise.
+// Returns the exit status, or -1 if the process could not be run.
+static int runOnce(const char* apolo, const char* flag, const char* script, const char* input,
+                   const char* errors, double* seconds, long* peakKilobytes) {
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int in = open(input != NULL ? input : "/dev/null", O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        int err = errors != NULL ? open(errors, O_WRONLY | O_CREAT | O_TRUNC, 0644) : out;
+        if (in < 0 || out < 0 || err < 0) _exit(127);
+        dup2(in, 0);
+        dup2(out, 1);
+        dup2(err, 2);
+        if (flag != NULL) {
+            execl(apolo, apolo, flag, script, (char*)NULL);
+        } else {
+            execl(apolo, apolo, script, (char*)NULL);
+        }
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) return -1;
+    *seconds = now() - start;
+    *peakKilobytes = usage.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Adds up the opcode counts in the one-line JSON that --stats=json prints.
+static double countInstructions(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return 0;
+    char line[8192];
+    double total = 0;
+    if (fgets(line, sizeof(line), file) != NULL) {
+        char* opcodes = strstr(line, "\"opcodes\":{");
+        char* end = opcodes != NULL ? strchr(opcodes, '}') : NULL;
+        for (char* c = opcodes; c != NULL && c < end; c++) {
+            if (*c == ':' && c[1] >= '0' && c[1] <= '9') total += strtod(c + 1, NULL);
+        }
+    }
+    fclose(file);
+    return total;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static bool runCase(const char* apolo, char* spec, int runs, Result* result) {
+    char* script = strchr(spec, ':');
+    if (script == NULL) return false;
+    *script++ = '\0';
+    char* input = strchr(script, ':');
+    if (input != NULL) *input++ = '\0';
+    snprintf(result->name, sizeof(result->name), "%s", spec);
+    result->failed = false;
+    result->peakKilobytes = 0;
+
+    char statsPath[] = "/tmp/apolo-bench-XXXXXX";
+    int statsFile = mkstemp(statsPath);
+    if (statsFile < 0) return false;
+    close(statsFile);
+    double seconds;
+    long peak;
+    result->instructions = 0;
+    if (runOnce(apolo, "--stats=json", script, input, statsPath, &seconds, &peak) == 0) {
+        result->instructions = countInstructions(statsPath);
+    }
+    unlink(statsPath);
+
+    double times[MAX_RUNS];
+    for (int i = 0; i < runs; i++) {
+        if (runOnce(apolo, NULL, script, input, NULL, &times[i], &peak) != 0) {
+            result->failed = true;
+            return true;
+        }
+        if (peak > result->peakKilobytes) result->peakKilobytes = peak;
+    }
+    qsort(times, runs, sizeof(double), compareDoubles);
+    result->median = runs % 2 == 1 ? times[runs / 2]
+                                   : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    return true;
+}
+
+static int loadBaseline(const char* path, BaselineEntry* entries) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return 0;
+    int count = 0;
+    char line[256];
+    while (count < MAX_CASES && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%63s %lf", entries[count].name, &entries[count].median) == 2) count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: harness [-n runs] [-b baseline] [-s save] apolo name:script[:stdin] ...\n");
+    exit(64);
+}
+
+int main(int argc, char* argv[]) {
+    int runs = 5;
+    const char* baselinePath = NULL;
+    const char* savePath = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "n:b:s:")) != -1) {
+        switch (option) {
+            case 'n': runs = atoi(optarg); break;
+            case 'b': baselinePath = optarg; break;
+            case 's': savePath = optarg; break;
+            default: usage();
+        }
+    }
+    if (runs < 1 || runs > MAX_RUNS || argc - optind < 2 || argc - optind - 1 > MAX_CASES) usage();
+    const char* apolo = argv[optind];
+
+    BaselineEntry baseline[MAX_CASES];
+    int baselineCount = baselinePath != NULL ? loadBaseline(baselinePath, baseline) : 0;
+
+    Result results[MAX_CASES];
+    int count = 0;
+    bool failed = false;
+    printf("%-12s %10s %14s %10s %10s\n", "benchmark", "median", "instr/s", "peak RSS", "baseline");
+    for (int i = optind + 1; i < argc; i++) {
+        Result* result = &results[count];
+        if (!runCase(apolo, argv[i], runs, result)) usage();
+        count++;
+        if (result->failed) {
+            printf("%-12s %10s\n", result->name, "failed");
+            failed = true;
+            continue;
+        }
+        printf("%-12s %8.3f s", result->name, result->median);
+        if (result->instructions > 0) {
+            printf(" %12.1fM", result->instructions / result->median / 1e6);
+        } else {
+            printf(" %13s", "-");
+        }
+        printf(" %7.1f MB", result->peakKilobytes / 1024.0);
+        for (int j = 0; j < baselineCount; j++) {
+            if (strcmp(baseline[j].name, result->name) != 0) continue;
+            printf(" %+9.1f%%", 100.0 * (result->median - baseline[j].median) / baseline[j].median);
+            break;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (savePath != NULL) {
+        FILE* file = fopen(savePath, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Could not write \"%s\".\n", savePath);
+            return 74;
+        }
+        fprintf(file, "# benchmark median-seconds instructions peak-kilobytes\n");
+        for (int i = 0; i < count; i++) {
+            if (results[i].failed) continue;
+            fprintf(file, "%s %.6f %.0f %ld\n", results[i].name, results[i].median,
+                    results[i].instructions, results[i].peakKilobytes);
+        }
+        fclose(file);
+    }
+    return failed ? 1 : 0;
+}
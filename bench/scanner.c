@@ -0,0 +1,71 @@
+// Scanner throughput benchmark.
+//
+// Build from the repository root, once with the SIMD paths and once with the
+// scalar fallback to compare them:
+//   gcc -O2 -IArquivos bench/scanner.c Arquivos/scanner.c -o scanbench
+//   gcc -O2 -IArquivos -DAPOLO_NO_SIMD bench/scanner.c Arquivos/scanner.c -o scanbench
+//   ./scanbench [megabytes] [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+
+static const char* fragments[] = {
+    "var totalAccumulatedValue = previousValue + 12.5;\n",
+    "    # a generated comment that is deliberately rather long to skip\n",
+    "print \"a string literal with some words in it\";\n",
+    "while (counter < limit) { counter = counter + 1; }\n",
+    "\t\t\n\n    \r\n",
+    "var message = \"line one\nline two\";\n",
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 64;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    size_t size = megabytes * 1024 * 1024;
+
+    char* source = (char*)malloc(size + 1);
+    size_t length = 0;
+    for (int i = 0;; i++) {
+        const char* fragment = fragments[i % (sizeof(fragments) / sizeof(fragments[0]))];
+        size_t fragmentLength = strlen(fragment);
+        if (length + fragmentLength > size) break;
+        memcpy(source + length, fragment, fragmentLength);
+        length += fragmentLength;
+    }
+    source[length] = '\0';
+
+    double best = 0;
+    long tokens = 0;
+    int lines = 0;
+    for (int round = 0; round < rounds; round++) {
+        double start = now();
+        Scanner scanner;
+        initScanner(&scanner, source);
+        tokens = 0;
+        for (;;) {
+            Token token = scanToken(&scanner);
+            if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) {
+                lines = token.line;
+                break;
+            }
+            tokens++;
+        }
+        double rate = length / (now() - start) / (1024 * 1024);
+        if (rate > best) best = rate;
+    }
+
+    printf("%zu bytes, %ld tokens, %d lines: %.1f MB/s (best of %d)\n",
+           length, tokens, lines, best, rounds);
+    free(source);
+    return 0;
+}
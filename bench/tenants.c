@@ -0,0 +1,92 @@
+// Time slicing: runs one script on many VMs interleaved by the round-robin
+// scheduler, next to a tenant stuck in an endless loop that is stopped once
+// it has burnt its fuel allowance, and compares with running the same VMs
+// one after the other. Output is kept in memory and discarded.
+//
+// Build from the repository root:
+//   gcc -O2 -IArquivos bench/tenants.c $(ls Arquivos/*.c | grep -v main.c) -o tenantbench -lpthread
+//   ./tenantbench bench/threads.apo [tenants] [slice]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "io.h"
+#include "scheduler.h"
+#include "vm.h"
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void initTenant(VM* vm) {
+    initVM(vm);
+    initOutput(&vm->out, NULL);
+    initOutput(&vm->err, NULL);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: tenantbench script [tenants] [slice]\n");
+        return 64;
+    }
+    int tenants = argc > 2 ? atoi(argv[2]) : 1000;
+    int64_t slice = argc > 3 ? atoll(argv[3]) : 10000;
+
+    FileView source;
+    if (!openFileView(argv[1], &source)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[1]);
+        return 74;
+    }
+    Output errors;
+    initOutput(&errors, stderr);
+    Program program;
+    initProgram(&program);
+    Program runaway;
+    initProgram(&runaway);
+    if (!compile(source.chars, &program, &errors)) return 65;
+    if (!compile("while (true) {}", &runaway, &errors)) return 65;
+
+    VM* vms = (VM*)malloc(sizeof(VM) * (tenants + 1));
+    double start = now();
+    for (int i = 0; i < tenants; i++) {
+        initTenant(&vms[i]);
+        execute(&vms[i], &program);
+        freeVM(&vms[i]);
+    }
+    double sequential = now() - start;
+
+    Scheduler scheduler;
+    initScheduler(&scheduler, slice);
+    for (int i = 0; i < tenants; i++) {
+        initTenant(&vms[i]);
+        scheduleTask(&scheduler, &vms[i], &program, 0);
+    }
+    initTenant(&vms[tenants]);
+    int stuck = scheduleTask(&scheduler, &vms[tenants], &runaway, slice * 100);
+
+    start = now();
+    int rounds = 0;
+    int64_t fuel = 0;
+    while (stepScheduler(&scheduler) > 0) rounds++;
+    double sliced = now() - start;
+    for (int i = 0; i < scheduler.count; i++) fuel += scheduler.tasks[i].fuelUsed;
+
+    printf("%d tenants, slice %lld: sequential %.3f s, time-sliced %.3f s (%+.1f%%)\n",
+           tenants, (long long)slice, sequential, sliced, (sliced / sequential - 1) * 100);
+    printf("%d rounds, %.1f M fuel, runaway tenant %s after %lld fuel\n", rounds, fuel / 1e6,
+           scheduler.tasks[stuck].result == INTERPRET_RUNTIME_ERROR ? "stopped" : "not stopped",
+           (long long)scheduler.tasks[stuck].fuelUsed);
+
+    for (int i = 0; i <= tenants; i++) freeVM(&vms[i]);
+    free(vms);
+    freeScheduler(&scheduler);
+    freeProgram(&program);
+    freeProgram(&runaway);
+    freeOutput(&errors);
+    closeFileView(&source);
+    return 0;
+}
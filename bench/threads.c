@@ -0,0 +1,89 @@
+// Multithreaded throughput of the embedding API: one script is compiled
+// once and executed repeatedly by one VM per thread, for 1, 2, 4, ... up to
+// the given number of threads. Output is kept in memory and discarded.
+//
+// Build from the repository root:
+//   gcc -O2 -IArquivos bench/threads.c $(ls Arquivos/*.c | grep -v main.c) -o threadbench -lpthread
+//   ./threadbench bench/threads.apo [threads] [runs per thread]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "io.h"
+#include "vm.h"
+
+typedef struct {
+    Program* program;
+    int runs;
+    int failures;
+} ThreadRun;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* work(void* arg) {
+    ThreadRun* run = (ThreadRun*)arg;
+    VM vm;
+    initVM(&vm);
+    vm.out.file = NULL;
+    vm.out.lineBuffered = false;
+    for (int i = 0; i < run->runs; i++) {
+        if (execute(&vm, run->program) != INTERPRET_OK) run->failures++;
+        vm.out.count = 0;
+    }
+    freeVM(&vm);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: threadbench script [threads] [runs]\n");
+        return 64;
+    }
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+    int runs = argc > 3 ? atoi(argv[3]) : 200;
+
+    FileView source;
+    if (!openFileView(argv[1], &source)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[1]);
+        return 74;
+    }
+    Program program;
+    initProgram(&program);
+    Output errors;
+    initOutput(&errors, stderr);
+    if (!compile(source.chars, &program, &errors)) return 65;
+    freeOutput(&errors);
+
+    double single = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        pthread_t* ids = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+        ThreadRun* threadRuns = (ThreadRun*)malloc(sizeof(ThreadRun) * threads);
+        double start = now();
+        for (int i = 0; i < threads; i++) {
+            threadRuns[i] = (ThreadRun){&program, runs, 0};
+            pthread_create(&ids[i], NULL, work, &threadRuns[i]);
+        }
+        int failures = 0;
+        for (int i = 0; i < threads; i++) {
+            pthread_join(ids[i], NULL);
+            failures += threadRuns[i].failures;
+        }
+        double rate = threads * runs / (now() - start);
+        if (threads == 1) single = rate;
+        printf("%2d threads: %9.1f runs/s (%.2fx)%s\n", threads, rate, rate / single,
+               failures > 0 ? ", with failures" : "");
+        free(ids);
+        free(threadRuns);
+    }
+
+    freeProgram(&program);
+    closeFileView(&source);
+    return 0;
+}